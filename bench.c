@@ -0,0 +1,597 @@
+// bench.c -- load generator and latency benchmark mode for the client (client --bench)
+// drives N connections from one poll() loop, so the generator itself stays cheap
+// and the numbers describe the server, not client threads fighting for the CPU
+//
+// closed loop (-r 0): every connection has one request in flight, the next goes out as soon as the reply ends
+// open loop (-r R): R requests per second in total are scheduled at fixed intervals and spread across connections
+//   latency is measured from the scheduled send time, not the actual one -- a stalled server
+//   shows up as latency instead of silently lowering the request rate (coordinated omission)
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// system headers
+#include <errno.h>       // errno for error handling
+#include <poll.h>        // poll() over every connection
+#include <time.h>        // clock_gettime() for latencies
+#include <sys/socket.h>  // send(), recv()
+
+#include "protocol.h"
+#include "histogram.h"
+#include "bench.h"
+
+
+// BENCH configuration constants
+#define BENCH_SERVER_IP "127.0.0.1"         // default server IP (localhost)
+#define BENCH_PORT 8080                     // default server port
+#define BENCH_MAX_COMMAND 4096              // longest request line the server accepts, newline included
+#define BENCH_MAX_CONNS 1024                // -c upper bound
+#define BENCH_MAX_MIX 32                    // -m entries
+#define BENCH_RECV_SIZE (64 * 1024)         // per connection -- output payloads are skipped, not kept
+#define BENCH_SEND_SIZE (16 * 1024)         // per connection -- requests not yet accepted by the socket
+#define BENCH_PENDING_MAX 1024              // per connection -- requests in flight in open loop
+#define BENCH_DRAIN_SEC 5.0                 // how long to wait for in-flight replies after the run
+#define DEFAULT_BENCH_CONNS 4
+#define DEFAULT_BENCH_DURATION 10.0
+#define DEFAULT_BENCH_COMMAND "echo bench"
+
+#define NSEC_PER_SEC 1000000000ULL
+
+
+// one entry of the command mix
+typedef struct {
+    char* line;               // command with its trailing newline, ready to send
+    size_t len;
+    unsigned weight;          // relative share of requests
+    histogram_t latency;      // per-command latency
+    uint64_t errors;          // replies whose status was not ok
+} bench_mix_t;
+
+// what to run and how hard
+typedef struct {
+    const char* server_ip;
+    int port;
+    int conns;                // concurrent connections
+    double duration;          // seconds of load
+    double rate;              // total requests per second, 0 = closed loop
+    bench_mix_t* mix;
+    int mix_count;
+    unsigned total_weight;
+} bench_options_t;
+
+// a request that has been queued but whose end frame has not arrived
+typedef struct {
+    uint64_t start_ns;        // scheduled (open loop) or actual (closed loop) send time
+    int mix;                  // which command
+} bench_request_t;
+
+// per-connection state
+typedef struct {
+    int fd;                   // -1 once the connection is gone
+    char* recv_buf;
+    size_t recv_len;
+    size_t skip;              // output payload bytes still to discard
+    char* send_buf;
+    size_t send_len;
+    bench_request_t* pending; // ring buffer, oldest first
+    int pending_head;
+    int pending_count;
+} bench_conn_t;
+
+// results for the whole run
+typedef struct {
+    histogram_t latency;
+    uint64_t replies[REPLY_ERROR + 1];  // indexed by reply_status_t
+    uint64_t completed;
+    uint64_t disconnects;     // connections lost before the run ended
+    uint64_t incomplete;      // requests still without a reply at the drain deadline
+    uint64_t last_reply_ns;
+} bench_stats_t;
+
+
+// function prototypes
+
+// options
+int parse_bench_options(int argc, char* argv[], bench_options_t* options);
+int add_bench_command(bench_options_t* options, const char* spec);
+void print_bench_usage(void);
+void free_bench_options(bench_options_t* options);
+
+// connections and requests
+int bench_conn_open(bench_conn_t* conn, const bench_options_t* options);
+void bench_conn_close(bench_conn_t* conn, bench_stats_t* stats);
+int bench_queue_request(bench_conn_t* conn, const bench_options_t* options, int mix, uint64_t start_ns);
+int bench_flush(bench_conn_t* conn);
+int bench_receive(bench_conn_t* conn, bench_options_t* options, bench_stats_t* stats, int* finished);
+int pick_mix(const bench_options_t* options, uint64_t* rng);
+
+// reporting
+void print_bench_report(const bench_options_t* options, const bench_stats_t* stats, uint64_t elapsed_ns);
+uint64_t now_ns(void);
+
+
+// benchmark entry point
+int run_bench(int argc, char* argv[]) {
+    bench_options_t options;
+    if (parse_bench_options(argc, argv, &options) == -1) {
+        free_bench_options(&options);
+        return EXIT_FAILURE;
+    }
+
+    bench_conn_t* conns = calloc((size_t)options.conns, sizeof(bench_conn_t));
+    struct pollfd* fds = calloc((size_t)options.conns, sizeof(struct pollfd));
+    bench_stats_t* stats = malloc(sizeof(bench_stats_t));
+    if (conns == NULL || fds == NULL || stats == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        free(conns);
+        free(fds);
+        free(stats);
+        free_bench_options(&options);
+        return EXIT_FAILURE;
+    }
+    memset(stats, 0, sizeof(*stats));
+    hist_init(&stats->latency);
+
+    // connect everything before the clock starts -- connection setup is not what we measure
+    int open_conns = 0;
+    for (int i = 0; i < options.conns; i++) {
+        conns[i].fd = -1;
+        if (bench_conn_open(&conns[i], &options) == 0) open_conns++;
+    }
+    if (open_conns == 0) {
+        fprintf(stderr, "Error: bench could not open any connection\n");
+    }
+
+    uint64_t rng = 0x9e3779b97f4a7c15ULL;   // fixed seed -- the same mix sequence every run
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t)(options.duration * (double)NSEC_PER_SEC);
+    uint64_t drain_end = end + (uint64_t)(BENCH_DRAIN_SEC * (double)NSEC_PER_SEC);
+    uint64_t interval = (options.rate > 0) ? (uint64_t)((double)NSEC_PER_SEC / options.rate) : 0;
+    if (options.rate > 0 && interval == 0) interval = 1;
+    uint64_t next_send = start;
+    int next_conn = 0;
+
+    // closed loop -- prime every connection with its first request
+    if (options.rate <= 0) {
+        for (int i = 0; i < options.conns; i++) {
+            if (conns[i].fd >= 0) bench_queue_request(&conns[i], &options, pick_mix(&options, &rng), start);
+        }
+    }
+
+    while (open_conns > 0) {
+        uint64_t now = now_ns();
+        int in_flight = 0;
+        for (int i = 0; i < options.conns; i++) in_flight += conns[i].pending_count;
+
+        if (now >= end && (in_flight == 0 || now >= drain_end)) break;
+
+        // open loop -- send everything that is due, round robin over the connections
+        // a request that finds every connection full stays due; its latency keeps growing meanwhile
+        if (options.rate > 0) {
+            while (next_send <= now && next_send < end) {
+                int sent = 0;
+                for (int tries = 0; tries < options.conns && !sent; tries++) {
+                    bench_conn_t* conn = &conns[next_conn];
+                    next_conn = (next_conn + 1) % options.conns;
+                    if (conn->fd >= 0 && bench_queue_request(conn, &options, pick_mix(&options, &rng), next_send) == 0) {
+                        sent = 1;
+                    }
+                }
+                if (!sent) break;
+                next_send += interval;
+            }
+        }
+
+        // sleep until the next event -- a reply, room to send, the next scheduled request or the end of the run
+        uint64_t wake = (now < end) ? end : drain_end;
+        if (options.rate > 0 && next_send < end && next_send < wake) wake = next_send;
+        int wait_ms = (wake > now) ? (int)((wake - now + 999999) / 1000000) : 0;
+
+        for (int i = 0; i < options.conns; i++) {
+            fds[i].fd = conns[i].fd;
+            fds[i].events = POLLIN | ((conns[i].send_len > 0) ? POLLOUT : 0);
+            fds[i].revents = 0;
+        }
+
+        int ready = poll(fds, (nfds_t)options.conns, wait_ms);
+        if (ready == -1) {
+            if (errno == EINTR) continue;
+            perror("Error: poll failed");
+            break;
+        }
+
+        for (int i = 0; i < options.conns && ready > 0; i++) {
+            bench_conn_t* conn = &conns[i];
+            if (conn->fd < 0 || fds[i].revents == 0) continue;
+
+            int failed = 0;
+            if (fds[i].revents & POLLOUT) failed = (bench_flush(conn) == -1);
+
+            int finished = 0;
+            if (!failed && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                failed = (bench_receive(conn, &options, stats, &finished) == -1);
+            }
+
+            if (failed) {
+                if (now_ns() < end) stats->disconnects++;
+                bench_conn_close(conn, stats);
+                open_conns--;
+                continue;
+            }
+
+            // closed loop -- replace every finished request while the run lasts
+            uint64_t after = now_ns();
+            if (options.rate <= 0 && after < end) {
+                for (int k = 0; k < finished; k++) {
+                    bench_queue_request(conn, &options, pick_mix(&options, &rng), after);
+                }
+            }
+        }
+    }
+
+    // whatever is still in flight never got a reply
+    for (int i = 0; i < options.conns; i++) bench_conn_close(&conns[i], stats);
+
+    uint64_t elapsed = (stats->last_reply_ns > start) ? stats->last_reply_ns - start : now_ns() - start;
+    print_bench_report(&options, stats, elapsed);
+
+    int failed = stats->completed == 0 || stats->incomplete > 0 || stats->disconnects > 0 ||
+                 stats->replies[REPLY_OK] != stats->completed;
+
+    free(conns);
+    free(fds);
+    free(stats);
+    free_bench_options(&options);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+// bench options
+// Usage: ./client --bench [-c conns] [-d seconds] [-r rate] [-m [weight:]command]... [server_ip] [port]
+// returns 0 on success, -1 on invalid options (usage already printed)
+int parse_bench_options(int argc, char* argv[], bench_options_t* options) {
+    int opt;
+
+    memset(options, 0, sizeof(*options));
+    options->server_ip = BENCH_SERVER_IP;
+    options->port = BENCH_PORT;
+    options->conns = DEFAULT_BENCH_CONNS;
+    options->duration = DEFAULT_BENCH_DURATION;
+
+    options->mix = calloc(BENCH_MAX_MIX, sizeof(bench_mix_t));
+    if (options->mix == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return -1;
+    }
+
+    optind = 1;
+    while ((opt = getopt(argc, argv, "c:d:r:m:")) != -1) {
+        char* end = NULL;
+        switch (opt) {
+            case 'c':
+                options->conns = (int)strtol(optarg, &end, 10);
+                if (*end != '\0' || options->conns < 1 || options->conns > BENCH_MAX_CONNS) {
+                    fprintf(stderr, "Error: Invalid connection count: %s (1-%d)\n", optarg, BENCH_MAX_CONNS);
+                    return -1;
+                }
+                break;
+            case 'd':
+                options->duration = strtod(optarg, &end);
+                if (*end != '\0' || options->duration <= 0) {
+                    fprintf(stderr, "Error: Invalid duration: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'r':
+                options->rate = strtod(optarg, &end);
+                if (*end != '\0' || options->rate < 0) {
+                    fprintf(stderr, "Error: Invalid rate: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'm':
+                if (add_bench_command(options, optarg) == -1) return -1;
+                break;
+            default:
+                print_bench_usage();
+                return -1;
+        }
+    }
+
+    // optional positional arguments, same as the interactive client
+    if (optind < argc) options->server_ip = argv[optind++];
+    if (optind < argc) {
+        options->port = atoi(argv[optind++]);
+        if (options->port <= 0 || options->port > 65535) {
+            fprintf(stderr, "Error: Invalid port number: %s\n", argv[optind - 1]);
+            return -1;
+        }
+    }
+    if (optind < argc) {
+        print_bench_usage();
+        return -1;
+    }
+
+    if (options->mix_count == 0 && add_bench_command(options, DEFAULT_BENCH_COMMAND) == -1) return -1;
+    return 0;
+}
+
+// adds one "[weight:]command" entry to the mix -- returns 0 on success, -1 on a bad entry
+int add_bench_command(bench_options_t* options, const char* spec) {
+    if (options->mix_count == BENCH_MAX_MIX) {
+        fprintf(stderr, "Error: Too many bench commands (max %d)\n", BENCH_MAX_MIX);
+        return -1;
+    }
+
+    // a leading run of digits followed by ':' is the weight
+    unsigned weight = 1;
+    const char* command = spec;
+    const char* p = spec;
+    while (*p >= '0' && *p <= '9') p++;
+    if (p > spec && *p == ':') {
+        weight = (unsigned)strtoul(spec, NULL, 10);
+        command = p + 1;
+    }
+
+    size_t len = strlen(command);
+    if (weight == 0 || len == 0 || len + 1 > BENCH_MAX_COMMAND || strchr(command, '\n') != NULL) {
+        fprintf(stderr, "Error: Invalid bench command: %s\n", spec);
+        return -1;
+    }
+
+    bench_mix_t* mix = &options->mix[options->mix_count];
+    mix->line = malloc(len + 2);
+    if (mix->line == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return -1;
+    }
+    memcpy(mix->line, command, len);
+    mix->line[len] = '\n';
+    mix->line[len + 1] = '\0';
+    mix->len = len + 1;
+    mix->weight = weight;
+    hist_init(&mix->latency);
+
+    options->mix_count++;
+    options->total_weight += weight;
+    return 0;
+}
+
+void print_bench_usage(void) {
+    fprintf(stderr, "Usage: client --bench [-c conns] [-d seconds] [-r rate] [-m [weight:]command]... [server_ip] [port]\n");
+    fprintf(stderr, "  -c conns     concurrent connections (default %d)\n", DEFAULT_BENCH_CONNS);
+    fprintf(stderr, "  -d seconds   length of the run (default %.0f)\n", DEFAULT_BENCH_DURATION);
+    fprintf(stderr, "  -r rate      total requests per second, 0 = closed loop (default 0)\n");
+    fprintf(stderr, "  -m command   add a command to the mix, optionally weighted as \"3:ls -l\" (default \"%s\")\n",
+            DEFAULT_BENCH_COMMAND);
+}
+
+void free_bench_options(bench_options_t* options) {
+    if (options->mix == NULL) return;
+    for (int i = 0; i < options->mix_count; i++) free(options->mix[i].line);
+    free(options->mix);
+    options->mix = NULL;
+}
+
+
+// connections and requests
+// returns 0 on success, -1 if the connection could not be set up (error already printed)
+int bench_conn_open(bench_conn_t* conn, const bench_options_t* options) {
+    memset(conn, 0, sizeof(*conn));
+    conn->fd = -1;
+
+    conn->recv_buf = malloc(BENCH_RECV_SIZE);
+    conn->send_buf = malloc(BENCH_SEND_SIZE);
+    conn->pending = malloc(BENCH_PENDING_MAX * sizeof(bench_request_t));
+    if (conn->recv_buf == NULL || conn->send_buf == NULL || conn->pending == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        bench_conn_close(conn, NULL);
+        return -1;
+    }
+
+    conn->fd = create_and_connect_socket(options->server_ip, options->port);
+    if (conn->fd == -1) {
+        bench_conn_close(conn, NULL);
+        return -1;
+    }
+    return 0;
+}
+
+// closes the socket and frees the buffers -- safe to call more than once
+void bench_conn_close(bench_conn_t* conn, bench_stats_t* stats) {
+    if (stats != NULL) stats->incomplete += (uint64_t)conn->pending_count;
+    conn->pending_count = 0;
+
+    if (conn->fd >= 0) close(conn->fd);
+    conn->fd = -1;
+    free(conn->recv_buf);
+    free(conn->send_buf);
+    free(conn->pending);
+    conn->recv_buf = NULL;
+    conn->send_buf = NULL;
+    conn->pending = NULL;
+}
+
+// queues one request and tries to send it right away
+// returns 0 when queued, -1 when the connection has no room (caller tries another one)
+int bench_queue_request(bench_conn_t* conn, const bench_options_t* options, int mix, uint64_t start_ns) {
+    const bench_mix_t* entry = &options->mix[mix];
+    if (conn->pending_count == BENCH_PENDING_MAX || conn->send_len + entry->len > BENCH_SEND_SIZE) return -1;
+
+    memcpy(conn->send_buf + conn->send_len, entry->line, entry->len);
+    conn->send_len += entry->len;
+
+    bench_request_t* request = &conn->pending[(conn->pending_head + conn->pending_count) % BENCH_PENDING_MAX];
+    request->start_ns = start_ns;
+    request->mix = mix;
+    conn->pending_count++;
+
+    // a send failure shows up as POLLERR/POLLHUP on the next poll()
+    bench_flush(conn);
+    return 0;
+}
+
+// sends as much of the send buffer as the socket takes without blocking
+// returns 0 on success (possibly with bytes left over), -1 if the connection failed
+int bench_flush(bench_conn_t* conn) {
+    while (conn->send_len > 0) {
+        ssize_t sent = send(conn->fd, conn->send_buf, conn->send_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        memmove(conn->send_buf, conn->send_buf + sent, conn->send_len - (size_t)sent);
+        conn->send_len -= (size_t)sent;
+    }
+    return 0;
+}
+
+// reads whatever the server sent and completes every request whose end frame arrived
+// output frames are skipped without being kept -- only the end frame matters here
+// returns 0 on success (finished = requests completed), -1 on EOF, error or a protocol violation
+int bench_receive(bench_conn_t* conn, bench_options_t* options, bench_stats_t* stats, int* finished) {
+    *finished = 0;
+
+    ssize_t bytes = recv(conn->fd, conn->recv_buf + conn->recv_len, BENCH_RECV_SIZE - conn->recv_len, MSG_DONTWAIT);
+    if (bytes == 0) return -1;
+    if (bytes == -1) return (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    conn->recv_len += (size_t)bytes;
+
+    uint64_t arrived = now_ns();
+    size_t pos = 0;
+    while (pos < conn->recv_len) {
+        size_t avail = conn->recv_len - pos;
+
+        // discard output payload
+        if (conn->skip > 0) {
+            size_t take = (conn->skip < avail) ? conn->skip : avail;
+            pos += take;
+            conn->skip -= take;
+            continue;
+        }
+
+        char type;
+        size_t payload_len;
+        int header_len = frame_parse_header(conn->recv_buf + pos, avail, &type, &payload_len);
+        if (header_len == 0) break;
+        if (header_len == -1) {
+            fprintf(stderr, "Error: bench received a malformed frame\n");
+            return -1;
+        }
+
+        if (type != FRAME_END) {
+            pos += (size_t)header_len;
+            conn->skip = payload_len;
+            continue;
+        }
+
+        // end frame -- wait until the whole (small) payload is here
+        if (payload_len >= FRAME_HEADER_MAX * 2) return -1;
+        if (avail < (size_t)header_len + payload_len) break;
+
+        int exit_code;
+        reply_status_t status;
+        if (frame_parse_end(conn->recv_buf + pos + header_len, payload_len, &exit_code, &status) == -1) {
+            fprintf(stderr, "Error: bench received a malformed end frame\n");
+            return -1;
+        }
+        pos += (size_t)header_len + payload_len;
+
+        // a reply nobody asked for -- the server refused the session
+        if (conn->pending_count == 0) {
+            stats->replies[status]++;
+            return -1;
+        }
+
+        bench_request_t* request = &conn->pending[conn->pending_head];
+        conn->pending_head = (conn->pending_head + 1) % BENCH_PENDING_MAX;
+        conn->pending_count--;
+
+        uint64_t latency = (arrived > request->start_ns) ? arrived - request->start_ns : 0;
+        hist_record(&stats->latency, latency);
+        hist_record(&options->mix[request->mix].latency, latency);
+        if (status != REPLY_OK) options->mix[request->mix].errors++;
+        stats->replies[status]++;
+        stats->completed++;
+        stats->last_reply_ns = arrived;
+        (*finished)++;
+    }
+
+    // keep the unprocessed tail (a partial frame) at the front
+    memmove(conn->recv_buf, conn->recv_buf + pos, conn->recv_len - pos);
+    conn->recv_len -= pos;
+    return 0;
+}
+
+// picks a mix entry at random, in proportion to the weights (xorshift64)
+int pick_mix(const bench_options_t* options, uint64_t* rng) {
+    if (options->mix_count == 1) return 0;
+
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 7;
+    *rng ^= *rng << 17;
+    unsigned ticket = (unsigned)(*rng % options->total_weight);
+    for (int i = 0; i < options->mix_count; i++) {
+        if (ticket < options->mix[i].weight) return i;
+        ticket -= options->mix[i].weight;
+    }
+    return options->mix_count - 1;
+}
+
+
+// reporting
+// latencies are printed in milliseconds
+static double ms(uint64_t ns) {
+    return (double)ns / 1e6;
+}
+
+void print_bench_report(const bench_options_t* options, const bench_stats_t* stats, uint64_t elapsed_ns) {
+    double seconds = (double)elapsed_ns / 1e9;
+    const histogram_t* h = &stats->latency;
+
+    printf("bench: %d connection%s, ", options->conns, (options->conns == 1) ? "" : "s");
+    if (options->rate > 0) printf("open loop at %.1f req/s", options->rate);
+    else printf("closed loop");
+    printf(", %.1f s, %d command%s in the mix\n", options->duration, options->mix_count, (options->mix_count == 1) ? "" : "s");
+
+    printf("  throughput   %llu requests in %.2f s -- %.1f req/s\n",
+           (unsigned long long)stats->completed, seconds, (seconds > 0) ? (double)stats->completed / seconds : 0.0);
+
+    if (h->total > 0) {
+        printf("  latency      min %.3f  mean %.3f  p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f ms\n",
+               ms(h->min), hist_mean(h) / 1e6, ms(hist_percentile(h, 50.0)), ms(hist_percentile(h, 90.0)),
+               ms(hist_percentile(h, 99.0)), ms(hist_percentile(h, 99.9)), ms(h->max));
+    }
+
+    printf("  replies     ");
+    for (int s = REPLY_OK; s <= REPLY_ERROR; s++) {
+        printf(" %s=%llu", reply_status_name((reply_status_t)s), (unsigned long long)stats->replies[s]);
+    }
+    printf("\n");
+    if (stats->incomplete > 0) printf("  incomplete   %llu (no reply)\n", (unsigned long long)stats->incomplete);
+    if (stats->disconnects > 0) printf("  disconnects  %llu\n", (unsigned long long)stats->disconnects);
+
+    // per-command breakdown only says something new when there is a mix
+    if (options->mix_count > 1) {
+        printf("  per command:\n");
+        for (int i = 0; i < options->mix_count; i++) {
+            const bench_mix_t* mix = &options->mix[i];
+            printf("    %-24.*s w=%-3u n=%-8llu p50 %.3f  p99 %.3f ms  errors %llu\n",
+                   (int)(mix->len - 1), mix->line, mix->weight, (unsigned long long)mix->latency.total,
+                   ms(hist_percentile(&mix->latency, 50.0)), ms(hist_percentile(&mix->latency, 99.0)),
+                   (unsigned long long)mix->errors);
+        }
+    }
+}
+
+// current CLOCK_MONOTONIC time in nanoseconds
+uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NSEC_PER_SEC + (uint64_t)ts.tv_nsec;
+}
@@ -0,0 +1,19 @@
+// header guard to prevent multiple inclusions of this file
+#ifndef BENCH_H
+#define BENCH_H
+
+// bench.h -- load generator and latency benchmark for the server (client --bench)
+//
+// opens N connections and keeps them busy with a weighted command mix, either
+// closed loop (each connection sends its next command when the previous reply ends)
+// or open loop at a fixed total rate (commands are sent on schedule, pipelined)
+// reports throughput, latency percentiles and errors by reply status
+
+// runs the benchmark -- argv[0] is "--bench", the rest are bench options
+// returns the process exit status (0 when every reply was ok)
+int run_bench(int argc, char* argv[]);
+
+// provided by client.c -- connects a TCP socket, prints its own error on failure
+int create_and_connect_socket(const char* server_ip, int port);
+
+#endif /* BENCH_H */
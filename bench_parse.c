@@ -0,0 +1,234 @@
+// bench_parse.c -- microbenchmark for the Phase 1 parser (make bench-parse)
+// runs parse_input(), parse_command_line(), split_by_pipes() and parse_pipeline() over a fixed corpus
+// and reports, per function and command: nanoseconds, allocations and bytes allocated per parse
+//
+// every parse works on a fresh copy of the command (the parsers write into their input) and
+// frees its result, so one iteration is parse + free; the copy's cost is measured separately and subtracted
+// allocations are counted by replacing malloc() and friends for the whole process, so calls made
+// inside libc on the parser's behalf (glob(), strdup()) are counted too
+//
+// Usage: ./bench_parse [-n iterations] [-f filter]
+//   -n  iterations per measurement (default: calibrated to about 100 ms each)
+//   -f  only corpus entries whose name contains filter
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>      // getopt()
+#include <time.h>        // clock_gettime()
+
+#include "shell_utils.h"
+
+
+#define BENCH_TARGET_NS 100000000ULL        // calibrated measurement length -- 100 ms
+#define BENCH_MAX_ITERATIONS 10000000ULL
+
+// glibc's allocator entry points -- the replacements below forward to them
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+// one corpus entry
+typedef struct {
+    const char* name;
+    const char* command;
+} parse_case_t;
+
+// one parser under test -- parses a writable copy of the command and frees the result
+typedef struct {
+    const char* name;
+    void (*run)(char* input);
+    int pipes_only;           // rejects commands without a pipe -- skipped for those
+} parse_function_t;
+
+// what one measurement found, per parse
+typedef struct {
+    double ns;
+    double allocs;
+    double bytes;
+} parse_cost_t;
+
+// corpus -- short commands, long argument lists, quoting and escapes, many-stage pipelines, globs
+// glob patterns expand against the working directory, run from the repository root for stable numbers
+static const parse_case_t corpus[] = {
+    { "short", "ls -l" },
+    { "short-redirect", "sort < input.txt > output.txt 2> errors.txt" },
+    { "long-args", "gcc -Wall -Wextra -std=c99 -g -pedantic -pthread -O2 -DNDEBUG -I. -Iinclude -Ilib -c a.c b.c c.c "
+                   "d.c e.c f.c g.c h.c i.c j.c k.c l.c m.c n.c o.c p.c q.c r.c s.c t.c u.c v.c w.c x.c y.c z.c -o out" },
+    { "quoted", "echo \"hello world\" 'single quoted' \"mixed 'inner' quotes\" plain\"joined\"'parts' \"a b c d e f\"" },
+    { "escaped", "printf \"col1\\tcol2\\tcol3\\n\" \"line\\none\" \"back\\\\slash\" \"say \\\"hi\\\"\" 'it\\'s'" },
+    { "pipeline-3", "cat access.log | grep GET | wc -l" },
+    { "pipeline-10", "cat data.csv | cut -d, -f2 | tr a-z A-Z | sort | uniq -c | sort -rn | head -50 | awk {print} "
+                     "| sed s/x/y/ | wc -l" },
+    { "glob", "ls *.c *.h" },
+    { "glob-nomatch", "ls *.nothing-matches-this [q-z]*.none" },
+};
+
+// prototypes
+static void run_parse_input(char* input);
+static void run_parse_command_line(char* input);
+static void run_split_by_pipes(char* input);
+static void run_parse_pipeline(char* input);
+static void run_copy_only(char* input);
+static parse_cost_t measure(void (*run)(char* input), const char* command, uint64_t iterations);
+static uint64_t calibrate(void (*run)(char* input), const char* command);
+static uint64_t now_ns(void);
+
+static const parse_function_t functions[] = {
+    { "parse_input", run_parse_input, 0 },
+    { "parse_command_line", run_parse_command_line, 0 },
+    { "split_by_pipes", run_split_by_pipes, 1 },
+    { "parse_pipeline", run_parse_pipeline, 0 },
+};
+
+// allocation counters -- the benchmark is single threaded
+static uint64_t alloc_count;
+static uint64_t alloc_bytes;
+
+
+// allocator replacements -- count, then forward to glibc
+void* malloc(size_t size) {
+    alloc_count++;
+    alloc_bytes += size;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    alloc_count++;
+    alloc_bytes += count * size;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    alloc_count++;
+    alloc_bytes += size;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) {
+    __libc_free(ptr);
+}
+
+
+int main(int argc, char* argv[]) {
+    uint64_t iterations = 0;
+    const char* filter = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:f:")) != -1) {
+        switch (opt) {
+            case 'n':
+                iterations = strtoull(optarg, NULL, 10);
+                if (iterations == 0) {
+                    fprintf(stderr, "Error: -n needs a positive number of iterations\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n iterations] [-f filter]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    printf("%-16s %-20s %10s %10s %10s %10s\n", "case", "function", "ns/parse", "allocs", "bytes", "iterations");
+    for (size_t c = 0; c < sizeof(corpus) / sizeof(corpus[0]); c++) {
+        if (filter != NULL && strstr(corpus[c].name, filter) == NULL) continue;
+        const char* command = corpus[c].command;
+
+        for (size_t f = 0; f < sizeof(functions) / sizeof(functions[0]); f++) {
+            if (functions[f].pipes_only && strchr(command, '|') == NULL) continue;
+            uint64_t n = (iterations > 0) ? iterations : calibrate(functions[f].run, command);
+
+            // the copy into the input buffer is part of every iteration -- take it back out
+            parse_cost_t copy = measure(run_copy_only, command, n);
+            parse_cost_t cost = measure(functions[f].run, command, n);
+            double ns = cost.ns - copy.ns;
+
+            printf("%-16s %-20s %10.0f %10.1f %10.0f %10llu\n", corpus[c].name, functions[f].name,
+                   (ns > 0) ? ns : 0, cost.allocs, cost.bytes, (unsigned long long)n);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+
+// parsers under test
+static void run_parse_input(char* input) {
+    char** argv = parse_input(input);
+    if (argv != NULL) free_argv(argv);
+}
+
+static void run_parse_command_line(char* input) {
+    command_t* cmd = parse_command_line(input);
+    if (cmd != NULL) free_command(cmd);
+}
+
+static void run_split_by_pipes(char* input) {
+    int num_segments = 0;
+    char** segments = split_by_pipes(input, &num_segments);
+    if (segments == NULL) return;
+    for (int i = 0; i < num_segments; i++) free(segments[i]);
+    free(segments);
+}
+
+static void run_parse_pipeline(char* input) {
+    pipeline_t* pipeline = parse_pipeline(input);
+    if (pipeline != NULL) free_pipeline(pipeline);
+}
+
+// baseline -- the copy alone
+static void run_copy_only(char* input) {
+    (void)input;
+}
+
+
+// measurement
+// runs iterations parses of command and averages them -- one warm-up parse first
+static parse_cost_t measure(void (*run)(char* input), const char* command, uint64_t iterations) {
+    char input[MAX_INPUT_SIZE];
+    size_t len = strlen(command) + 1;
+
+    memcpy(input, command, len);
+    run(input);
+
+    uint64_t allocs_before = alloc_count;
+    uint64_t bytes_before = alloc_bytes;
+    uint64_t start = now_ns();
+    for (uint64_t i = 0; i < iterations; i++) {
+        memcpy(input, command, len);
+        run(input);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    parse_cost_t cost;
+    cost.ns = (double)elapsed / (double)iterations;
+    cost.allocs = (double)(alloc_count - allocs_before) / (double)iterations;
+    cost.bytes = (double)(alloc_bytes - bytes_before) / (double)iterations;
+    return cost;
+}
+
+// iterations that take about BENCH_TARGET_NS -- doubles a trial run until it takes a tenth of that
+static uint64_t calibrate(void (*run)(char* input), const char* command) {
+    uint64_t n = 1;
+    while (n < BENCH_MAX_ITERATIONS) {
+        parse_cost_t cost = measure(run, command, n);
+        if (cost.ns * (double)n >= BENCH_TARGET_NS / 10) {
+            uint64_t target = (uint64_t)((double)BENCH_TARGET_NS / cost.ns);
+            return (target > 0) ? target : 1;
+        }
+        n *= 2;
+    }
+    return BENCH_MAX_ITERATIONS;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
@@ -0,0 +1,569 @@
+// bench_pipeline.c -- pipeline throughput benchmark (make bench-pipeline)
+// pushes generated bytes through pipelines of pass-through stages and reports bytes/s and CPU/byte as CSV,
+// one row per mode, stage count and input size, so runs from different commits can be diffed or plotted
+//
+// every pipeline is "head -c <size> /dev/zero" followed by 0 to N "cat" stages:
+//   direct  parse_pipeline() + execute_pipeline() in this process, stdout drained by a sink thread --
+//           the executor, the pipes and the stages alone
+//   server  the same command as a request to a server this benchmark starts -- adds the command child,
+//           execute_command_with_capture()'s capture buffer, the output frame and the TCP socket
+// the difference between the two rows of one size and stage count is the server's copy and framing cost
+//
+// CPU is everything the run cost, on every CPU: direct counts this process (sink thread) and the reaped stages,
+// server counts the server process and its spawn helper, each with its reaped command children (/proc/<pid>/stat),
+// and this client
+// the server keeps a command's whole output in memory before sending it -- sizes past free RAM only work in direct mode
+//
+// Usage: ./bench_pipeline [-s sizes] [-n max_stages] [-r runs] [-m direct|server] [-S server] [-p port]
+//   -s  comma-separated input sizes, K/M/G suffixes (default 1K,64K,1M,16M,256M)
+//   -n  most pass-through stages (default 4, at most MAX_PIPES)
+//   -r  runs per row, the median by wall time is reported (default 3)
+//   -m  only one mode (default both)
+//   -S  server binary started for server mode (default ./server)
+//   -p  port it listens on (default 9091)
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>       // pipe2(), O_CLOEXEC
+#include <errno.h>
+#include <signal.h>      // kill()
+#include <time.h>        // clock_gettime()
+#include <pthread.h>     // sink thread
+#include <sys/wait.h>    // waitpid()
+#include <sys/resource.h> // getrusage()
+#include <sys/socket.h>  // socket(), connect(), send(), recv()
+#include <netinet/in.h>  // struct sockaddr_in
+#include <netinet/tcp.h> // TCP_NODELAY
+#include <arpa/inet.h>   // htons(), inet_pton()
+
+#include "shell_utils.h"
+#include "protocol.h"
+
+
+#define DEFAULT_SIZES "1K,64K,1M,16M,256M"
+#define DEFAULT_MAX_STAGES 4
+#define DEFAULT_RUNS 3
+#define DEFAULT_SERVER "./server"
+#define DEFAULT_PORT 9091
+
+#define MAX_SIZES 32
+#define MAX_RUNS 101
+#define SINK_BUFFER_SIZE (64 * 1024)        // read size of the sink thread and the socket reader
+#define COMMAND_SIZE 512
+#define SERVER_START_TIMEOUT_MS 5000
+
+// what one run cost
+typedef struct {
+    double seconds;           // wall clock, first byte requested to last byte received
+    double user;              // CPU seconds, every process involved
+    double sys;
+    size_t bytes;             // bytes that came out of the pipeline
+    int ok;                   // exit status 0 and bytes == the input size
+} run_result_t;
+
+// the sink thread's side of a direct run
+typedef struct {
+    int fd;
+    size_t bytes;
+} sink_t;
+
+// benchmark settings
+typedef struct {
+    size_t sizes[MAX_SIZES];
+    int num_sizes;
+    int max_stages;
+    int runs;
+    int direct;
+    int server;
+    const char* server_path;
+    int port;
+} bench_settings_t;
+
+// prototypes
+static int parse_settings(int argc, char* argv[], bench_settings_t* settings);
+static int parse_sizes(char* text, bench_settings_t* settings);
+static void build_command(char* command, size_t size, int stages);
+static int run_direct(const char* command, size_t size, run_result_t* result);
+static void* sink_thread(void* arg);
+static pid_t start_server(const char* path, int port);
+static void stop_server(pid_t pid);
+static int connect_server(int port, int timeout_ms);
+static int run_server(int fd, pid_t server_pid, const char* command, size_t size, run_result_t* result);
+static int server_cpu(pid_t pid, double* user, double* sys);
+static int process_cpu(pid_t pid, double* user, double* sys);
+static void self_cpu(int who, double* user, double* sys);
+static void print_row(const char* mode, int stages, size_t size, run_result_t* runs, int count);
+static int compare_seconds(const void* a, const void* b);
+static double now_seconds(void);
+
+
+int main(int argc, char* argv[]) {
+    bench_settings_t settings;
+    if (parse_settings(argc, argv, &settings) == -1) return EXIT_FAILURE;
+
+    // a server that dies mid-reply must not take the benchmark with it
+    signal(SIGPIPE, SIG_IGN);
+
+    run_result_t runs[MAX_RUNS];
+    char command[COMMAND_SIZE];
+    printf("mode,stages,bytes,runs,seconds,mib_per_s,cpu_seconds,cpu_ns_per_byte,user_seconds,sys_seconds,ok\n");
+    fflush(stdout);
+
+    if (settings.direct) {
+        for (int stages = 0; stages <= settings.max_stages; stages++) {
+            for (int s = 0; s < settings.num_sizes; s++) {
+                build_command(command, settings.sizes[s], stages);
+                int count = 0;
+                for (int r = 0; r < settings.runs; r++) {
+                    if (run_direct(command, settings.sizes[s], &runs[count]) == 0) count++;
+                }
+                print_row("direct", stages, settings.sizes[s], runs, count);
+            }
+        }
+    }
+
+    if (settings.server) {
+        pid_t server_pid = start_server(settings.server_path, settings.port);
+        if (server_pid == -1) return EXIT_FAILURE;
+        int fd = connect_server(settings.port, SERVER_START_TIMEOUT_MS);
+        if (fd == -1) {
+            stop_server(server_pid);
+            return EXIT_FAILURE;
+        }
+
+        for (int stages = 0; stages <= settings.max_stages && fd >= 0; stages++) {
+            for (int s = 0; s < settings.num_sizes && fd >= 0; s++) {
+                build_command(command, settings.sizes[s], stages);
+                int count = 0;
+                for (int r = 0; r < settings.runs; r++) {
+                    if (run_server(fd, server_pid, command, settings.sizes[s], &runs[count]) == -1) {
+                        // the session is gone -- nothing after this row can be measured
+                        close(fd);
+                        fd = -1;
+                        break;
+                    }
+                    count++;
+                }
+                print_row("server", stages, settings.sizes[s], runs, count);
+            }
+        }
+
+        if (fd >= 0) close(fd);
+        stop_server(server_pid);
+    }
+    return EXIT_SUCCESS;
+}
+
+
+// command line
+static int parse_settings(int argc, char* argv[], bench_settings_t* settings) {
+    char default_sizes[] = DEFAULT_SIZES;
+    settings->num_sizes = 0;
+    settings->max_stages = DEFAULT_MAX_STAGES;
+    settings->runs = DEFAULT_RUNS;
+    settings->direct = 1;
+    settings->server = 1;
+    settings->server_path = DEFAULT_SERVER;
+    settings->port = DEFAULT_PORT;
+
+    int opt;
+    int valid = 1;
+    while (valid && (opt = getopt(argc, argv, "s:n:r:m:S:p:")) != -1) {
+        switch (opt) {
+            case 's':
+                valid = (parse_sizes(optarg, settings) == 0);
+                break;
+            case 'n':
+                settings->max_stages = atoi(optarg);
+                valid = (settings->max_stages >= 0 && settings->max_stages <= MAX_PIPES);
+                break;
+            case 'r':
+                settings->runs = atoi(optarg);
+                valid = (settings->runs > 0 && settings->runs <= MAX_RUNS);
+                break;
+            case 'm':
+                settings->direct = (strcmp(optarg, "direct") == 0);
+                settings->server = (strcmp(optarg, "server") == 0);
+                valid = (settings->direct || settings->server);
+                break;
+            case 'S':
+                settings->server_path = optarg;
+                break;
+            case 'p':
+                settings->port = atoi(optarg);
+                valid = (settings->port > 0 && settings->port <= 65535);
+                break;
+            default:
+                valid = 0;
+                break;
+        }
+    }
+    if (!valid) {
+        fprintf(stderr, "Usage: %s [-s sizes] [-n max_stages] [-r runs] [-m direct|server] [-S server] [-p port]\n", argv[0]);
+        fprintf(stderr, "  defaults: -s %s -n %d -r %d -S %s -p %d, both modes\n",
+                DEFAULT_SIZES, DEFAULT_MAX_STAGES, DEFAULT_RUNS, DEFAULT_SERVER, DEFAULT_PORT);
+        return -1;
+    }
+    if (settings->num_sizes == 0) parse_sizes(default_sizes, settings);
+    return 0;
+}
+
+// "1K,64K,1M" -- K, M and G are powers of 1024
+static int parse_sizes(char* text, bench_settings_t* settings) {
+    settings->num_sizes = 0;
+    for (char* item = strtok(text, ","); item != NULL; item = strtok(NULL, ",")) {
+        char* end;
+        unsigned long long value = strtoull(item, &end, 10);
+        if (*end == 'K' || *end == 'k') { value <<= 10; end++; }
+        else if (*end == 'M' || *end == 'm') { value <<= 20; end++; }
+        else if (*end == 'G' || *end == 'g') { value <<= 30; end++; }
+        if (end == item || *end != '\0' || value == 0 || settings->num_sizes == MAX_SIZES) {
+            fprintf(stderr, "Error: bad size list entry '%s'\n", item);
+            return -1;
+        }
+        settings->sizes[settings->num_sizes++] = (size_t)value;
+    }
+    return (settings->num_sizes > 0) ? 0 : -1;
+}
+
+// "head -c <size> /dev/zero | cat | cat ..."
+static void build_command(char* command, size_t size, int stages) {
+    int len = snprintf(command, COMMAND_SIZE, "head -c %zu /dev/zero", size);
+    for (int i = 0; i < stages; i++) {
+        len += snprintf(command + len, COMMAND_SIZE - (size_t)len, " | cat");
+    }
+}
+
+
+// direct mode
+// runs the pipeline with this process's stdout pointed at a pipe the sink thread drains
+static int run_direct(const char* command, size_t size, run_result_t* result) {
+    char input[MAX_INPUT_SIZE];
+    snprintf(input, sizeof(input), "%s", command);
+    pipeline_t* pipeline = parse_pipeline(input);
+    if (pipeline == NULL) {
+        fprintf(stderr, "Error: could not parse '%s'\n", command);
+        return -1;
+    }
+
+    // close-on-exec everywhere except the stdout the stages inherit -- a stage holding
+    // a spare write end would keep the sink from ever seeing end of file
+    int sink_pipe[2];
+    if (pipe2(sink_pipe, O_CLOEXEC) == -1) {
+        perror("Error: pipe creation failed for the sink");
+        free_pipeline(pipeline);
+        return -1;
+    }
+    fflush(stdout);
+    int saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (saved_stdout == -1 || dup2(sink_pipe[1], STDOUT_FILENO) == -1) {
+        perror("Error: could not redirect stdout to the sink");
+        if (saved_stdout != -1) close(saved_stdout);
+        close(sink_pipe[0]);
+        close(sink_pipe[1]);
+        free_pipeline(pipeline);
+        return -1;
+    }
+    close(sink_pipe[1]);
+
+    sink_t sink;
+    sink.fd = sink_pipe[0];
+    sink.bytes = 0;
+    pthread_t thread;
+
+    double self_user, self_sys, child_user, child_sys;
+    self_cpu(RUSAGE_SELF, &self_user, &self_sys);
+    self_cpu(RUSAGE_CHILDREN, &child_user, &child_sys);
+    double start = now_seconds();
+
+    int status = -1;
+    int started = (pthread_create(&thread, NULL, sink_thread, &sink) == 0);
+    if (started) status = execute_pipeline(pipeline);
+
+    // putting stdout back closes the last write end -- the sink reads to end of file and returns
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    if (started) pthread_join(thread, NULL);
+    double end = now_seconds();
+    close(sink_pipe[0]);
+    free_pipeline(pipeline);
+    if (!started) {
+        fprintf(stderr, "Error: could not start the sink thread\n");
+        return -1;
+    }
+
+    double user, sys;
+    self_cpu(RUSAGE_SELF, &user, &sys);
+    result->user = user - self_user;
+    result->sys = sys - self_sys;
+    self_cpu(RUSAGE_CHILDREN, &user, &sys);
+    result->user += user - child_user;
+    result->sys += sys - child_sys;
+    result->seconds = end - start;
+    result->bytes = sink.bytes;
+    result->ok = (status == 0 && sink.bytes == size);
+    return 0;
+}
+
+static void* sink_thread(void* arg) {
+    sink_t* sink = (sink_t*)arg;
+    char* buffer = malloc(SINK_BUFFER_SIZE);
+    if (buffer == NULL) return NULL;
+    while (1) {
+        ssize_t bytes = read(sink->fd, buffer, SINK_BUFFER_SIZE);
+        if (bytes > 0) {
+            sink->bytes += (size_t)bytes;
+        } else if (bytes == 0 || errno != EINTR) {
+            break;
+        }
+    }
+    free(buffer);
+    return NULL;
+}
+
+
+// server mode
+// starts the server with no output or time limit and errors-only logging, output discarded
+static pid_t start_server(const char* path, int port) {
+    char port_text[16];
+    snprintf(port_text, sizeof(port_text), "%d", port);
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("Error: fork failed for the server");
+        return -1;
+    }
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd != -1) {
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+            close(null_fd);
+        }
+        execl(path, path, "-p", port_text, "-o", "0", "-t", "0", "-l", "error", (char*)NULL);
+        _exit(127);
+    }
+    return pid;
+}
+
+static void stop_server(pid_t pid) {
+    kill(pid, SIGTERM);
+    while (waitpid(pid, NULL, 0) == -1 && errno == EINTR) {
+        // interrupted -- keep waiting
+    }
+}
+
+// connects to the local server, retrying until it listens or timeout_ms passes
+static int connect_server(int port, int timeout_ms) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+    for (int waited = 0; waited < timeout_ms; waited += 50) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1) {
+            perror("Error: socket creation failed");
+            return -1;
+        }
+        if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            return fd;
+        }
+        close(fd);
+        usleep(50 * 1000);
+    }
+    fprintf(stderr, "Error: no server listening on port %d after %d ms\n", port, timeout_ms);
+    return -1;
+}
+
+// sends one request and reads its reply to the end frame, counting output payload bytes
+// returns 0 once the reply is complete, -1 if the session broke
+static int run_server(int fd, pid_t server_pid, const char* command, size_t size, run_result_t* result) {
+    char request[COMMAND_SIZE + 1];
+    int request_len = snprintf(request, sizeof(request), "%s\n", command);
+
+    double self_user, self_sys, server_user, server_sys;
+    self_cpu(RUSAGE_SELF, &self_user, &self_sys);
+    if (server_cpu(server_pid, &server_user, &server_sys) == -1) return -1;
+    double start = now_seconds();
+
+    if (send_all(fd, request, (size_t)request_len) == -1) {
+        perror("Error: send failed");
+        return -1;
+    }
+
+    char* buffer = malloc(SINK_BUFFER_SIZE);
+    if (buffer == NULL) return -1;
+    size_t len = 0;           // unparsed bytes at the start of buffer
+    size_t skip = 0;          // output payload bytes still to come
+    size_t output = 0;
+    int exit_code = -1;
+    int done = 0;
+    while (!done) {
+        ssize_t bytes = recv(fd, buffer + len, SINK_BUFFER_SIZE - len, 0);
+        if (bytes == 0 || (bytes == -1 && errno != EINTR)) {
+            fprintf(stderr, "Error: server closed the session mid-reply\n");
+            free(buffer);
+            return -1;
+        }
+        if (bytes == -1) continue;
+        len += (size_t)bytes;
+
+        size_t pos = 0;
+        while (pos < len && !done) {
+            size_t avail = len - pos;
+            if (skip > 0) {
+                size_t take = (skip < avail) ? skip : avail;
+                pos += take;
+                skip -= take;
+                continue;
+            }
+
+            char type;
+            size_t payload_len;
+            int header_len = frame_parse_header(buffer + pos, avail, &type, &payload_len);
+            if (header_len == 0) break;
+            if (header_len == -1) {
+                fprintf(stderr, "Error: malformed frame from the server\n");
+                free(buffer);
+                return -1;
+            }
+            if (type != FRAME_END) {
+                if (type == FRAME_OUTPUT) output += payload_len;
+                pos += (size_t)header_len;
+                skip = payload_len;
+                continue;
+            }
+
+            // end frame -- wait until its short payload is complete
+            if (avail < (size_t)header_len + payload_len) break;
+            reply_status_t status;
+            if (frame_parse_end(buffer + pos + header_len, payload_len, &exit_code, &status) == -1) exit_code = -1;
+            done = 1;
+        }
+        memmove(buffer, buffer + pos, len - pos);
+        len -= pos;
+    }
+    free(buffer);
+    double end = now_seconds();
+
+    // the command is reaped (by the server or its spawn helper) before the reply is sent, so its CPU is in by now
+    double user, sys;
+    self_cpu(RUSAGE_SELF, &user, &sys);
+    result->user = user - self_user;
+    result->sys = sys - self_sys;
+    if (server_cpu(server_pid, &user, &sys) == -1) return -1;
+    result->user += user - server_user;
+    result->sys += sys - server_sys;
+    result->seconds = end - start;
+    result->bytes = output;
+    result->ok = (exit_code == 0 && output == size);
+    return 0;
+}
+
+
+// CPU accounting
+// the server plus its own children -- the spawn helper forks and reaps the command children, so their CPU lands there
+static int server_cpu(pid_t pid, double* user, double* sys) {
+    if (process_cpu(pid, user, sys) == -1) return -1;
+
+    char path[64];
+    char list[1024];
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/children", (int)pid, (int)pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return 0;
+    ssize_t len = read(fd, list, sizeof(list) - 1);
+    close(fd);
+    if (len <= 0) return 0;
+    list[len] = '\0';
+
+    for (char* item = strtok(list, " \n"); item != NULL; item = strtok(NULL, " \n")) {
+        double child_user, child_sys;
+        if (process_cpu((pid_t)atoi(item), &child_user, &child_sys) == 0) {
+            *user += child_user;
+            *sys += child_sys;
+        }
+    }
+    return 0;
+}
+
+// user and system seconds of a process plus its reaped children, from /proc/<pid>/stat
+static int process_cpu(pid_t pid, double* user, double* sys) {
+    char path[64];
+    char stat[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror("Error: cannot read the server's CPU time");
+        return -1;
+    }
+    ssize_t len = read(fd, stat, sizeof(stat) - 1);
+    close(fd);
+    if (len <= 0) return -1;
+    stat[len] = '\0';
+
+    // the command name may contain spaces -- fields are counted from its closing parenthesis,
+    // which ends field 2; utime, stime, cutime and cstime are fields 14 to 17
+    char* fields = strrchr(stat, ')');
+    unsigned long utime, stime;
+    long cutime, cstime;
+    if (fields == NULL || sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %ld %ld",
+                                 &utime, &stime, &cutime, &cstime) != 4) {
+        fprintf(stderr, "Error: cannot parse %s\n", path);
+        return -1;
+    }
+    double tick = (double)sysconf(_SC_CLK_TCK);
+    *user = (double)(utime + (unsigned long)cutime) / tick;
+    *sys = (double)(stime + (unsigned long)cstime) / tick;
+    return 0;
+}
+
+static void self_cpu(int who, double* user, double* sys) {
+    struct rusage usage;
+    getrusage(who, &usage);
+    *user = (double)usage.ru_utime.tv_sec + (double)usage.ru_utime.tv_usec / 1e6;
+    *sys = (double)usage.ru_stime.tv_sec + (double)usage.ru_stime.tv_usec / 1e6;
+}
+
+
+// output
+// one CSV row -- the median run by wall time, ok only if every run was
+static void print_row(const char* mode, int stages, size_t size, run_result_t* runs, int count) {
+    if (count == 0) {
+        printf("%s,%d,%zu,0,,,,,,,0\n", mode, stages, size);
+        fflush(stdout);
+        return;
+    }
+
+    int ok = 1;
+    for (int i = 0; i < count; i++) ok = ok && runs[i].ok;
+    qsort(runs, (size_t)count, sizeof(run_result_t), compare_seconds);
+    run_result_t* median = &runs[count / 2];
+
+    double cpu = median->user + median->sys;
+    double mib_per_s = (median->seconds > 0) ? (double)median->bytes / median->seconds / (1024.0 * 1024.0) : 0;
+    double ns_per_byte = (median->bytes > 0) ? cpu * 1e9 / (double)median->bytes : 0;
+    printf("%s,%d,%zu,%d,%.6f,%.1f,%.6f,%.3f,%.6f,%.6f,%d\n", mode, stages, size, count, median->seconds,
+           mib_per_s, cpu, ns_per_byte, median->user, median->sys, ok);
+    fflush(stdout);
+}
+
+static int compare_seconds(const void* a, const void* b) {
+    double x = ((const run_result_t*)a)->seconds;
+    double y = ((const run_result_t*)b)->seconds;
+    return (x > y) - (x < y);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,352 @@
+// bench_shard.c -- data-parallel stage benchmark (make bench-shard)
+// runs "cat <log> | <stage>" through execute_pipeline() at several pipeline_parallel settings and reports
+// wall time, throughput and speedup over the serial run, so the scaling of sharded stages can be read off
+//
+// the input is a generated log of comma-separated lines, written to a temporary file once per run;
+// every stage's output is hashed by the sink thread, and a sharded run is "same" only if its hash and
+// exit status match the serial run's -- sharding must never change what comes out
+//
+// CPU is this process (sink thread) plus the reaped stages, whose usage includes the replicas they reaped
+// speedup is bounded by the CPUs the machine has -- replicas past that only add chunk copies
+//
+// Usage: ./bench_shard [-s size] [-P replicas] [-r runs] [-f filter]
+//   -s  input size, K/M/G suffixes (default 256M)
+//   -P  comma-separated replica counts (default 1 and powers of two up to the online CPUs)
+//   -r  runs per row, the median by wall time is reported (default 3)
+//   -f  only stages whose command contains filter
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>       // pipe2(), O_CLOEXEC
+#include <errno.h>
+#include <time.h>        // clock_gettime()
+#include <pthread.h>     // sink thread
+#include <sys/resource.h> // getrusage()
+
+#include "shell_utils.h"
+
+
+#define DEFAULT_SIZE (256UL << 20)
+#define DEFAULT_RUNS 3
+#define MAX_REPLICA_COUNTS 16
+#define MAX_RUNS 101
+#define SINK_BUFFER_SIZE (64 * 1024)
+#define COMMAND_SIZE 512
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+// what one run cost
+typedef struct {
+    double seconds;           // wall clock, pipeline start to sink end of file
+    double cpu;               // user + system seconds, every process involved
+    size_t bytes;             // bytes that came out of the stage
+    uint64_t hash;            // FNV-1a of those bytes
+    int status;               // execute_pipeline() result
+} run_result_t;
+
+// the sink thread's side of a run
+typedef struct {
+    int fd;
+    size_t bytes;
+    uint64_t hash;
+} sink_t;
+
+// prototypes
+static int parse_counts(char* text, int* counts, int max);
+static int parse_size(const char* text, size_t* size);
+static int write_input(char* path, size_t size);
+static int run_stage(const char* command, int replicas, run_result_t* result);
+static void* sink_thread(void* arg);
+static int compare_seconds(const void* a, const void* b);
+static double cpu_seconds(int who);
+static double now_seconds(void);
+
+// stages under test -- each line-stateless, so each is sharded when pipeline_parallel > 1
+static const char* const stages[] = {
+    "grep ERROR",
+    "grep -v INFO",
+    "grep -i -e warn -e error",
+    "sed s/GET/PUT/g",
+    "cut -d, -f2,6",
+    "tr a-z A-Z",
+};
+
+// generated log lines -- levels weighted so that ERROR matches about one line in five
+static const char* const levels[] = { "INFO", "INFO", "INFO", "WARN", "ERROR" };
+static const char* const methods[] = { "GET", "GET", "POST", "PUT" };
+
+
+int main(int argc, char* argv[]) {
+    size_t size = DEFAULT_SIZE;
+    int counts[MAX_REPLICA_COUNTS];
+    int num_counts = 0;
+    int runs = DEFAULT_RUNS;
+    const char* filter = NULL;
+
+    int opt;
+    int valid = 1;
+    while (valid && (opt = getopt(argc, argv, "s:P:r:f:")) != -1) {
+        switch (opt) {
+            case 's':
+                valid = (parse_size(optarg, &size) == 0);
+                break;
+            case 'P':
+                num_counts = parse_counts(optarg, counts, MAX_REPLICA_COUNTS);
+                valid = (num_counts > 0);
+                break;
+            case 'r':
+                runs = atoi(optarg);
+                valid = (runs > 0 && runs <= MAX_RUNS);
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            default:
+                valid = 0;
+                break;
+        }
+    }
+    if (!valid) {
+        fprintf(stderr, "Usage: %s [-s size] [-P replicas] [-r runs] [-f filter]\n", argv[0]);
+        fprintf(stderr, "  defaults: -s %luM -r %d, -P 1 and powers of two up to the online CPUs (at most %d)\n",
+                DEFAULT_SIZE >> 20, DEFAULT_RUNS, PIPELINE_PARALLEL_MAX);
+        return EXIT_FAILURE;
+    }
+    if (num_counts == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        counts[num_counts++] = 1;
+        for (int n = 2; num_counts < MAX_REPLICA_COUNTS && n <= PIPELINE_PARALLEL_MAX && (n <= cpus || n == 2); n *= 2) {
+            counts[num_counts++] = n;
+        }
+    }
+
+    char path[] = "/tmp/bench_shard-XXXXXX";
+    if (write_input(path, size) == -1) return EXIT_FAILURE;
+
+    run_result_t results[MAX_RUNS];
+    char command[COMMAND_SIZE];
+    printf("%-40s %8s %10s %10s %8s %10s %5s\n", "stage", "replicas", "seconds", "mib_per_s", "speedup", "cpu_s", "same");
+    for (size_t s = 0; s < sizeof(stages) / sizeof(stages[0]); s++) {
+        if (filter != NULL && strstr(stages[s], filter) == NULL) continue;
+        snprintf(command, sizeof(command), "cat %s | %s", path, stages[s]);
+
+        run_result_t serial;
+        memset(&serial, 0, sizeof(serial));
+        for (int c = 0; c < num_counts; c++) {
+            int count = 0;
+            for (int r = 0; r < runs; r++) {
+                if (run_stage(command, counts[c], &results[count]) == 0) count++;
+            }
+            if (count == 0) {
+                printf("%-40s %8d %10s\n", stages[s], counts[c], "failed");
+                continue;
+            }
+            qsort(results, (size_t)count, sizeof(run_result_t), compare_seconds);
+            run_result_t* median = &results[count / 2];
+            if (c == 0) serial = *median;
+
+            // every run has to agree with the first row, not just the median
+            int same = 1;
+            for (int r = 0; r < count; r++) {
+                same = same && results[r].hash == serial.hash && results[r].bytes == serial.bytes &&
+                       results[r].status == serial.status;
+            }
+            double speedup = (median->seconds > 0) ? serial.seconds / median->seconds : 0;
+            printf("%-40s %8d %10.3f %10.1f %8.2f %10.3f %5s\n", stages[s], counts[c], median->seconds,
+                   (double)size / median->seconds / (1024.0 * 1024.0), speedup, median->cpu, same ? "yes" : "NO");
+            fflush(stdout);
+        }
+    }
+
+    unlink(path);
+    return EXIT_SUCCESS;
+}
+
+
+// command line
+// "1,2,4,8" -- ascending is not required; returns the number of counts or -1
+static int parse_counts(char* text, int* counts, int max) {
+    int count = 0;
+    for (char* item = strtok(text, ","); item != NULL; item = strtok(NULL, ",")) {
+        char* end;
+        long value = strtol(item, &end, 10);
+        if (end == item || *end != '\0' || value < 1 || value > PIPELINE_PARALLEL_MAX || count == max) {
+            fprintf(stderr, "Error: bad replica count '%s' (1 to %d)\n", item, PIPELINE_PARALLEL_MAX);
+            return -1;
+        }
+        counts[count++] = (int)value;
+    }
+    return count;
+}
+
+// "256M" -- K, M and G are powers of 1024
+static int parse_size(const char* text, size_t* size) {
+    char* end;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (*end == 'K' || *end == 'k') { value <<= 10; end++; }
+    else if (*end == 'M' || *end == 'm') { value <<= 20; end++; }
+    else if (*end == 'G' || *end == 'g') { value <<= 30; end++; }
+    if (end == text || *end != '\0' || value == 0) {
+        fprintf(stderr, "Error: bad size '%s'\n", text);
+        return -1;
+    }
+    *size = (size_t)value;
+    return 0;
+}
+
+
+// input
+// writes size bytes of log lines to a new temporary file -- path is the mkstemp() template, filled in
+static int write_input(char* path, size_t size) {
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("Error: cannot create the input file");
+        return -1;
+    }
+    FILE* file = fdopen(fd, "w");
+    if (file == NULL) {
+        perror("Error: cannot open the input file");
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+
+    // a fixed generator, so every run and every commit sees the same bytes
+    uint64_t state = 88172645463325252ULL;
+    size_t written = 0;
+    char line[256];
+    for (unsigned long i = 0; written < size; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        int len = snprintf(line, sizeof(line), "2026-10-18T%02lu:%02lu:%02lu.%03lu,host-%lu,%s,/api/v1/items/%lu,%d,%s,"
+                           "request served in %lu ms\n", (i / 3600000) % 24, (i / 60000) % 60, (i / 1000) % 60,
+                           i % 1000, (unsigned long)(state % 40), methods[state % 4], (unsigned long)(state % 100000),
+                           (state % 50 == 0) ? 500 : 200, levels[(state >> 8) % 5], (unsigned long)(state >> 16) % 997);
+        // the last line is cut to size -- without its newline, which a sharded stage must handle too
+        size_t take = ((size_t)len < size - written) ? (size_t)len : size - written;
+        if (fwrite(line, 1, take, file) != take) {
+            perror("Error: cannot write the input file");
+            fclose(file);
+            unlink(path);
+            return -1;
+        }
+        written += take;
+    }
+    if (fclose(file) != 0) {
+        perror("Error: cannot write the input file");
+        unlink(path);
+        return -1;
+    }
+    return 0;
+}
+
+
+// runs
+// runs the pipeline with pipeline_parallel = replicas and this process's stdout pointed at the sink thread
+static int run_stage(const char* command, int replicas, run_result_t* result) {
+    char input[MAX_INPUT_SIZE];
+    snprintf(input, sizeof(input), "%s", command);
+    pipeline_t* pipeline = parse_pipeline(input);
+    if (pipeline == NULL) {
+        fprintf(stderr, "Error: could not parse '%s'\n", command);
+        return -1;
+    }
+
+    // close-on-exec everywhere except the stdout the stages inherit -- a stage holding
+    // a spare write end would keep the sink from ever seeing end of file
+    int sink_pipe[2];
+    if (pipe2(sink_pipe, O_CLOEXEC) == -1) {
+        perror("Error: pipe creation failed for the sink");
+        free_pipeline(pipeline);
+        return -1;
+    }
+    fflush(stdout);
+    int saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (saved_stdout == -1 || dup2(sink_pipe[1], STDOUT_FILENO) == -1) {
+        perror("Error: could not redirect stdout to the sink");
+        if (saved_stdout != -1) close(saved_stdout);
+        close(sink_pipe[0]);
+        close(sink_pipe[1]);
+        free_pipeline(pipeline);
+        return -1;
+    }
+    close(sink_pipe[1]);
+
+    sink_t sink;
+    sink.fd = sink_pipe[0];
+    sink.bytes = 0;
+    sink.hash = FNV_OFFSET;
+    pthread_t thread;
+
+    double cpu_start = cpu_seconds(RUSAGE_SELF) + cpu_seconds(RUSAGE_CHILDREN);
+    double start = now_seconds();
+
+    int status = -1;
+    int started = (pthread_create(&thread, NULL, sink_thread, &sink) == 0);
+    if (started) {
+        pipeline_parallel = replicas;
+        status = execute_pipeline(pipeline);
+        pipeline_parallel = 1;
+    }
+
+    // putting stdout back closes the last write end -- the sink reads to end of file and returns
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    if (started) pthread_join(thread, NULL);
+    double end = now_seconds();
+    close(sink_pipe[0]);
+    free_pipeline(pipeline);
+    if (!started) {
+        fprintf(stderr, "Error: could not start the sink thread\n");
+        return -1;
+    }
+
+    result->seconds = end - start;
+    result->cpu = cpu_seconds(RUSAGE_SELF) + cpu_seconds(RUSAGE_CHILDREN) - cpu_start;
+    result->bytes = sink.bytes;
+    result->hash = sink.hash;
+    result->status = status;
+    return 0;
+}
+
+static void* sink_thread(void* arg) {
+    sink_t* sink = (sink_t*)arg;
+    unsigned char* buffer = malloc(SINK_BUFFER_SIZE);
+    if (buffer == NULL) return NULL;
+    while (1) {
+        ssize_t bytes = read(sink->fd, buffer, SINK_BUFFER_SIZE);
+        if (bytes > 0) {
+            for (ssize_t i = 0; i < bytes; i++) sink->hash = (sink->hash ^ buffer[i]) * FNV_PRIME;
+            sink->bytes += (size_t)bytes;
+        } else if (bytes == 0 || errno != EINTR) {
+            break;
+        }
+    }
+    free(buffer);
+    return NULL;
+}
+
+static int compare_seconds(const void* a, const void* b) {
+    double x = ((const run_result_t*)a)->seconds;
+    double y = ((const run_result_t*)b)->seconds;
+    return (x > y) - (x < y);
+}
+
+static double cpu_seconds(int who) {
+    struct rusage usage;
+    getrusage(who, &usage);
+    return (double)usage.ru_utime.tv_sec + (double)usage.ru_utime.tv_usec / 1e6 +
+           (double)usage.ru_stime.tv_sec + (double)usage.ru_stime.tv_usec / 1e6;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,319 @@
+// bench_spawn.c -- process-spawn cost benchmark (make bench-spawn)
+// times spawn-to-exit of a trivial command ("true") with every launch strategy we could use,
+// at several parent resident set sizes -- fork() has to copy the parent's page tables, the others do not
+//
+// strategies:
+//   execute_simple_command  the Phase 1 executor as it is -- fork(), execvp(), wait4()
+//   fork                    bare fork() + execvp() + waitpid(), the same minus the executor's bookkeeping
+//   vfork                   vfork() + execvp() -- the parent sleeps until the child execs, nothing is copied
+//   posix_spawn             posix_spawnp() -- glibc uses clone(CLONE_VM | CLONE_VFORK) underneath
+//   clone_vm                clone(CLONE_VM | CLONE_VFORK) on a private stack, then execvp()
+// every sample is one spawn through the parent's waitpid() returning, so exec and exit of the child are included
+//
+// the parent is grown to each size with anonymous memory that is written to, so every page is resident;
+// sizes the machine cannot hold (over 90% of available memory) are skipped with a message
+//
+// Usage: ./bench_spawn [-s sizes] [-d seconds] [-n max_spawns] [-f filter]
+//   -s  comma-separated parent RSS targets, K/M/G suffixes, ascending (default 10M,1G,8G)
+//   -d  time spent on each strategy and size (default 1 second)
+//   -n  most spawns per strategy and size (default 10000)
+//   -f  only strategies whose name contains filter
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sched.h>       // clone()
+#include <signal.h>      // SIGCHLD
+#include <spawn.h>       // posix_spawnp()
+#include <time.h>        // clock_gettime()
+#include <sys/mman.h>    // mmap() for the ballast
+#include <sys/wait.h>    // waitpid()
+
+#include "shell_utils.h"
+#include "histogram.h"
+
+
+#define DEFAULT_SIZES "10M,1G,8G"
+#define DEFAULT_SECONDS 1.0
+#define DEFAULT_MAX_SPAWNS 10000
+#define MIN_SPAWNS 10                       // even when one spawn takes longer than -d
+#define MAX_SIZES 16
+#define CLONE_STACK_SIZE (64 * 1024)
+
+extern char** environ;
+
+// one launch strategy -- spawns "true", waits for it, returns 0 on success
+typedef struct {
+    const char* name;
+    int (*spawn)(void);
+} spawn_strategy_t;
+
+// prototypes
+static int spawn_executor(void);
+static int spawn_fork(void);
+static int spawn_vfork(void);
+static int spawn_posix(void);
+static int spawn_clone(void);
+static int clone_child(void* arg);
+static int wait_child(pid_t pid);
+static int parse_sizes(char* text, size_t* sizes, int max);
+static size_t resident_bytes(void);
+static size_t available_bytes(void);
+static int grow_ballast(size_t target);
+static void format_size(size_t bytes, char* text, size_t size);
+static uint64_t now_ns(void);
+
+static const spawn_strategy_t strategies[] = {
+    { "execute_simple_command", spawn_executor },
+    { "fork", spawn_fork },
+    { "vfork", spawn_vfork },
+    { "posix_spawn", spawn_posix },
+    { "clone_vm", spawn_clone },
+};
+
+// the trivial command every strategy runs
+static char* true_argv[] = { "true", NULL };
+
+// the executor's view of the same command -- built once in main()
+static command_t* true_command;
+
+// stack for clone_vm -- the child runs on it only until execvp()
+static char* clone_stack;
+
+
+int main(int argc, char* argv[]) {
+    char size_list[] = DEFAULT_SIZES;
+    size_t sizes[MAX_SIZES];
+    int num_sizes = parse_sizes(size_list, sizes, MAX_SIZES);
+    double seconds = DEFAULT_SECONDS;
+    uint64_t max_spawns = DEFAULT_MAX_SPAWNS;
+    const char* filter = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:d:n:f:")) != -1) {
+        switch (opt) {
+            case 's':
+                num_sizes = parse_sizes(optarg, sizes, MAX_SIZES);
+                if (num_sizes <= 0) return EXIT_FAILURE;
+                break;
+            case 'd':
+                seconds = atof(optarg);
+                if (seconds <= 0) {
+                    fprintf(stderr, "Error: -d needs a positive number of seconds\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'n':
+                max_spawns = strtoull(optarg, NULL, 10);
+                if (max_spawns == 0) {
+                    fprintf(stderr, "Error: -n needs a positive number of spawns\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s sizes] [-d seconds] [-n max_spawns] [-f filter]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    char command_line[] = "true";
+    true_command = parse_command_line(command_line);
+    clone_stack = malloc(CLONE_STACK_SIZE);
+    if (true_command == NULL || clone_stack == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return EXIT_FAILURE;
+    }
+
+    static histogram_t hist;
+    printf("%-10s %-24s %10s %10s %10s %10s %8s\n", "rss", "strategy", "mean_us", "p50_us", "p99_us", "max_us", "spawns");
+    for (int s = 0; s < num_sizes; s++) {
+        if (grow_ballast(sizes[s]) == -1) continue;
+        char rss[16];
+        format_size(resident_bytes(), rss, sizeof(rss));
+
+        for (size_t i = 0; i < sizeof(strategies) / sizeof(strategies[0]); i++) {
+            if (filter != NULL && strstr(strategies[i].name, filter) == NULL) continue;
+
+            // one warm-up spawn faults in the strategy's code and the command's page cache
+            if (strategies[i].spawn() == -1) {
+                fprintf(stderr, "Error: %s could not run '%s'\n", strategies[i].name, true_argv[0]);
+                continue;
+            }
+
+            hist_init(&hist);
+            uint64_t deadline = now_ns() + (uint64_t)(seconds * 1e9);
+            uint64_t spawns = 0;
+            while (spawns < max_spawns && (spawns < MIN_SPAWNS || now_ns() < deadline)) {
+                uint64_t start = now_ns();
+                if (strategies[i].spawn() == -1) break;
+                hist_record(&hist, now_ns() - start);
+                spawns++;
+            }
+
+            printf("%-10s %-24s %10.1f %10.1f %10.1f %10.1f %8llu\n", rss, strategies[i].name,
+                   hist_mean(&hist) / 1e3, (double)hist_percentile(&hist, 50) / 1e3,
+                   (double)hist_percentile(&hist, 99) / 1e3, (double)hist.max / 1e3, (unsigned long long)spawns);
+            fflush(stdout);
+        }
+    }
+
+    free_command(true_command);
+    free(clone_stack);
+    return EXIT_SUCCESS;
+}
+
+
+// strategies
+static int spawn_executor(void) {
+    return (execute_simple_command(true_command) == 0) ? 0 : -1;
+}
+
+static int spawn_fork(void) {
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("Error: fork failed");
+        return -1;
+    }
+    if (pid == 0) {
+        execvp(true_argv[0], true_argv);
+        _exit(127);
+    }
+    return wait_child(pid);
+}
+
+// the child may only exec or _exit -- it runs on the parent's memory and stack
+static int spawn_vfork(void) {
+    pid_t pid = vfork();
+    if (pid == -1) {
+        perror("Error: vfork failed");
+        return -1;
+    }
+    if (pid == 0) {
+        execvp(true_argv[0], true_argv);
+        _exit(127);
+    }
+    return wait_child(pid);
+}
+
+static int spawn_posix(void) {
+    pid_t pid;
+    int error = posix_spawnp(&pid, true_argv[0], NULL, NULL, true_argv, environ);
+    if (error != 0) {
+        fprintf(stderr, "Error: posix_spawnp failed: %s\n", strerror(error));
+        return -1;
+    }
+    return wait_child(pid);
+}
+
+// CLONE_VFORK keeps the parent asleep until the child execs, so the shared memory is never touched by both
+static int spawn_clone(void) {
+    pid_t pid = clone(clone_child, clone_stack + CLONE_STACK_SIZE, CLONE_VM | CLONE_VFORK | SIGCHLD, NULL);
+    if (pid == -1) {
+        perror("Error: clone failed");
+        return -1;
+    }
+    return wait_child(pid);
+}
+
+static int clone_child(void* arg) {
+    (void)arg;
+    execvp(true_argv[0], true_argv);
+    _exit(127);
+}
+
+// reaps the child -- 0 if it ran "true" and exited 0
+static int wait_child(pid_t pid) {
+    int status;
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            perror("Error: waitpid failed");
+            return -1;
+        }
+    }
+    return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+}
+
+
+// parent size
+// "10M,1G,8G" -- K, M and G are powers of 1024; returns the number of sizes or -1
+static int parse_sizes(char* text, size_t* sizes, int max) {
+    int count = 0;
+    for (char* item = strtok(text, ","); item != NULL; item = strtok(NULL, ",")) {
+        char* end;
+        unsigned long long value = strtoull(item, &end, 10);
+        if (*end == 'K' || *end == 'k') { value <<= 10; end++; }
+        else if (*end == 'M' || *end == 'm') { value <<= 20; end++; }
+        else if (*end == 'G' || *end == 'g') { value <<= 30; end++; }
+        if (end == item || *end != '\0' || count == max || (count > 0 && value < sizes[count - 1])) {
+            fprintf(stderr, "Error: bad size list entry '%s' (sizes must ascend)\n", item);
+            return -1;
+        }
+        sizes[count++] = (size_t)value;
+    }
+    return count;
+}
+
+// current RSS from /proc/self/statm (second field, in pages)
+static size_t resident_bytes(void) {
+    char text[128];
+    int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return 0;
+    ssize_t len = read(fd, text, sizeof(text) - 1);
+    close(fd);
+    if (len <= 0) return 0;
+    text[len] = '\0';
+
+    unsigned long size, resident;
+    if (sscanf(text, "%lu %lu", &size, &resident) != 2) return 0;
+    return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static size_t available_bytes(void) {
+    return (size_t)sysconf(_SC_AVPHYS_PAGES) * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+// maps and writes enough anonymous memory to bring RSS up to target -- the mappings are kept for the rest of the run
+// returns 0 on success (or if RSS is already there), -1 if the size was skipped
+static int grow_ballast(size_t target) {
+    char text[16];
+    size_t resident = resident_bytes();
+    if (resident >= target) return 0;
+
+    size_t grow = target - resident;
+    if (grow > available_bytes() / 10 * 9) {
+        format_size(target, text, sizeof(text));
+        fprintf(stderr, "Skipping RSS %s: not enough available memory\n", text);
+        return -1;
+    }
+
+    char* ballast = mmap(NULL, grow, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ballast == MAP_FAILED) {
+        format_size(target, text, sizeof(text));
+        fprintf(stderr, "Skipping RSS %s: ", text);
+        perror("mmap failed");
+        return -1;
+    }
+    // non-zero bytes, so no page can stay on the shared zero page
+    memset(ballast, 1, grow);
+    return 0;
+}
+
+static void format_size(size_t bytes, char* text, size_t size) {
+    if (bytes >= (1UL << 30)) snprintf(text, size, "%.1fG", (double)bytes / (double)(1UL << 30));
+    else snprintf(text, size, "%.1fM", (double)bytes / (double)(1UL << 20));
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
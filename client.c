@@ -15,10 +15,20 @@
 #include <sys/socket.h>  // socket(), connect(), send(), recv()
 #include <netinet/in.h>  // struct sockaddr_in
 #include <arpa/inet.h>   // inet_pton(), htons()
+#include <netinet/tcp.h> // TCP_NODELAY
 
 // system headers
 #include <errno.h>       // errno for error handling
-#include <fcntl.h>
+#include <fcntl.h>       // open() for -f scripts
+#include <limits.h>      // INT_MAX for an unlimited window
+#include <poll.h>        // poll() over stdin and the socket
+#include <sys/uio.h>     // writev() for output
+
+// framing shared with the server
+#include "protocol.h"
+
+// client --bench load generator
+#include "bench.h"
 
 
 // CLIENT configuration constants (must match server protocol)
@@ -26,16 +36,97 @@
 #define BUFFER_SIZE 4096          // buffer size for send/receive (must match server)
 #define SERVER_IP "127.0.0.1"     // default server IP (localhost)
 
+// reusable buffers -- allocated once per connection
+#define RECV_BUFFER_SIZE (256 * 1024)   // server replies -- large outputs arrive in few reads
+#define SEND_BUFFER_SIZE (64 * 1024)    // requests not yet accepted by the socket
+#define STDIN_BUFFER_SIZE (64 * 1024)   // typed-ahead input not yet sent
+#define MAX_COMMAND_SIZE BUFFER_SIZE    // longest request line the server accepts, newline included
+#define OUTPUT_IOV_MAX 64               // output slices gathered per writev()
+#define DEFAULT_WINDOW 64               // batch mode: requests in flight at once
 
-// function prototypes
 
-// socket management functions
-int create_and_connect_socket(const char* server_ip, int port);
+// how the client reads and submits commands
+typedef struct {
+    int input_fd;             // where commands come from -- stdin or the -f script
+    int batch;                // no prompts, requests pipelined, exit codes reported
+    int window;               // batch mode: max requests in flight, 0 = unlimited
+} client_options_t;
+
+
+// connection state for the event loop
+typedef struct {
+    int socket_fd;
+
+    // server -> client
+    char* recv_buf;           // received bytes, output payload is written from here
+    size_t recv_start;        // first unprocessed byte
+    size_t recv_end;          // one past the last received byte
+    char frame_type;          // type of the frame being received, 0 between frames
+    size_t frame_remaining;   // payload bytes of the current frame still to process
+    char last_byte;           // last output byte written -- decides the trailing newline
+    char trace[FRAME_TRACE_MAX + 1];  // @trace phase breakdown of the current reply, shown with its status
+    size_t trace_len;
+    char usage[FRAME_USAGE_MAX + 1];  // @time per-stage report of the current reply, shown with its status
+    size_t usage_len;
+    char list[FRAME_LIST_MAX + 1];    // per-entry statuses of a command list reply, shown with its status
+    size_t list_len;
+    char cursor[FRAME_CURSOR_MAX + 1];  // @page -- where the rest of a paged output can be read, shown with its status
+    size_t cursor_len;
+
+    // client -> server
+    char* send_buf;           // request bytes not yet accepted by the socket
+    size_t send_len;
+    int in_flight;            // requests sent whose end frame has not arrived
+    int max_in_flight;        // 1 for the interactive shell, the window in batch mode
+    char** pending;           // text of in-flight requests, oldest first (ring buffer)
+    int pending_head;
+    int pending_cap;
+
+    // user input
+    int input_fd;             // stdin or the script file
+    int batch;                // batch mode -- no prompts, status line per reply
+    int failed;               // replies whose status was not ok
+    char* input_buf;          // input bytes not yet turned into requests
+    size_t input_len;
+    int input_eof;            // stdin reached EOF
+    int discarding;           // dropping the rest of an over-long line
+    int exit_sent;            // exit queued -- its acknowledgment ends the session
+    int done;                 // session finished
+} client_conn_t;
+
+
+// function prototypes
 
 // user interface and command handling
-void run_client_loop(int socket_fd);
+int parse_client_options(int argc, char* argv[], client_options_t* options, const char** server_ip, int* port);
+void print_client_usage(const char* program);
+int run_client_loop(int socket_fd, const client_options_t* options);
 int is_empty_or_whitespace(const char* str);
 
+// connection state and event handling
+int client_conn_init(client_conn_t* conn, int socket_fd, const client_options_t* options);
+void client_conn_free(client_conn_t* conn);
+void write_prompt(client_conn_t* conn);
+void read_user_input(client_conn_t* conn);
+void dispatch_input_lines(client_conn_t* conn);
+int is_exit_command(const char* line);
+int push_pending(client_conn_t* conn, const char* line, size_t len);
+char* pop_pending(client_conn_t* conn);
+void queue_request(client_conn_t* conn, const char* data, size_t len);
+int flush_requests(client_conn_t* conn);
+int receive_server_data(client_conn_t* conn);
+void finish_reply(client_conn_t* conn, int exit_code, reply_status_t status);
+void print_reply_status(int exit_code, reply_status_t status);
+void print_usage_report(const char* report);
+void print_list_report(const char* report);
+void print_cursor_hint(const char* trailer);
+void print_notice(client_conn_t* conn, const char* text, size_t len);
+double usage_field(const char* line, const char* key);
+
+// output helpers
+int write_all(int fd, const void* data, size_t len);
+int write_all_iov(int fd, struct iovec* iov, int count);
+
 // error handling functions
 void print_connection_error(const char* server_ip, int port);
 void print_connection_lost_error(void);
@@ -46,18 +137,15 @@ int main(int argc, char* argv[]) {
     // parse command line arguments for server IP and port (optional)
     const char* server_ip = SERVER_IP;  // default to localhost
     int port = PORT;                     // default to 8080
+    client_options_t options;
 
-    // allow user to specify server IP and port as command line arguments
-    // Usage: ./client [server_ip] [port]
-    if (argc >= 2) {
-        server_ip = argv[1];  // use provided IP
+    // load generator mode -- everything after --bench belongs to it (see bench.c)
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        return run_bench(argc - 1, argv + 1);
     }
-    if (argc >= 3) {
-        port = atoi(argv[2]);  // use provided port
-        if (port <= 0 || port > 65535) {
-            fprintf(stderr, "Error: Invalid port number. Using default port %d\n", PORT);
-            port = PORT;
-        }
+
+    if (parse_client_options(argc, argv, &options, &server_ip, &port) == -1) {
+        return EXIT_FAILURE;
     }
 
     // create socket and connect to server
@@ -69,12 +157,79 @@ int main(int argc, char* argv[]) {
 
     // connection successful - enter main client loop
     // presents prompt, reads commands, sends to server, displays results
-    run_client_loop(socket_fd);
+    int status = run_client_loop(socket_fd, &options);
 
     // cleanup - close socket connection
     close(socket_fd);
+    if (options.input_fd != STDIN_FILENO) close(options.input_fd);
+
+    return status;
+}
+
+
+// command line options
+// Usage: ./client [-f script] [-w window] [-i] [server_ip] [port]
+// batch mode is used for -f and whenever stdin is not a terminal, -i forces the interactive shell
+// returns 0 on success, -1 on invalid options (usage already printed)
+int parse_client_options(int argc, char* argv[], client_options_t* options, const char** server_ip, int* port) {
+    int opt;
+    int force_interactive = 0;
+    const char* script = NULL;
+
+    options->input_fd = STDIN_FILENO;
+    options->batch = 0;
+    options->window = DEFAULT_WINDOW;
 
-    return EXIT_SUCCESS;
+    while ((opt = getopt(argc, argv, "f:w:i")) != -1) {
+        switch (opt) {
+            case 'f':
+                script = optarg;
+                break;
+            case 'w':
+                options->window = atoi(optarg);
+                if (options->window < 0) {
+                    print_client_usage(argv[0]);
+                    return -1;
+                }
+                break;
+            case 'i':
+                force_interactive = 1;
+                break;
+            default:
+                print_client_usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if (script != NULL) {
+        options->input_fd = open(script, O_RDONLY);
+        if (options->input_fd == -1) {
+            fprintf(stderr, "Error: Cannot open script '%s': %s\n", script, strerror(errno));
+            return -1;
+        }
+    }
+    options->batch = !force_interactive && (script != NULL || !isatty(STDIN_FILENO));
+
+    // allow user to specify server IP and port as command line arguments
+    // Usage: ./client [server_ip] [port]
+    if (optind < argc) {
+        *server_ip = argv[optind];  // use provided IP
+    }
+    if (optind + 1 < argc) {
+        *port = atoi(argv[optind + 1]);  // use provided port
+        if (*port <= 0 || *port > 65535) {
+            fprintf(stderr, "Error: Invalid port number. Using default port %d\n", PORT);
+            *port = PORT;
+        }
+    }
+    return 0;
+}
+
+void print_client_usage(const char* program) {
+    fprintf(stderr, "Usage: %s [-f script] [-w window] [-i] [server_ip] [port]\n", program);
+    fprintf(stderr, "  -f script  run commands from a file (batch mode)\n");
+    fprintf(stderr, "  -w window  batch mode: requests in flight at once, 0 = all (default %d)\n", DEFAULT_WINDOW);
+    fprintf(stderr, "  -i         interactive shell even when stdin is not a terminal\n");
 }
 
 
@@ -114,6 +269,10 @@ int create_and_connect_socket(const char* server_ip, int port) {
         return -1;
     }
 
+    // requests are small single lines -- send them immediately instead of waiting on Nagle
+    int nodelay = 1;
+    setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
     // connection successful
     return socket_fd;
 }
@@ -227,125 +386,574 @@ int create_and_connect_socket(const char* server_ip, int port) {
 
 // main client loop
 // presents shell prompt, reads user commands, sends to server, displays output
-// continues until user types "exit" or connection is lost
-void run_client_loop(int socket_fd) {
-    char command[BUFFER_SIZE];    // buffer for user input
-    char response[BUFFER_SIZE];   // buffer for server response
-    ssize_t bytes_received;
-
-    // main command loop - runs indefinitely until exit or disconnect
-    while (1) {
-        // display shell prompt (exactly like Phase 1 - clean, no extra text)
-        printf("$ ");
-        fflush(stdout);  // ensure prompt is displayed immediately
-
-        // read command from user input
-        // fgets reads a line including the newline character
-        if (fgets(command, sizeof(command), stdin) == NULL) {
-            // EOF encountered (Ctrl+D) or read error
-            // send exit command to server and disconnect gracefully
-            const char* exit_cmd = "exit\n";
-            send(socket_fd, exit_cmd, strlen(exit_cmd), 0);
+// event driven: one poll() watches the input and the socket together, so server output is
+// displayed the moment it arrives and the client never sits blocked on the wrong descriptor
+// batch mode keeps up to a window of requests in flight so a script pays one round trip, not one per command
+// continues until user types "exit", input ends, or connection is lost
+// returns EXIT_SUCCESS, or EXIT_FAILURE if the connection was lost or a batch command failed
+int run_client_loop(int socket_fd, const client_options_t* options) {
+    client_conn_t conn;
+    if (client_conn_init(&conn, socket_fd, options) == -1) {
+        perror("Error: Failed to allocate client buffers");
+        return EXIT_FAILURE;
+    }
+
+    // display shell prompt (exactly like Phase 1 - clean, no extra text)
+    write_prompt(&conn);
+
+    while (!conn.done) {
+        // hand the next typed command to the server once the previous reply is complete
+        dispatch_input_lines(&conn);
+        if (conn.done) break;
+
+        struct pollfd fds[2];
+        int nfds = 0;
+        int stdin_index = -1;
+
+        // stop reading input while the input buffer is full -- typed-ahead lines wait there
+        if (!conn.input_eof && conn.input_len < STDIN_BUFFER_SIZE) {
+            stdin_index = nfds;
+            fds[nfds].fd = conn.input_fd;
+            fds[nfds].events = POLLIN;
+            nfds++;
+        }
+        int socket_index = nfds;
+        fds[nfds].fd = socket_fd;
+        fds[nfds].events = POLLIN | (conn.send_len > 0 ? POLLOUT : 0);
+        nfds++;
+
+        if (poll(fds, (nfds_t)nfds, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("Error: poll failed");
             break;
         }
 
-        // check if command is empty or only whitespace
-        // don't send empty commands to server - just show prompt again
-        if (is_empty_or_whitespace(command)) {
-            continue;  // skip to next iteration, display prompt again
+        if (stdin_index >= 0 && fds[stdin_index].revents != 0) {
+            read_user_input(&conn);
         }
 
-        // send command to server
-        // command already includes newline from fgets (per protocol)
-        ssize_t bytes_sent = send(socket_fd, command, strlen(command), 0);
-        if (bytes_sent == -1) {
-            // send failed - connection might be lost
+        short socket_events = fds[socket_index].revents;
+        if ((socket_events & POLLOUT) && flush_requests(&conn) == -1) {
             perror("Error: Failed to send command to server");
             print_connection_lost_error();
             break;
         }
+        if (socket_events & (POLLIN | POLLHUP | POLLERR)) {
+            if (receive_server_data(&conn) == -1) {
+                print_connection_lost_error();
+                break;
+            }
+        }
+    }
+
+    int status = (conn.done && conn.failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    client_conn_free(&conn);
+    return status;
+}
+
+
+// connection state
+// allocates the reusable buffers once -- returns 0 on success, -1 on allocation failure
+int client_conn_init(client_conn_t* conn, int socket_fd, const client_options_t* options) {
+    memset(conn, 0, sizeof(*conn));
+    conn->socket_fd = socket_fd;
+    conn->input_fd = options->input_fd;
+    conn->batch = options->batch;
+    conn->last_byte = '\n';
+    conn->max_in_flight = 1;
+    if (options->batch) {
+        conn->max_in_flight = (options->window > 0) ? options->window : INT_MAX;
+    }
+    conn->pending_cap = 16;
+    conn->pending = malloc((size_t)conn->pending_cap * sizeof(char*));
+    conn->recv_buf = malloc(RECV_BUFFER_SIZE);
+    conn->send_buf = malloc(SEND_BUFFER_SIZE);
+    conn->input_buf = malloc(STDIN_BUFFER_SIZE);
+    if (conn->pending == NULL || conn->recv_buf == NULL || conn->send_buf == NULL || conn->input_buf == NULL) {
+        client_conn_free(conn);
+        return -1;
+    }
+    return 0;
+}
+
+void client_conn_free(client_conn_t* conn) {
+    while (conn->pending != NULL && conn->in_flight > 0) {
+        free(pop_pending(conn));
+    }
+    free(conn->pending);
+    conn->pending = NULL;
+    free(conn->recv_buf);
+    free(conn->send_buf);
+    free(conn->input_buf);
+    conn->recv_buf = conn->send_buf = conn->input_buf = NULL;
+}
+
+// writes the shell prompt -- raw write() so it never interleaves badly with writev() output
+// batch mode has no prompt
+void write_prompt(client_conn_t* conn) {
+    if (conn->batch) return;
+    write_all(STDOUT_FILENO, "$ ", 2);
+}
+
+
+// user input
+// reads whatever the input has into the input buffer -- never blocks, poll() said it is readable
+void read_user_input(client_conn_t* conn) {
+    ssize_t bytes = read(conn->input_fd, conn->input_buf + conn->input_len, STDIN_BUFFER_SIZE - conn->input_len);
+    if (bytes > 0) {
+        conn->input_len += (size_t)bytes;
+    } else if (bytes == 0 || errno != EINTR) {
+        // EOF encountered (Ctrl+D) or read error
+        conn->input_eof = 1;
+    }
+}
+
+// turns complete input lines into requests while the window has room for them
+// empty lines only redraw the prompt, "exit" and end of input close the session
+void dispatch_input_lines(client_conn_t* conn) {
+    // a full send buffer means the server is behind -- wait for POLLOUT before taking more lines
+    while (!conn->exit_sent && conn->in_flight < conn->max_in_flight && conn->send_len + MAX_COMMAND_SIZE <= SEND_BUFFER_SIZE) {
+        char* newline = memchr(conn->input_buf, '\n', conn->input_len);
+        size_t line_len;
+
+        if (newline != NULL) {
+            line_len = (size_t)(newline - conn->input_buf) + 1;
+        } else if (conn->input_eof && conn->input_len > 0) {
+            // last line without a newline -- still a command
+            line_len = conn->input_len;
+        } else if (conn->input_len == STDIN_BUFFER_SIZE) {
+            // a line longer than the whole buffer can never be sent -- drop it
+            fprintf(stderr, "Error: Command too long (max %d bytes)\n", MAX_COMMAND_SIZE - 1);
+            conn->input_len = 0;
+            conn->discarding = 1;
+            continue;
+        } else {
+            if (conn->input_eof && push_pending(conn, "exit", 4) == 0) {
+                // EOF encountered (Ctrl+D) -- send exit command to server and disconnect gracefully
+                queue_request(conn, "exit\n", 5);
+                conn->in_flight++;
+                conn->exit_sent = 1;
+            }
+            return;
+        }
 
-        // check if user wants to exit
-        // compare first 4 characters to handle "exit" or "exit\n"
-        if (strncmp(command, "exit", 4) == 0) {
-            // user requested exit - receive acknowledgment and break
-            // server sends empty response for exit command
-            recv(socket_fd, response, sizeof(response) - 1, 0);
-            break;  // exit the loop, closing connection
+        // copy the line out and consume it from the input buffer
+        char line[MAX_COMMAND_SIZE];
+        int too_long = conn->discarding || line_len >= sizeof(line);
+        if (!too_long) {
+            memcpy(line, conn->input_buf, line_len);
+            line[line_len] = '\0';
         }
+        conn->input_len -= line_len;
+        memmove(conn->input_buf, conn->input_buf + line_len, conn->input_len);
 
-        // receive response from server
-        // server sends command output (may be empty, single line, or multiple lines)
-        memset(response, 0, sizeof(response));  // clear buffer
-        bytes_received = recv(socket_fd, response, sizeof(response) - 1, 0);
+        if (too_long) {
+            // tail of an over-long line, or a line the server would split in two
+            if (!conn->discarding) {
+                fprintf(stderr, "Error: Command too long (max %d bytes)\n", MAX_COMMAND_SIZE - 1);
+            }
+            conn->discarding = 0;
+            write_prompt(conn);
+            continue;
+        }
 
-        // check for errors or connection closed
-        if (bytes_received < 0) {
-            // recv error - network issue
-            perror("Error: Failed to receive response from server");
-            print_connection_lost_error();
-            break;
-        } else if (bytes_received == 0) {
-            // server closed connection
-            print_connection_lost_error();
-            break;
+        // check if command is empty or only whitespace
+        // don't send empty commands to server - just show prompt again
+        if (is_empty_or_whitespace(line)) {
+            write_prompt(conn);
+            continue;
         }
 
-        // null-terminate the received data
-        response[bytes_received] = '\0';
-
-        // display server response to user
-        // output is displayed exactly as received (clean, no extra formatting)
-        // this preserves all newlines, spacing, and formatting from the command output
-        printf("%s", response);
-
-        // handle large outputs - keep receiving until no more data is immediately available
-        // temporarily set socket to non-blocking mode
-        int flags = fcntl(socket_fd, F_GETFL, 0);
-        fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK);
-        
-        while (1) {
-            // clear buffer for next chunk
-            memset(response, 0, sizeof(response));
-            
-            // try to receive more data (non-blocking because we set O_NONBLOCK)
-            ssize_t additional_bytes = recv(socket_fd, response, sizeof(response) - 1, 0);
-            
-            if (additional_bytes > 0) {
-                // more data available - display it
-                response[additional_bytes] = '\0';
-                printf("%s", response);
-                
-                // update bytes_received to track the last chunk
-                bytes_received = additional_bytes;
-            } else if (additional_bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-                // no more data available right now - this is normal, we're done receiving
+        // remember the command so its reply can be labelled
+        size_t text_len = (line[line_len - 1] == '\n') ? line_len - 1 : line_len;
+        if (push_pending(conn, line, text_len) == -1) {
+            perror("Error: Failed to queue command");
+            conn->done = 1;
+            return;
+        }
+
+        // command already includes newline (per protocol) unless it was the last line of input
+        queue_request(conn, line, line_len);
+        if (line[line_len - 1] != '\n') queue_request(conn, "\n", 1);
+        conn->in_flight++;
+
+        // check if user wants to exit -- the server's acknowledgment ends the session
+        if (is_exit_command(line)) {
+            conn->exit_sent = 1;
+        }
+    }
+}
+
+// returns 1 if the line is the exit command (surrounding whitespace ignored), 0 otherwise
+int is_exit_command(const char* line) {
+    while (*line == ' ' || *line == '\t') line++;
+    if (strncmp(line, "exit", 4) != 0) return 0;
+    return is_empty_or_whitespace(line + 4);
+}
+
+
+// in-flight request texts
+// the server replies strictly in request order, so a FIFO pairs every reply with its command
+// returns 0 on success, -1 on allocation failure
+int push_pending(client_conn_t* conn, const char* line, size_t len) {
+    if (conn->in_flight == conn->pending_cap) {
+        // grow and unwrap the ring so the oldest entry is at index 0
+        char** grown = malloc((size_t)conn->pending_cap * 2 * sizeof(char*));
+        if (grown == NULL) return -1;
+        for (int i = 0; i < conn->in_flight; i++) {
+            grown[i] = conn->pending[(conn->pending_head + i) % conn->pending_cap];
+        }
+        free(conn->pending);
+        conn->pending = grown;
+        conn->pending_head = 0;
+        conn->pending_cap *= 2;
+    }
+
+    char* text = malloc(len + 1);
+    if (text == NULL) return -1;
+    memcpy(text, line, len);
+    text[len] = '\0';
+    conn->pending[(conn->pending_head + conn->in_flight) % conn->pending_cap] = text;
+    return 0;
+}
+
+// removes and returns the oldest in-flight request text -- caller frees
+char* pop_pending(client_conn_t* conn) {
+    char* text = conn->pending[conn->pending_head];
+    conn->pending_head = (conn->pending_head + 1) % conn->pending_cap;
+    conn->in_flight--;
+    return text;
+}
+
+
+// requests to the server
+// appends request bytes to the send buffer and tries to send them right away
+void queue_request(client_conn_t* conn, const char* data, size_t len) {
+    if (conn->send_len + len > SEND_BUFFER_SIZE) {
+        // cannot happen with single-line requests -- the buffer holds many of them
+        fprintf(stderr, "Error: Request queue full, command dropped\n");
+        return;
+    }
+    memcpy(conn->send_buf + conn->send_len, data, len);
+    conn->send_len += len;
+    flush_requests(conn);
+}
+
+// sends as much of the send buffer as the socket accepts without blocking
+// returns 0 on success (possibly with bytes left for the next POLLOUT), -1 on failure
+int flush_requests(client_conn_t* conn) {
+    while (conn->send_len > 0) {
+        ssize_t sent = send(conn->socket_fd, conn->send_buf, conn->send_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        conn->send_len -= (size_t)sent;
+        memmove(conn->send_buf, conn->send_buf + sent, conn->send_len);
+    }
+    return 0;
+}
+
+
+// server replies
+// reads what the socket has and processes every complete piece of it
+// output payload is written to stdout straight from the receive buffer with writev()
+// returns 0 on success, -1 if the connection was closed, failed, or sent a malformed reply
+int receive_server_data(client_conn_t* conn) {
+    // compact so a read always has a large contiguous space
+    if (conn->recv_start > 0) {
+        memmove(conn->recv_buf, conn->recv_buf + conn->recv_start, conn->recv_end - conn->recv_start);
+        conn->recv_end -= conn->recv_start;
+        conn->recv_start = 0;
+    }
+
+    ssize_t bytes_received = recv(conn->socket_fd, conn->recv_buf + conn->recv_end, RECV_BUFFER_SIZE - conn->recv_end, MSG_DONTWAIT);
+    if (bytes_received == -1) {
+        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        // recv error - network issue
+        perror("Error: Failed to receive response from server");
+        return -1;
+    }
+    if (bytes_received == 0) {
+        // server closed connection
+        return -1;
+    }
+    conn->recv_end += (size_t)bytes_received;
+
+    // gather output slices and write them with as few syscalls as possible
+    struct iovec iov[OUTPUT_IOV_MAX];
+    int iov_count = 0;
+
+    while (conn->recv_start < conn->recv_end) {
+        char* data = conn->recv_buf + conn->recv_start;
+        size_t avail = conn->recv_end - conn->recv_start;
+
+        if (conn->frame_type == 0) {
+            // between frames -- parse the next header
+            size_t payload_len;
+            int header_len = frame_parse_header(data, avail, &conn->frame_type, &payload_len);
+            if (header_len == -1) {
+                fprintf(stderr, "Error: Malformed reply from server\n");
+                return -1;
+            }
+            if (header_len == 0) break;  // header incomplete -- wait for more bytes
+            conn->recv_start += (size_t)header_len;
+            conn->frame_remaining = payload_len;
+            continue;
+        }
+
+        if (conn->frame_type == FRAME_TRACE || conn->frame_type == FRAME_USAGE || conn->frame_type == FRAME_LIST ||
+            conn->frame_type == FRAME_CURSOR) {
+            // trace, usage, list and cursor trailers -- kept until the end frame so they print after the output
+            if (avail < conn->frame_remaining) {
+                if (conn->frame_remaining > RECV_BUFFER_SIZE / 2) {
+                    fprintf(stderr, "Error: Malformed reply from server\n");
+                    return -1;
+                }
+                break;
+            }
+            char* trailer = conn->usage;
+            size_t max = FRAME_USAGE_MAX;
+            size_t* trailer_len = &conn->usage_len;
+            if (conn->frame_type == FRAME_TRACE) { trailer = conn->trace; max = FRAME_TRACE_MAX; trailer_len = &conn->trace_len; }
+            if (conn->frame_type == FRAME_LIST) { trailer = conn->list; max = FRAME_LIST_MAX; trailer_len = &conn->list_len; }
+            if (conn->frame_type == FRAME_CURSOR) { trailer = conn->cursor; max = FRAME_CURSOR_MAX; trailer_len = &conn->cursor_len; }
+            size_t len = (conn->frame_remaining < max) ? conn->frame_remaining : max;
+            memcpy(trailer, data, len);
+            trailer[len] = '\0';
+            *trailer_len = len;
+            conn->recv_start += conn->frame_remaining;
+            conn->frame_type = 0;
+            continue;
+        }
+
+        if (conn->frame_type == FRAME_NOTICE) {
+            // a background job finished -- not part of any reply, shown as soon as it is complete
+            if (avail < conn->frame_remaining) {
+                if (conn->frame_remaining > RECV_BUFFER_SIZE / 2) {
+                    fprintf(stderr, "Error: Malformed reply from server\n");
+                    return -1;
+                }
                 break;
-            } else if (additional_bytes == 0) {
-                // connection closed by server
-                // restore blocking mode before returning
-                fcntl(socket_fd, F_SETFL, flags);
-                print_connection_lost_error();
-                return;
-            } else {
-                // real error occurred
-                perror("Error: Failed to receive response from server");
-                // restore blocking mode before returning
-                fcntl(socket_fd, F_SETFL, flags);
-                print_connection_lost_error();
-                return;
             }
+            if (write_all_iov(STDOUT_FILENO, iov, iov_count) == -1) return -1;
+            iov_count = 0;
+            print_notice(conn, data, conn->frame_remaining);
+            conn->recv_start += conn->frame_remaining;
+            conn->frame_type = 0;
+            continue;
         }
-        
-        // restore socket to blocking mode for next command
-        fcntl(socket_fd, F_SETFL, flags);
-
-        // ensure output ends with newline for clean formatting
-        // only add newline if the response was non-empty and doesn't already end with one
-        if (bytes_received > 0 && response[bytes_received - 1] != '\n') {
-            printf("\n");
+
+        if (conn->frame_type == FRAME_END) {
+            // the status payload is tiny -- wait until it is fully buffered
+            if (avail < conn->frame_remaining) {
+                if (conn->frame_remaining > RECV_BUFFER_SIZE / 2) {
+                    fprintf(stderr, "Error: Malformed reply from server\n");
+                    return -1;
+                }
+                break;
+            }
+            int exit_code;
+            reply_status_t status;
+            if (frame_parse_end(data, conn->frame_remaining, &exit_code, &status) == -1) {
+                fprintf(stderr, "Error: Malformed reply from server\n");
+                return -1;
+            }
+            conn->recv_start += conn->frame_remaining;
+            conn->frame_type = 0;
+
+            // everything before the end frame must reach the screen before the status does
+            if (write_all_iov(STDOUT_FILENO, iov, iov_count) == -1) return -1;
+            iov_count = 0;
+            finish_reply(conn, exit_code, status);
+            continue;
         }
+
+        // output frame (or a frame type this client does not know) -- pass the payload through
+        size_t chunk = (avail < conn->frame_remaining) ? avail : conn->frame_remaining;
+        if (conn->frame_type == FRAME_OUTPUT && chunk > 0) {
+            if (iov_count == OUTPUT_IOV_MAX) {
+                if (write_all_iov(STDOUT_FILENO, iov, iov_count) == -1) return -1;
+                iov_count = 0;
+            }
+            iov[iov_count].iov_base = data;
+            iov[iov_count].iov_len = chunk;
+            iov_count++;
+            conn->last_byte = data[chunk - 1];
+        }
+        conn->recv_start += chunk;
+        conn->frame_remaining -= chunk;
+        if (conn->frame_remaining == 0) conn->frame_type = 0;
     }
+
+    return write_all_iov(STDOUT_FILENO, iov, iov_count);
+}
+
+// completes one reply -- trailing newline, limit message, prompt for the next command
+// batch mode labels every reply with its exit code on stderr instead of prompting
+void finish_reply(client_conn_t* conn, int exit_code, reply_status_t status) {
+    // ensure output ends with newline for clean formatting
+    if (conn->last_byte != '\n') {
+        write_all(STDOUT_FILENO, "\n", 1);
+        conn->last_byte = '\n';
+    }
+
+    char* command = pop_pending(conn);
+    if (conn->exit_sent && conn->in_flight == 0) {
+        // server acknowledged exit -- session over
+        free(command);
+        conn->done = 1;
+        return;
+    }
+
+    // the server stopped the command -- say why, output above may be truncated
+    print_reply_status(exit_code, status);
+    if (conn->trace_len > 0) {
+        fprintf(stderr, "[trace ms] %s\n", conn->trace);
+        conn->trace_len = 0;
+    }
+    if (conn->usage_len > 0) {
+        print_usage_report(conn->usage);
+        conn->usage_len = 0;
+    }
+    if (conn->list_len > 0) {
+        print_list_report(conn->list);
+        conn->list_len = 0;
+    }
+    if (conn->cursor_len > 0) {
+        print_cursor_hint(conn->cursor);
+        conn->cursor_len = 0;
+    }
+    if (conn->batch) {
+        if (status != REPLY_OK) conn->failed++;
+        fprintf(stderr, "[exit %d] %s\n", exit_code, command);
+    }
+    free(command);
+    write_prompt(conn);
+}
+
+
+// writes the whole buffer to fd, retrying on partial writes -- returns 0 on success, -1 on failure
+int write_all(int fd, const void* data, size_t len) {
+    struct iovec iov;
+    iov.iov_base = (void*)data;
+    iov.iov_len = len;
+    return write_all_iov(fd, &iov, 1);
+}
+
+// writev() the slices in order, retrying on partial writes -- returns 0 on success, -1 on failure
+int write_all_iov(int fd, struct iovec* iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            perror("Error: Failed to write output");
+            return -1;
+        }
+        // skip fully written slices, then trim the partially written one
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= (size_t)written;
+        }
+    }
+    return 0;
+}
+
+
+// explains on stderr why the server stopped a command -- silent for normal completion
+void print_reply_status(int exit_code, reply_status_t status) {
+    switch (status) {
+        case REPLY_TIMEOUT:
+            fprintf(stderr, "Error: Command killed by server: wall-clock timeout exceeded\n");
+            break;
+        case REPLY_CPU_LIMIT:
+            fprintf(stderr, "Error: Command killed: CPU time limit exceeded (exit %d)\n", exit_code);
+            break;
+        case REPLY_OUTPUT_LIMIT:
+            fprintf(stderr, "Error: Command killed by server: output limit exceeded, output truncated\n");
+            break;
+        default:
+            // ok / failed are plain exit statuses, and error replies carry their own message
+            break;
+    }
+}
+
+// prints an @time report on stderr -- one line per stage with its share of the pipeline's CPU time
+//   [time] 2  91.3% cpu  pid=4242 exit=0 user_ms=85.120 sys_ms=3.210 ... cmd=grep x
+void print_usage_report(const char* report) {
+    double total_cpu = 0;
+    for (const char* line = report; line != NULL && *line != '\0'; ) {
+        total_cpu += usage_field(line, "user_ms=") + usage_field(line, "sys_ms=");
+        line = strchr(line, '\n');
+        if (line != NULL) line++;
+    }
+
+    int stage = 1;
+    for (const char* line = report; *line != '\0'; ) {
+        const char* end = strchr(line, '\n');
+        int len = (end != NULL) ? (int)(end - line) : (int)strlen(line);
+        if (strncmp(line, "pid=", 4) == 0) {
+            double cpu = usage_field(line, "user_ms=") + usage_field(line, "sys_ms=");
+            double share = (total_cpu > 0) ? 100.0 * cpu / total_cpu : 0;
+            fprintf(stderr, "[time] %d %5.1f%% cpu  %.*s\n", stage++, share, len, line);
+        } else {
+            // not_reported=<n> and anything newer servers add
+            fprintf(stderr, "[time] %.*s\n", len, line);
+        }
+        if (end == NULL) break;
+        line = end + 1;
+    }
+}
+
+// prints a background job's completion notice on stderr
+// at an idle prompt the notice gets a line of its own and the prompt is drawn again below it
+void print_notice(client_conn_t* conn, const char* text, size_t len) {
+    int idle = (!conn->batch && conn->in_flight == 0);
+    if (idle) write_all(STDOUT_FILENO, "\n", 1);
+    fprintf(stderr, "%.*s\n", (int)len, text);
+    if (idle) write_prompt(conn);
+}
+
+// prints a command list's statuses on stderr -- one line per entry, numbered in the order written
+//   [list] 2 exit=skipped cmd=make install
+void print_list_report(const char* report) {
+    int entry = 1;
+    for (const char* line = report; *line != '\0'; ) {
+        const char* end = strchr(line, '\n');
+        int len = (end != NULL) ? (int)(end - line) : (int)strlen(line);
+        if (strncmp(line, "exit=", 5) == 0) fprintf(stderr, "[list] %d %.*s\n", entry++, len, line);
+        else fprintf(stderr, "[list] %.*s\n", len, line);
+        if (end == NULL) break;
+        line = end + 1;
+    }
+}
+
+// tells where a paged output stands and how to read on, on stderr
+//   [page] 65536 of 22888896 bytes -- cursor 1 for more, cursor 1 search <text>, cursor 1 close
+void print_cursor_hint(const char* trailer) {
+    int id;
+    unsigned long long offset, total;
+    if (sscanf(trailer, "cursor=%d offset=%llu total=%llu", &id, &offset, &total) != 3) return;
+    if (offset < total) {
+        fprintf(stderr, "[page] %llu of %llu bytes -- cursor %d for more, cursor %d search <text>, cursor %d close\n",
+                offset, total, id, id, id);
+    } else {
+        fprintf(stderr, "[page] end of output (%llu bytes), cursor %d closed\n", total, id);
+    }
+}
+
+// numeric value of " key=" in one report line (key includes the '='), 0 if absent
+double usage_field(const char* line, const char* key) {
+    const char* end = strchr(line, '\n');
+    const char* field = strstr(line, key);
+    if (field == NULL || (end != NULL && field > end)) return 0;
+    return strtod(field + strlen(key), NULL);
 }
 
 
@@ -0,0 +1,325 @@
+// flight.c -- per-thread flight recorder rings and their dump file, see flight.h
+//
+// each ring has a single writer, its owning thread: a record is filled in place, then published
+// by advancing head -- nothing is shared between threads on the recording path
+// the dump runs inside the signal handler, so it only uses async-signal-safe calls
+// (open, write, close, clock_gettime) on memory that was allocated before the signal
+// dump file: a flight_header_t, then flight_record_t records, each ring oldest first
+
+// _GNU_SOURCE for SA_RESTART and SA_RESETHAND
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+
+#include "flight.h"
+#include "protocol.h"
+
+
+#define FLIGHT_RING_SIZE 1024               // records per thread -- a power of two, 64 KiB
+#define FLIGHT_MAGIC "FLIGHT1\n"
+#define FLIGHT_PATH_MAX 4096
+
+// start of a dump file
+typedef struct {
+    char magic[8];            // FLIGHT_MAGIC
+    uint32_t record_size;     // sizeof(flight_record_t) of the writer
+    int32_t pid;              // server process
+    int32_t signal;           // signal that triggered the dump
+    uint32_t reserved;
+    uint64_t realtime_ns;     // both clocks read at dump time -- maps ts_ns to wall-clock time
+    uint64_t monotonic_ns;
+} flight_header_t;
+
+// one thread's ring -- rings are never freed, a finished session hands its ring to the next one
+typedef struct flight_ring {
+    flight_record_t records[FLIGHT_RING_SIZE];
+    uint64_t head;            // records committed so far, written by the owner only
+    uint32_t number;
+    int in_use;
+    struct flight_ring* next; // immutable once published
+} flight_ring_t;
+
+// signals that dump the rings -- SIGUSR1 on request, the rest are crashes
+static const int crash_signals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+
+static const char* const event_names[FLIGHT_EVENT_COUNT] = {
+    "open", "close", "refused", "request", "fork", "reap", "reply"
+};
+
+static flight_ring_t* ring_list = NULL;                     // push-only, lock-free
+static uint32_t ring_count = 0;
+static char dump_path[FLIGHT_PATH_MAX];
+static pid_t server_pid;                                    // command children inherit the handlers
+static int dumping;
+
+static __thread flight_ring_t* local_ring = NULL;
+static __thread uint64_t local_session;
+static __thread uint64_t local_request;
+static __thread flight_record_t scratch;                    // target of records when no ring could be allocated
+
+// prototypes
+static flight_ring_t* flight_local(void);
+static uint64_t clock_ns(clockid_t clock);
+static void flight_signal(int sig);
+static void flight_dump(int sig);
+static void write_quietly(int fd, const void* data, size_t len);
+static int compare_records(const void* a, const void* b);
+static void print_record(const flight_record_t* rec, const flight_header_t* header);
+
+
+// setup
+int flight_start(const char* path) {
+    if (strlen(path) >= sizeof(dump_path)) {
+        fprintf(stderr, "Error: flight recorder path too long\n");
+        return -1;
+    }
+    strcpy(dump_path, path);
+    server_pid = getpid();
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = flight_signal;
+    sigemptyset(&action.sa_mask);
+
+    // SIGUSR1 dumps and carries on -- interrupted system calls resume on their own
+    action.sa_flags = SA_RESTART;
+    if (sigaction(SIGUSR1, &action, NULL) == -1) {
+        perror("Error: sigaction failed for SIGUSR1");
+        return -1;
+    }
+
+    // crashes dump once, then the default action (core dump) runs as if we were not here
+    action.sa_flags = SA_RESETHAND;
+    for (size_t i = 0; i < sizeof(crash_signals) / sizeof(crash_signals[0]); i++) {
+        if (sigaction(crash_signals[i], &action, NULL) == -1) {
+            perror("Error: sigaction failed for a crash signal");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+// recording
+// the calling thread's ring -- taken from the pool on first use, or allocated if none is free
+static flight_ring_t* flight_local(void) {
+    if (local_ring != NULL) return local_ring;
+
+    for (flight_ring_t* ring = __atomic_load_n(&ring_list, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&ring->in_use, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            local_ring = ring;
+            return ring;
+        }
+    }
+
+    flight_ring_t* ring = calloc(1, sizeof(flight_ring_t));
+    if (ring == NULL) {
+        // nowhere to record -- records go to the scratch record and are lost
+        return NULL;
+    }
+    ring->number = __atomic_add_fetch(&ring_count, 1, __ATOMIC_RELAXED);
+    ring->in_use = 1;
+    ring->next = __atomic_load_n(&ring_list, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&ring_list, &ring->next, ring, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        // another thread published first -- ring->next now holds the new head, retry
+    }
+    local_ring = ring;
+    return ring;
+}
+
+void flight_set_session(unsigned long session) {
+    local_session = session;
+    local_request = 0;
+}
+
+void flight_next_request(void) {
+    local_request++;
+}
+
+flight_record_t* flight_begin(flight_event_t event) {
+    flight_ring_t* ring = flight_local();
+    flight_record_t* rec = (ring != NULL) ? &ring->records[ring->head & (FLIGHT_RING_SIZE - 1)] : &scratch;
+
+    memset(rec, 0, sizeof(*rec));
+    rec->ts_ns = clock_ns(CLOCK_MONOTONIC);
+    rec->session = local_session;
+    rec->request = local_request;
+    rec->exit_code = -1;
+    rec->event = (uint16_t)event;
+    if (ring != NULL) rec->thread = ring->number;
+    return rec;
+}
+
+void flight_commit(flight_record_t* rec) {
+    if (rec == &scratch) return;
+    __atomic_store_n(&local_ring->head, local_ring->head + 1, __ATOMIC_RELEASE);
+}
+
+void flight_thread_done(void) {
+    if (local_ring == NULL) return;
+    __atomic_store_n(&local_ring->in_use, 0, __ATOMIC_RELEASE);
+    local_ring = NULL;
+    local_session = 0;
+    local_request = 0;
+}
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+
+// dumping -- signal handler context from here on
+static void flight_signal(int sig) {
+    int saved_errno = errno;
+
+    // a crashing command child must not overwrite the server's dump with its stale copy
+    if (getpid() == server_pid && !__atomic_exchange_n(&dumping, 1, __ATOMIC_ACQUIRE)) {
+        flight_dump(sig);
+        __atomic_store_n(&dumping, 0, __ATOMIC_RELEASE);
+    }
+
+    errno = saved_errno;
+
+    // SA_RESETHAND restored the default action -- the raised signal is delivered once we return
+    if (sig != SIGUSR1) raise(sig);
+}
+
+static void flight_dump(int sig) {
+    int fd = open(dump_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) return;
+
+    flight_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FLIGHT_MAGIC, sizeof(header.magic));
+    header.record_size = sizeof(flight_record_t);
+    header.pid = (int32_t)server_pid;
+    header.signal = sig;
+    header.realtime_ns = clock_ns(CLOCK_REALTIME);
+    header.monotonic_ns = clock_ns(CLOCK_MONOTONIC);
+    write_quietly(fd, &header, sizeof(header));
+
+    for (flight_ring_t* ring = __atomic_load_n(&ring_list, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (head < FLIGHT_RING_SIZE) {
+            write_quietly(fd, ring->records, head * sizeof(flight_record_t));
+            continue;
+        }
+
+        // a full ring -- skip the oldest slot, its owner may be overwriting it right now
+        // oldest first: the slots after it to the end of the ring, then the ones from the start up to it
+        size_t skip = (size_t)(head & (FLIGHT_RING_SIZE - 1));
+        size_t after = FLIGHT_RING_SIZE - 1 - skip;
+        if (after > 0) write_quietly(fd, &ring->records[skip + 1], after * sizeof(flight_record_t));
+        if (skip > 0) write_quietly(fd, ring->records, skip * sizeof(flight_record_t));
+    }
+    close(fd);
+
+    const char* note = "flight recorder dumped to ";
+    write_quietly(STDERR_FILENO, note, strlen(note));
+    write_quietly(STDERR_FILENO, dump_path, strlen(dump_path));
+    write_quietly(STDERR_FILENO, "\n", 1);
+}
+
+static void write_quietly(int fd, const void* data, size_t len) {
+    const char* p = data;
+    while (len > 0) {
+        ssize_t written = write(fd, p, len);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        p += written;
+        len -= (size_t)written;
+    }
+}
+
+
+// decoding -- ordinary context again
+int flight_decode(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        perror("Error: cannot open flight recorder dump");
+        return -1;
+    }
+
+    flight_header_t header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, FLIGHT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.record_size != sizeof(flight_record_t)) {
+        fprintf(stderr, "Error: %s is not a flight recorder dump of this server version\n", path);
+        fclose(file);
+        return -1;
+    }
+
+    // the whole dump in memory, so events of every thread can be merged by time
+    size_t count = 0;
+    size_t capacity = FLIGHT_RING_SIZE;
+    flight_record_t* records = malloc(capacity * sizeof(flight_record_t));
+    while (records != NULL && fread(&records[count], sizeof(flight_record_t), 1, file) == 1) {
+        if (++count == capacity) {
+            capacity *= 2;
+            flight_record_t* grown = realloc(records, capacity * sizeof(flight_record_t));
+            if (grown == NULL) {
+                free(records);
+                records = NULL;
+                break;
+            }
+            records = grown;
+        }
+    }
+    fclose(file);
+    if (records == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        return -1;
+    }
+
+    qsort(records, count, sizeof(flight_record_t), compare_records);
+
+    printf("# flight recorder dump: server pid %d, signal %d, %zu records\n", header.pid, header.signal, count);
+    for (size_t i = 0; i < count; i++) print_record(&records[i], &header);
+
+    free(records);
+    return 0;
+}
+
+// oldest first -- ties keep each thread's records together
+static int compare_records(const void* a, const void* b) {
+    const flight_record_t* x = a;
+    const flight_record_t* y = b;
+    if (x->ts_ns != y->ts_ns) return (x->ts_ns < y->ts_ns) ? -1 : 1;
+    if (x->thread != y->thread) return (x->thread < y->thread) ? -1 : 1;
+    return 0;
+}
+
+// e.g. 2026-10-18 12:00:01.123456 t2 s3 r17 reply    pid=4561 exit=0 status=ok out=12 ms=1.234
+static void print_record(const flight_record_t* rec, const flight_header_t* header) {
+    // monotonic timestamps become wall-clock time through the clock pair read at dump time
+    uint64_t wall_ns = header->realtime_ns - (header->monotonic_ns - rec->ts_ns);
+    time_t seconds = (time_t)(wall_ns / 1000000000ULL);
+    struct tm local;
+    char when[32];
+    localtime_r(&seconds, &local);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &local);
+
+    const char* event = (rec->event < FLIGHT_EVENT_COUNT) ? event_names[rec->event] : "unknown";
+    printf("%s.%06lu t%u s%llu r%llu %-8s", when, (unsigned long)(wall_ns % 1000000000ULL / 1000), rec->thread,
+           (unsigned long long)rec->session, (unsigned long long)rec->request, event);
+
+    if (rec->pid != 0) printf(" pid=%d", rec->pid);
+    if (rec->event == FLIGHT_REAP || rec->event == FLIGHT_REPLY) {
+        printf(" exit=%d status=%s", rec->exit_code, reply_status_name((reply_status_t)rec->status));
+    }
+    if (rec->bytes_in > 0) printf(" in=%llu", (unsigned long long)rec->bytes_in);
+    if (rec->event == FLIGHT_REAP || rec->event == FLIGHT_REPLY) printf(" out=%llu", (unsigned long long)rec->bytes_out);
+    if (rec->duration_ns > 0) printf(" ms=%.3f", (double)rec->duration_ns / 1e6);
+    printf("\n");
+}
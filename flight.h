@@ -0,0 +1,73 @@
+// header guard to prevent multiple inclusions of this file
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+// flight.h -- always-on in-memory flight recorder for the server
+//
+// every thread appends fixed-size binary records (one cache line each) to its own ring:
+// no locks, no formatting, no system call beyond a vDSO clock read, so it stays on for every command
+// the rings are written to a file only when asked to:
+//   kill -USR1 <server pid>      dumps the rings and keeps running
+//   SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT   dump the rings, then die as before
+// ./server -D <file> decodes a dump into one line per event, oldest first
+//
+// usage:
+//   flight_record_t* rec = flight_begin(FLIGHT_FORK);   // never NULL
+//   rec->pid = pid;
+//   rec->duration_ns = ...;
+//   flight_commit(rec);
+
+#include <stdint.h>
+
+// what a record marks -- most are the end of a phase of one request
+typedef enum {
+    FLIGHT_SESSION_OPEN,
+    FLIGHT_SESSION_CLOSE,
+    FLIGHT_SESSION_REFUSED,   // accept loop turned a connection away
+    FLIGHT_REQUEST,           // request line received -- bytes_in = line length
+    FLIGHT_FORK,              // command child forked -- pid (-1 if fork failed), duration = fork phase
+    FLIGHT_REAP,              // command child reaped -- exit code, status, bytes_out = captured output
+    FLIGHT_REPLY,             // reply sent -- exit code, status, bytes_out = output sent, duration = total
+    FLIGHT_EVENT_COUNT
+} flight_event_t;
+
+// one record -- 64 bytes, the layout of the dump file too
+typedef struct {
+    uint64_t ts_ns;           // CLOCK_MONOTONIC
+    uint64_t session;         // 0 outside a session
+    uint64_t request;         // per-session request number, 0 before the first request
+    uint64_t duration_ns;     // length of the phase that ended, 0 if none
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    int32_t pid;              // command child, 0 if none
+    int32_t exit_code;        // -1 if unknown
+    uint16_t event;           // flight_event_t
+    uint16_t status;          // reply_status_t for FLIGHT_REAP and FLIGHT_REPLY
+    uint32_t thread;          // ring number -- rings are reused by later sessions
+} flight_record_t;
+
+
+// installs the dump handlers -- dumps go to path (copied), call once before the first session
+// returns 0 on success, -1 on failure (error already printed)
+int flight_start(const char* path);
+
+// tags the calling thread's records with a session id and restarts its request numbering
+void flight_set_session(unsigned long session);
+
+// starts the next request of the calling thread's session
+void flight_next_request(void);
+
+// starts a record in the calling thread's ring -- timestamp, session and request are filled in,
+// everything else is zero (exit_code -1); the record is not part of a dump until committed
+flight_record_t* flight_begin(flight_event_t event);
+
+// publishes a record
+void flight_commit(flight_record_t* rec);
+
+// returns the calling thread's ring to the pool -- call when a session thread ends
+void flight_thread_done(void);
+
+// prints a dump file as text on stdout -- returns 0 on success, -1 on failure (error already printed)
+int flight_decode(const char* path);
+
+#endif /* FLIGHT_H */
@@ -0,0 +1,74 @@
+// histogram.c -- log-linear latency histogram, see histogram.h
+
+#include <string.h>
+
+#include "histogram.h"
+
+
+// bucket layout
+// values below HIST_SUB_BUCKETS get one bucket each (exact)
+// above that, a value with its top bit at position msb lands in group (msb - HIST_SUB_BITS + 1),
+// and the HIST_SUB_BITS bits below the top bit pick the sub-bucket inside the group
+static int bucket_index(uint64_t value) {
+    if (value < HIST_SUB_BUCKETS) return (int)value;
+
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - HIST_SUB_BITS;
+    int sub = (int)(value >> shift) - HIST_SUB_BUCKETS;
+    return (shift + 1) * HIST_SUB_BUCKETS + sub;
+}
+
+// largest value that maps to the given bucket
+static uint64_t bucket_upper(int index) {
+    if (index < HIST_SUB_BUCKETS) return (uint64_t)index;
+
+    int shift = index / HIST_SUB_BUCKETS - 1;
+    uint64_t sub = (uint64_t)(index % HIST_SUB_BUCKETS) + HIST_SUB_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+}
+
+
+void hist_init(histogram_t* hist) {
+    memset(hist, 0, sizeof(*hist));
+    hist->min = UINT64_MAX;
+}
+
+void hist_record(histogram_t* hist, uint64_t value) {
+    hist->counts[bucket_index(value)]++;
+    hist->total++;
+    hist->sum += (double)value;
+    if (value < hist->min) hist->min = value;
+    if (value > hist->max) hist->max = value;
+}
+
+void hist_merge(histogram_t* dst, const histogram_t* src) {
+    if (src->total == 0) return;
+    for (int i = 0; i < HIST_BUCKETS; i++) dst->counts[i] += src->counts[i];
+    dst->total += src->total;
+    dst->sum += src->sum;
+    if (src->min < dst->min) dst->min = src->min;
+    if (src->max > dst->max) dst->max = src->max;
+}
+
+uint64_t hist_percentile(const histogram_t* hist, double percentile) {
+    if (hist->total == 0) return 0;
+    if (percentile >= 100.0) return hist->max;
+
+    // rank of the wanted value, 1-based -- p0 is the smallest value
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)hist->total + 0.5);
+    if (rank == 0) rank = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen >= rank) {
+            uint64_t value = bucket_upper(i);
+            return (value > hist->max) ? hist->max : value;
+        }
+    }
+    return hist->max;
+}
+
+double hist_mean(const histogram_t* hist) {
+    return (hist->total > 0) ? hist->sum / (double)hist->total : 0.0;
+}
@@ -0,0 +1,42 @@
+// header guard to prevent multiple inclusions of this file
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+// histogram.h -- fixed-size latency histogram (HDR-style log-linear buckets)
+//
+// values are unsigned 64-bit integers (nanoseconds in practice)
+// every power of two is split into HIST_SUB_BUCKETS linear sub-buckets, so any
+// recorded value is reported with a relative error below 1 / HIST_SUB_BUCKETS
+// recording is a few instructions and never allocates -- safe on hot paths
+
+#include <stdint.h>
+
+#define HIST_SUB_BITS 7                                   // 128 sub-buckets -- under 0.8% error
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;           // number of recorded values
+    uint64_t min;             // exact smallest value, UINT64_MAX while empty
+    uint64_t max;             // exact largest value
+    double sum;               // for the mean
+} histogram_t;
+
+
+// clears a histogram
+void hist_init(histogram_t* hist);
+
+// records one value
+void hist_record(histogram_t* hist, uint64_t value);
+
+// adds every value recorded in src to dst
+void hist_merge(histogram_t* dst, const histogram_t* src);
+
+// returns the value at the given percentile (0-100) -- the top of its bucket, never above max
+uint64_t hist_percentile(const histogram_t* hist, double percentile);
+
+// returns the mean of the recorded values, 0 when empty
+double hist_mean(const histogram_t* hist);
+
+#endif /* HISTOGRAM_H */
@@ -0,0 +1,371 @@
+// log.c -- asynchronous structured logging, see log.h
+//
+// the ring is a bounded multi-producer queue (sequence number per slot):
+//   a producer claims slot `pos` by advancing enqueue_pos with a CAS, fills the slot,
+//   then publishes it by setting the slot's sequence to pos + 1
+//   the single writer thread consumes slots in order and hands them back by setting pos + LOG_SLOTS
+// a producer that finds its slot still unconsumed knows the ring is full and drops the record
+//
+// a record that does not fit its slot is cut at a field boundary: a field is written whole or not at all
+// (a string value may be cut short), and the closing quote, brackets and braces always fit in the reserve,
+// so even a truncated record is valid JSON
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "log.h"
+
+
+#define LOG_SLOTS 2048                      // records in flight -- a power of two
+#define LOG_SLOT_SIZE 2048                  // longest record, newline included -- room for a slow_command record
+#define LOG_SLOT_RESERVE 32                 // kept free for the closing fields of a truncated record
+#define LOG_MAX_DEPTH 4                     // nested objects and arrays -- deeper ones are dropped
+#define LOG_BATCH_SIZE (64 * 1024)          // bytes the writer gathers per write()
+#define LOG_IDLE_NS (2 * 1000 * 1000)       // writer sleep when the ring is empty
+
+struct log_record {
+    size_t seq;               // slot sequence -- see the top of this file
+    size_t pos;               // claimed position, published as seq = pos + 1
+    size_t len;
+    int truncated;            // out of room -- no more fields are written
+    int depth;                // open nested objects and arrays
+    int skipped;              // nested values opened after truncation, closed without output
+    char closers[LOG_MAX_DEPTH];
+    char text[LOG_SLOT_SIZE];
+};
+
+static const char* const level_names[] = { "debug", "info", "warn", "error" };
+
+static log_record_t ring[LOG_SLOTS];
+static size_t enqueue_pos;
+static size_t dequeue_pos;                  // writer thread only
+static unsigned long dropped;               // records lost to a full ring since the last report
+static int running;
+static int stopping;
+static pthread_t writer;
+
+static log_level_t min_level = LOG_INFO;
+static unsigned sample_every = 1;
+static log_output_mode_t output_mode = LOG_OUTPUT_SIZE;
+
+static __thread unsigned long session_id;
+static __thread unsigned sample_tick;
+
+// prototypes
+static void* log_writer(void* arg);
+static int write_fully(int fd, const char* data, size_t len);
+static size_t rec_room(const log_record_t* rec);
+static void rec_append(log_record_t* rec, const char* data, size_t len);
+static void rec_printf(log_record_t* rec, const char* format, ...);
+static void rec_escaped(log_record_t* rec, const char* data, size_t len);
+static const char* rec_separator(const log_record_t* rec);
+static void rec_reserved(log_record_t* rec, char c);
+static void rec_open(log_record_t* rec, const char* key, char opener, char closer);
+static void rec_close(log_record_t* rec);
+
+
+// configuration
+int log_parse_level(const char* name, log_level_t* level) {
+    for (int i = LOG_DEBUG; i <= LOG_ERROR; i++) {
+        if (strcmp(name, level_names[i]) == 0) {
+            *level = (log_level_t)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void log_configure(log_level_t level, unsigned sample, log_output_mode_t mode) {
+    min_level = level;
+    sample_every = (sample > 0) ? sample : 1;
+    output_mode = mode;
+}
+
+int log_start(void) {
+    for (size_t i = 0; i < LOG_SLOTS; i++) __atomic_store_n(&ring[i].seq, i, __ATOMIC_RELAXED);
+    enqueue_pos = 0;
+    dequeue_pos = 0;
+    stopping = 0;
+
+    int err = pthread_create(&writer, NULL, log_writer, NULL);
+    if (err != 0) {
+        fprintf(stderr, "Error: log writer thread creation failed: %s\n", strerror(err));
+        return -1;
+    }
+    __atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void log_shutdown(void) {
+    if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) return;
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+}
+
+void log_set_session(unsigned long session) {
+    session_id = session;
+}
+
+unsigned long log_session(void) {
+    return session_id;
+}
+
+log_output_mode_t log_output_mode(void) {
+    return output_mode;
+}
+
+
+// producers
+log_record_t* log_begin(log_level_t level, const char* event, int sampled) {
+    if (level < min_level || !__atomic_load_n(&running, __ATOMIC_ACQUIRE)) return NULL;
+
+    // sampling only thins routine records -- warnings and errors are always kept
+    if (sampled && level <= LOG_INFO && sample_every > 1 && (sample_tick++ % sample_every) != 0) return NULL;
+
+    // claim a slot
+    log_record_t* rec;
+    size_t pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    while (1) {
+        rec = &ring[pos & (LOG_SLOTS - 1)];
+        size_t seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+            // lost the race -- pos now holds the current position, retry
+        } else if (diff < 0) {
+            // the writer has not consumed this slot yet -- ring full, never wait
+            __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    rec->pos = pos;
+    rec->len = 0;
+    rec->truncated = 0;
+    rec->depth = 0;
+    rec->skipped = 0;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    rec_printf(rec, "{\"ts\":%lld.%06ld,\"level\":\"%s\",\"event\":\"%s\"",
+               (long long)now.tv_sec, now.tv_nsec / 1000, level_names[level], event);
+    if (session_id != 0) rec_printf(rec, ",\"session\":%lu", session_id);
+
+    unsigned long lost = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+    if (lost > 0) rec_printf(rec, ",\"dropped\":%lu", lost);
+    return rec;
+}
+
+void log_str(log_record_t* rec, const char* key, const char* value) {
+    log_bytes(rec, key, value, strlen(value));
+}
+
+void log_bytes(log_record_t* rec, const char* key, const char* data, size_t len) {
+    if (key != NULL) rec_printf(rec, "%s\"%s\":\"", rec_separator(rec), key);
+    else rec_printf(rec, "%s\"", rec_separator(rec));
+    if (rec->truncated) return;
+
+    // the value may be cut short, its closing quote always fits
+    rec_escaped(rec, data, len);
+    rec_reserved(rec, '"');
+}
+
+void log_int(log_record_t* rec, const char* key, long long value) {
+    if (key != NULL) rec_printf(rec, "%s\"%s\":%lld", rec_separator(rec), key, value);
+    else rec_printf(rec, "%s%lld", rec_separator(rec), value);
+}
+
+void log_double(log_record_t* rec, const char* key, double value) {
+    if (key != NULL) rec_printf(rec, "%s\"%s\":%.3f", rec_separator(rec), key, value);
+    else rec_printf(rec, "%s%.3f", rec_separator(rec), value);
+}
+
+void log_object_begin(log_record_t* rec, const char* key) {
+    rec_open(rec, key, '{', '}');
+}
+
+void log_object_end(log_record_t* rec) {
+    rec_close(rec);
+}
+
+void log_array_begin(log_record_t* rec, const char* key) {
+    rec_open(rec, key, '[', ']');
+}
+
+void log_array_end(log_record_t* rec) {
+    rec_close(rec);
+}
+
+void log_commit(log_record_t* rec) {
+    // nested values left open by the caller, then the closing fields -- the reserve has room for all of them
+    while (rec->depth > 0) rec_close(rec);
+    const char* tail = rec->truncated ? ",\"truncated\":true}\n" : "}\n";
+    size_t tail_len = strlen(tail);
+    memcpy(rec->text + rec->len, tail, tail_len);
+    rec->len += tail_len;
+
+    __atomic_store_n(&rec->seq, rec->pos + 1, __ATOMIC_RELEASE);
+}
+
+void log_message(log_level_t level, const char* event, const char* message) {
+    log_record_t* rec = log_begin(level, event, 0);
+    if (rec == NULL) return;
+    log_str(rec, "msg", message);
+    log_commit(rec);
+}
+
+
+// record building -- everything stops at the reserve, the record is then marked truncated
+// and every later field is skipped, so the record ends at a field boundary
+
+// bytes left before the reserve -- closers may already have dipped into it
+static size_t rec_room(const log_record_t* rec) {
+    size_t limit = LOG_SLOT_SIZE - LOG_SLOT_RESERVE;
+    return (rec->len < limit) ? limit - rec->len : 0;
+}
+
+// appends all of data or nothing
+static void rec_append(log_record_t* rec, const char* data, size_t len) {
+    if (rec->truncated) return;
+    if (len > rec_room(rec)) {
+        rec->truncated = 1;
+        return;
+    }
+    memcpy(rec->text + rec->len, data, len);
+    rec->len += len;
+}
+
+// appends all of the formatted text or nothing
+static void rec_printf(log_record_t* rec, const char* format, ...) {
+    if (rec->truncated) return;
+    size_t room = rec_room(rec);
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(rec->text + rec->len, room + 1, format, args);
+    va_end(args);
+    if (n < 0) return;
+    if ((size_t)n > room) {
+        rec->truncated = 1;
+    } else {
+        rec->len += (size_t)n;
+    }
+}
+
+// no comma before the first value of an object or array
+static const char* rec_separator(const log_record_t* rec) {
+    char last = (rec->len > 0) ? rec->text[rec->len - 1] : '{';
+    return (last == '{' || last == '[') ? "" : ",";
+}
+
+// one closing character, written into the reserve if need be
+static void rec_reserved(log_record_t* rec, char c) {
+    if (rec->len < LOG_SLOT_SIZE) rec->text[rec->len++] = c;
+}
+
+// opens a nested object or array -- key NULL for an element of an array
+static void rec_open(log_record_t* rec, const char* key, char opener, char closer) {
+    if (rec->depth == LOG_MAX_DEPTH) rec->truncated = 1;
+    if (key != NULL) rec_printf(rec, "%s\"%s\":%c", rec_separator(rec), key, opener);
+    else rec_printf(rec, "%s%c", rec_separator(rec), opener);
+    if (rec->truncated) {
+        // nothing was written -- the matching close writes nothing either
+        rec->skipped++;
+        return;
+    }
+    rec->closers[rec->depth++] = closer;
+}
+
+static void rec_close(log_record_t* rec) {
+    if (rec->skipped > 0) {
+        rec->skipped--;
+    } else if (rec->depth > 0) {
+        rec_reserved(rec, rec->closers[--rec->depth]);
+    }
+}
+
+// JSON string escaping -- quotes, backslashes and control characters
+static void rec_escaped(log_record_t* rec, const char* data, size_t len) {
+    for (size_t i = 0; i < len && !rec->truncated; i++) {
+        unsigned char c = (unsigned char)data[i];
+        char esc[8];
+        if (c == '"' || c == '\\') {
+            esc[0] = '\\';
+            esc[1] = (char)c;
+            rec_append(rec, esc, 2);
+        } else if (c == '\n') {
+            rec_append(rec, "\\n", 2);
+        } else if (c == '\t') {
+            rec_append(rec, "\\t", 2);
+        } else if (c < 0x20 || c == 0x7f) {
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            rec_append(rec, esc, 6);
+        } else {
+            esc[0] = (char)c;
+            rec_append(rec, esc, 1);
+        }
+    }
+}
+
+
+// writer thread
+// gathers published records into one batch and writes it with a single write()
+static void* log_writer(void* arg) {
+    (void)arg;
+    static char batch[LOG_BATCH_SIZE];
+    size_t batch_len = 0;
+
+    while (1) {
+        log_record_t* rec = &ring[dequeue_pos & (LOG_SLOTS - 1)];
+        if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) == dequeue_pos + 1) {
+            if (batch_len + rec->len > sizeof(batch)) {
+                write_fully(STDOUT_FILENO, batch, batch_len);
+                batch_len = 0;
+            }
+            memcpy(batch + batch_len, rec->text, rec->len);
+            batch_len += rec->len;
+
+            // hand the slot back to the producers
+            __atomic_store_n(&rec->seq, dequeue_pos + LOG_SLOTS, __ATOMIC_RELEASE);
+            dequeue_pos++;
+            continue;
+        }
+
+        // nothing published -- write what we have, then stop or nap
+        if (batch_len > 0) {
+            write_fully(STDOUT_FILENO, batch, batch_len);
+            batch_len = 0;
+        }
+        if (__atomic_load_n(&stopping, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&enqueue_pos, __ATOMIC_ACQUIRE) == dequeue_pos) {
+            break;
+        }
+        struct timespec idle = { 0, LOG_IDLE_NS };
+        nanosleep(&idle, NULL);
+    }
+    return NULL;
+}
+
+static int write_fully(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += written;
+        len -= (size_t)written;
+    }
+    return 0;
+}
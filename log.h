@@ -0,0 +1,90 @@
+// header guard to prevent multiple inclusions of this file
+#ifndef LOG_H
+#define LOG_H
+
+// log.h -- asynchronous structured logging for the server
+//
+// one JSON object per line, e.g.
+//   {"ts":1718000000.123456,"level":"info","event":"command","session":3,"cmd":"ls -l","exit":0,...}
+//
+// a record is built in place inside a slot of a lock-free ring buffer and handed to a
+// background writer thread, which batches records into large write()s on stdout
+// producers never block and never call into stdio: if the ring is full the record is
+// dropped and counted, and the next record written reports how many were lost
+//
+// usage:
+//   log_record_t* rec = log_begin(LOG_INFO, "command");   // NULL when filtered out -- skip the fields
+//   if (rec != NULL) {
+//       log_str(rec, "cmd", command);
+//       log_int(rec, "exit", exit_code);
+//       log_commit(rec);
+//   }
+
+#include <stddef.h>
+
+typedef enum {
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR
+} log_level_t;
+
+// how much of a command's output goes into its record
+typedef enum {
+    LOG_OUTPUT_SIZE,          // byte count only (default)
+    LOG_OUTPUT_BODY           // the output itself, truncated to fit the record
+} log_output_mode_t;
+
+typedef struct log_record log_record_t;
+
+
+// parses a level name ("debug", "info", "warn", "error") -- returns 0 on success, -1 if unknown
+int log_parse_level(const char* name, log_level_t* level);
+
+// configures logging -- call before log_start()
+// records below min_level are dropped, debug and info records are sampled 1 in sample_every (1 = all)
+void log_configure(log_level_t min_level, unsigned sample_every, log_output_mode_t output_mode);
+
+// starts the writer thread -- returns 0 on success, -1 on failure (error already printed)
+int log_start(void);
+
+// writes every committed record and stops the writer thread
+void log_shutdown(void);
+
+// tags the calling thread's records with a session id (0 = none)
+void log_set_session(unsigned long session);
+
+// the calling thread's session id -- lets a session hand its tag to helper threads
+unsigned long log_session(void);
+
+// current output mode -- lets callers skip copying bodies nobody will log
+log_output_mode_t log_output_mode(void);
+
+// starts a record -- returns NULL if the level is filtered, the record is sampled out or the ring is full
+// sampled: 1 to apply sampling (per-command records), 0 for records that must not be sampled
+log_record_t* log_begin(log_level_t level, const char* event, int sampled);
+
+// record fields -- keys are plain identifiers, string values are JSON-escaped
+// key NULL for an element of an array
+void log_str(log_record_t* rec, const char* key, const char* value);
+void log_bytes(log_record_t* rec, const char* key, const char* data, size_t len);
+void log_int(log_record_t* rec, const char* key, long long value);
+void log_double(log_record_t* rec, const char* key, double value);
+
+// nested values, up to 4 deep -- e.g. "stages":[{"pid":12,...},{...}]
+//   log_array_begin(rec, "stages");
+//   log_object_begin(rec, NULL); log_int(rec, "pid", 12); log_object_end(rec);
+//   log_array_end(rec);
+// anything still open is closed by log_commit()
+void log_object_begin(log_record_t* rec, const char* key);
+void log_object_end(log_record_t* rec);
+void log_array_begin(log_record_t* rec, const char* key);
+void log_array_end(log_record_t* rec);
+
+// publishes a record to the writer thread
+void log_commit(log_record_t* rec);
+
+// one-line convenience for records with only a message field
+void log_message(log_level_t level, const char* event, const char* message);
+
+#endif /* LOG_H */
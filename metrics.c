@@ -0,0 +1,352 @@
+// metrics.c -- per-thread server counters merged at scrape time, served as Prometheus text
+// see metrics.h
+
+// _GNU_SOURCE for accept4() -- scrape connections are close-on-exec like every other server socket
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>    // struct timeval for the scrape read timeout
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "metrics.h"
+
+
+#define METRIC_PREFIX "remote_shell_"
+#define METRIC_BUCKETS 16                   // finite latency buckets, +Inf is implicit
+#define SCRAPE_REQUEST_MAX 4096             // request bytes read before answering
+#define SCRAPE_TIMEOUT_SEC 2                // a scraper that sends nothing is dropped after this
+
+// upper bounds of the latency buckets in seconds -- 100us to 10s
+static const double bucket_bounds[METRIC_BUCKETS] = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025,
+    0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0
+};
+
+// wire names indexed by metric_counter_t
+static const char* const counter_names[METRIC_COUNTER_COUNT] = {
+    "sessions_total", "sessions_closed_total", "sessions_refused_total",
+    "received_bytes_total", "sent_bytes_total", "fork_failures_total",
+    "spilled_bytes_total", "send_stalls_total", "throttled_commands_total"
+};
+
+static const char* const counter_help[METRIC_COUNTER_COUNT] = {
+    "Client sessions accepted.",
+    "Client sessions finished.",
+    "Connections refused because the session limit was reached.",
+    "Request bytes received from clients.",
+    "Reply bytes sent to clients, frame headers included.",
+    "Failed fork() calls for command children.",
+    "Captured output bytes spilled to files past the session memory budget.",
+    "Streamed replies given up on because the client stopped reading.",
+    "Commands whose output reading was paused because the client fell behind."
+};
+
+// one thread's counters -- written only by the owning thread, read by scrapes
+// shards are never freed: a finished session returns its shard to the pool and the next
+// session keeps adding to it, which is exactly what cumulative counters need
+typedef struct metrics_shard {
+    uint64_t counters[METRIC_COUNTER_COUNT];
+    uint64_t commands[REPLY_ERROR + 1];                     // by reply status
+    uint64_t phase_buckets[PHASE_COUNT][METRIC_BUCKETS + 1]; // per bucket, not cumulative, last is +Inf
+    uint64_t phase_sum_ns[PHASE_COUNT];
+    uint64_t capture_high_water;                            // largest capture buffer, bytes
+    uint64_t queued;                                        // gauge, owning session only
+    int in_use;
+    struct metrics_shard* next;                             // immutable once published
+} metrics_shard_t;
+
+// growable text buffer for one scrape
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+} metrics_text_t;
+
+static metrics_shard_t* shard_list = NULL;                  // push-only, lock-free
+static __thread metrics_shard_t* local_shard = NULL;
+
+// prototypes
+static metrics_shard_t* metrics_local(void);
+static void bump(uint64_t* counter, uint64_t n);
+static void* metrics_thread(void* arg);
+static void serve_scrape(int client_fd);
+static char* render_metrics(size_t* len);
+static void text_append(metrics_text_t* text, const char* format, ...);
+
+
+// per-thread shards
+// the calling thread's shard -- taken from the pool on first use, or allocated if none is free
+static metrics_shard_t* metrics_local(void) {
+    if (local_shard != NULL) return local_shard;
+
+    for (metrics_shard_t* shard = __atomic_load_n(&shard_list, __ATOMIC_ACQUIRE); shard != NULL; shard = shard->next) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&shard->in_use, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            local_shard = shard;
+            return shard;
+        }
+    }
+
+    metrics_shard_t* shard = calloc(1, sizeof(metrics_shard_t));
+    if (shard == NULL) {
+        // nowhere to count -- callers skip the update
+        return NULL;
+    }
+    shard->in_use = 1;
+    shard->next = __atomic_load_n(&shard_list, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&shard_list, &shard->next, shard, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        // another thread published first -- shard->next now holds the new head, retry
+    }
+    local_shard = shard;
+    return shard;
+}
+
+// single-writer increment -- a relaxed load and store, no read-modify-write bus lock needed
+static void bump(uint64_t* counter, uint64_t n) {
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+void metrics_add(metric_counter_t counter, uint64_t n) {
+    metrics_shard_t* shard = metrics_local();
+    if (shard != NULL) bump(&shard->counters[counter], n);
+}
+
+void metrics_capture_buffer(uint64_t bytes) {
+    metrics_shard_t* shard = metrics_local();
+    if (shard != NULL && bytes > __atomic_load_n(&shard->capture_high_water, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&shard->capture_high_water, bytes, __ATOMIC_RELAXED);
+    }
+}
+
+void metrics_set_queued(uint64_t requests) {
+    metrics_shard_t* shard = metrics_local();
+    if (shard != NULL) __atomic_store_n(&shard->queued, requests, __ATOMIC_RELAXED);
+}
+
+void metrics_record_request(const request_timing_t* timing, reply_status_t status) {
+    metrics_shard_t* shard = metrics_local();
+    if (shard == NULL) return;
+
+    if ((int)status >= 0 && status <= REPLY_ERROR) bump(&shard->commands[status], 1);
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        double seconds = timing->phase[i];
+        if (seconds < 0) continue;
+        int bucket = 0;
+        while (bucket < METRIC_BUCKETS && seconds > bucket_bounds[bucket]) bucket++;
+        bump(&shard->phase_buckets[i][bucket], 1);
+        bump(&shard->phase_sum_ns[i], (uint64_t)(seconds * 1e9));
+    }
+}
+
+void metrics_thread_done(void) {
+    if (local_shard == NULL) return;
+    __atomic_store_n(&local_shard->queued, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&local_shard->in_use, 0, __ATOMIC_RELEASE);
+    local_shard = NULL;
+}
+
+
+// listener
+int metrics_start(int port) {
+    int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd == -1) {
+        perror("Error: metrics socket creation failed");
+        return -1;
+    }
+
+    int opt = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    // local only -- scrapers run next to the server
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((unsigned short)port);
+
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(listen_fd, 16) == -1) {
+        perror("Error: metrics listener setup failed");
+        close(listen_fd);
+        return -1;
+    }
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&thread, &attr, metrics_thread, (void*)(intptr_t)listen_fd);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        fprintf(stderr, "Error: metrics thread creation failed: %s\n", strerror(err));
+        close(listen_fd);
+        return -1;
+    }
+    return 0;
+}
+
+// serves scrapes one at a time -- a scrape is a few kilobytes of text
+static void* metrics_thread(void* arg) {
+    int listen_fd = (int)(intptr_t)arg;
+    while (1) {
+        int client_fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client_fd == -1) {
+            if (errno != EINTR) perror("Error: metrics accept failed");
+            continue;
+        }
+        serve_scrape(client_fd);
+        close(client_fd);
+    }
+    return NULL;
+}
+
+// reads one HTTP request and answers it -- GET /metrics (or /) gets the metrics, anything else a 404
+static void serve_scrape(int client_fd) {
+    struct timeval timeout = { SCRAPE_TIMEOUT_SEC, 0 };
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // read the request head -- the body (if any) is ignored
+    char request[SCRAPE_REQUEST_MAX + 1];
+    size_t len = 0;
+    while (len < SCRAPE_REQUEST_MAX) {
+        ssize_t n = recv(client_fd, request + len, SCRAPE_REQUEST_MAX - len, 0);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) continue;
+            break;
+        }
+        len += (size_t)n;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) break;
+    }
+    request[len] = '\0';
+
+    int found = strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET / ", 6) == 0;
+    char header[256];
+    char* body = NULL;
+    size_t body_len = 0;
+    if (found) body = render_metrics(&body_len);
+
+    int header_len;
+    if (body != NULL) {
+        header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                              "Content-Length: %zu\r\nConnection: close\r\n\r\n", body_len);
+    } else {
+        header_len = snprintf(header, sizeof(header), "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+                              found ? "500 Internal Server Error" : "404 Not Found");
+    }
+
+    if (send_all(client_fd, header, (size_t)header_len) == 0 && body != NULL) {
+        send_all(client_fd, body, body_len);
+    }
+    free(body);
+}
+
+
+// rendering
+// sums every shard into one Prometheus text page -- returns a malloc'd string, NULL on allocation failure
+static char* render_metrics(size_t* len) {
+    uint64_t counters[METRIC_COUNTER_COUNT] = { 0 };
+    uint64_t commands[REPLY_ERROR + 1] = { 0 };
+    static uint64_t buckets[PHASE_COUNT][METRIC_BUCKETS + 1];  // only the metrics thread renders
+    uint64_t sum_ns[PHASE_COUNT] = { 0 };
+    uint64_t high_water = 0;
+    uint64_t queued = 0;
+    memset(buckets, 0, sizeof(buckets));
+
+    for (metrics_shard_t* shard = __atomic_load_n(&shard_list, __ATOMIC_ACQUIRE); shard != NULL; shard = shard->next) {
+        for (int i = 0; i < METRIC_COUNTER_COUNT; i++) counters[i] += __atomic_load_n(&shard->counters[i], __ATOMIC_RELAXED);
+        for (int s = 0; s <= REPLY_ERROR; s++) commands[s] += __atomic_load_n(&shard->commands[s], __ATOMIC_RELAXED);
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            for (int b = 0; b <= METRIC_BUCKETS; b++) buckets[p][b] += __atomic_load_n(&shard->phase_buckets[p][b], __ATOMIC_RELAXED);
+            sum_ns[p] += __atomic_load_n(&shard->phase_sum_ns[p], __ATOMIC_RELAXED);
+        }
+        uint64_t hw = __atomic_load_n(&shard->capture_high_water, __ATOMIC_RELAXED);
+        if (hw > high_water) high_water = hw;
+        queued += __atomic_load_n(&shard->queued, __ATOMIC_RELAXED);
+    }
+
+    metrics_text_t text = { NULL, 0, 0 };
+
+    for (int i = 0; i < METRIC_COUNTER_COUNT; i++) {
+        text_append(&text, "# HELP " METRIC_PREFIX "%s %s\n# TYPE " METRIC_PREFIX "%s counter\n" METRIC_PREFIX "%s %llu\n",
+                    counter_names[i], counter_help[i], counter_names[i], counter_names[i], (unsigned long long)counters[i]);
+    }
+
+    // closed is read after accepted, so it can only lag -- never report a negative gauge
+    uint64_t active = (counters[METRIC_SESSIONS] > counters[METRIC_SESSIONS_CLOSED])
+                          ? counters[METRIC_SESSIONS] - counters[METRIC_SESSIONS_CLOSED] : 0;
+    text_append(&text, "# HELP " METRIC_PREFIX "sessions_active Client sessions being served.\n"
+                       "# TYPE " METRIC_PREFIX "sessions_active gauge\n" METRIC_PREFIX "sessions_active %llu\n",
+                (unsigned long long)active);
+    text_append(&text, "# HELP " METRIC_PREFIX "queued_requests Requests received but not started, all sessions.\n"
+                       "# TYPE " METRIC_PREFIX "queued_requests gauge\n" METRIC_PREFIX "queued_requests %llu\n",
+                (unsigned long long)queued);
+    text_append(&text, "# HELP " METRIC_PREFIX "capture_buffer_high_water_bytes Largest output capture buffer allocated.\n"
+                       "# TYPE " METRIC_PREFIX "capture_buffer_high_water_bytes gauge\n"
+                       METRIC_PREFIX "capture_buffer_high_water_bytes %llu\n",
+                (unsigned long long)high_water);
+
+    text_append(&text, "# HELP " METRIC_PREFIX "commands_total Commands run, by reply status.\n"
+                       "# TYPE " METRIC_PREFIX "commands_total counter\n");
+    for (int s = 0; s <= REPLY_ERROR; s++) {
+        text_append(&text, METRIC_PREFIX "commands_total{status=\"%s\"} %llu\n",
+                    reply_status_name((reply_status_t)s), (unsigned long long)commands[s]);
+    }
+
+    text_append(&text, "# HELP " METRIC_PREFIX "phase_seconds Command latency by phase.\n"
+                       "# TYPE " METRIC_PREFIX "phase_seconds histogram\n");
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        uint64_t cumulative = 0;
+        for (int b = 0; b < METRIC_BUCKETS; b++) {
+            cumulative += buckets[p][b];
+            text_append(&text, METRIC_PREFIX "phase_seconds_bucket{phase=\"%s\",le=\"%g\"} %llu\n",
+                        phase_name((phase_t)p), bucket_bounds[b], (unsigned long long)cumulative);
+        }
+        cumulative += buckets[p][METRIC_BUCKETS];
+        text_append(&text, METRIC_PREFIX "phase_seconds_bucket{phase=\"%s\",le=\"+Inf\"} %llu\n",
+                    phase_name((phase_t)p), (unsigned long long)cumulative);
+        text_append(&text, METRIC_PREFIX "phase_seconds_sum{phase=\"%s\"} %.9f\n", phase_name((phase_t)p), (double)sum_ns[p] / 1e9);
+        text_append(&text, METRIC_PREFIX "phase_seconds_count{phase=\"%s\"} %llu\n", phase_name((phase_t)p), (unsigned long long)cumulative);
+    }
+
+    if (text.data == NULL) return NULL;
+    *len = text.len;
+    return text.data;
+}
+
+// printf-style append -- on allocation failure the text is dropped and data becomes NULL
+static void text_append(metrics_text_t* text, const char* format, ...) {
+    if (text->data == NULL && text->cap != 0) return;  // an earlier append failed
+
+    while (1) {
+        va_list args;
+        va_start(args, format);
+        int needed = vsnprintf(text->data ? text->data + text->len : NULL, text->cap - text->len, format, args);
+        va_end(args);
+        if (needed < 0) return;
+        if (text->len + (size_t)needed < text->cap) {
+            text->len += (size_t)needed;
+            return;
+        }
+
+        size_t new_cap = (text->cap == 0) ? 8192 : text->cap * 2;
+        while (new_cap <= text->len + (size_t)needed) new_cap *= 2;
+        char* grown = realloc(text->data, new_cap);
+        if (grown == NULL) {
+            free(text->data);
+            text->data = NULL;
+            text->cap = 1;
+            return;
+        }
+        text->data = grown;
+        text->cap = new_cap;
+    }
+}
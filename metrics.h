@@ -0,0 +1,50 @@
+// header guard to prevent multiple inclusions of this file
+#ifndef METRICS_H
+#define METRICS_H
+
+// metrics.h -- server counters and histograms in Prometheus text format
+//
+// every thread updates its own shard with plain relaxed atomic stores -- no locks,
+// no shared cache lines on the hot path; a scrape walks all shards and sums them
+// the listener is a tiny HTTP server on its own (local) port, served by one thread
+
+#include <stdint.h>
+
+#include "protocol.h"
+#include "stats.h"
+
+// monotonically increasing counters
+typedef enum {
+    METRIC_SESSIONS,          // sessions accepted
+    METRIC_SESSIONS_CLOSED,   // sessions finished -- active = accepted - closed
+    METRIC_SESSIONS_REFUSED,  // connections turned away at MAX_SESSIONS
+    METRIC_BYTES_IN,          // request bytes received
+    METRIC_BYTES_OUT,         // reply bytes sent, frame headers included
+    METRIC_FORK_FAILURES,     // fork() of a command child failed
+    METRIC_SPILLED_BYTES,     // captured output bytes past the session's memory budget, kept in spill files
+    METRIC_SEND_STALLS,       // streamed replies given up on -- the client took no bytes for the stall timeout
+    METRIC_THROTTLED,         // streamed commands paused at least once because the client fell behind
+    METRIC_COUNTER_COUNT
+} metric_counter_t;
+
+
+// adds n to a counter of the calling thread's shard
+void metrics_add(metric_counter_t counter, uint64_t n);
+
+// raises the capture-buffer high-water mark if bytes is larger
+void metrics_capture_buffer(uint64_t bytes);
+
+// sets the calling session's queue depth (requests received but not yet started)
+void metrics_set_queued(uint64_t requests);
+
+// records one finished command -- status counter and phase latency histograms
+void metrics_record_request(const request_timing_t* timing, reply_status_t status);
+
+// returns the calling thread's shard to the pool -- call when a session thread ends
+void metrics_thread_done(void);
+
+// starts the metrics listener on 127.0.0.1:port in its own thread
+// returns 0 on success, -1 on failure (error already printed)
+int metrics_start(int port);
+
+#endif /* METRICS_H */
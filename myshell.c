@@ -14,7 +14,7 @@ int main(void) {
     char input[MAX_INPUT_SIZE];
 
     // to hold parsed commands
-    pipeline_t* pipeline;
+    command_list_t* list;
     // to check whether execution was successful
     int status;
 
@@ -52,9 +52,9 @@ int main(void) {
             break;
         }
         
-        // parse the command line (handles both simple commands and pipes)
-        pipeline = parse_pipeline(input);
-        if (pipeline == NULL) {
+        // parse the command line (handles simple commands, pipes and ;, &&, || lists)
+        list = parse_command_list(input);
+        if (list == NULL) {
             // parsing failed -- possible syntax error
             handle_error(ERROR_INVALID_COMMAND, input);
 
@@ -62,14 +62,14 @@ int main(void) {
             continue;
         }
 
-        // execute the pipeline (works for single commands too)
-        status = execute_pipeline(pipeline);
+        // execute the list (works for single commands too)
+        status = execute_command_list(list);
         if (status != 0) {
             // error already handled in execute_pipeline
         }
 
         // clean up memory
-        free_pipeline(pipeline);
+        free_command_list(list);
     }
 
     return 0;
@@ -0,0 +1,42 @@
+// header guard to prevent multiple inclusions of this file
+#ifndef PROBES_H
+#define PROBES_H
+
+// probes.h -- USDT (SystemTap/DTrace-style) static tracepoints, provider "remote_shell"
+//
+// with <sys/sdt.h> available (systemtap-sdt-dev / systemtap-sdt-devel) each probe compiles to a single
+// nop plus an ELF note naming it -- no runtime library, no system call, nothing to switch on
+// perf, bpftrace and stap turn a probe into a breakpoint only while something is attached:
+//   bpftrace -l 'usdt:./server:*'
+//   perf buildid-cache --add ./server && perf list sdt_remote_shell:*
+// without the header every probe compiles to nothing; build with -DNO_PROBES to force that
+//
+// arguments are read straight from registers by the tracer -- pass integers and pointers, never
+// anything that would need computing only for the probe
+
+#if !defined(NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef HAVE_PROBES
+
+#include <sys/sdt.h>
+
+#define PROBE0(name)             DTRACE_PROBE(remote_shell, name)
+#define PROBE1(name, a)          DTRACE_PROBE1(remote_shell, name, a)
+#define PROBE2(name, a, b)       DTRACE_PROBE2(remote_shell, name, a, b)
+#define PROBE3(name, a, b, c)    DTRACE_PROBE3(remote_shell, name, a, b, c)
+
+#else
+
+// sizeof never evaluates its operand -- the arguments count as used and cost nothing
+#define PROBE0(name)             do { } while (0)
+#define PROBE1(name, a)          do { (void)sizeof(a); } while (0)
+#define PROBE2(name, a, b)       do { (void)sizeof(a); (void)sizeof(b); } while (0)
+#define PROBE3(name, a, b, c)    do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while (0)
+
+#endif
+
+#endif /* PROBES_H */
@@ -0,0 +1,128 @@
+// protocol.c -- framing helpers shared by the server and the client
+// see protocol.h for the wire format
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>  // send(), sendmsg()
+#include <sys/uio.h>     // struct iovec
+
+#include "protocol.h"
+
+
+// wire names indexed by reply_status_t
+static const char* const status_names[] = {
+    "ok", "failed", "timeout", "cpu_limit", "output_limit", "error"
+};
+
+
+const char* reply_status_name(reply_status_t status) {
+    if ((int)status < 0 || (size_t)status >= sizeof(status_names) / sizeof(status_names[0])) return "error";
+    return status_names[status];
+}
+
+reply_status_t reply_status_from_name(const char* name) {
+    for (size_t i = 0; i < sizeof(status_names) / sizeof(status_names[0]); i++) {
+        if (strcmp(name, status_names[i]) == 0) return (reply_status_t)i;
+    }
+    return REPLY_ERROR;
+}
+
+
+// send the whole buffer -- send() may write less than asked on a busy socket
+// MSG_NOSIGNAL so a vanished client gives EPIPE instead of killing the server
+int send_all(int fd, const void* data, size_t len) {
+    const char* ptr = data;
+    while (len > 0) {
+        ssize_t sent = send(fd, ptr, len, MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        ptr += sent;
+        len -= (size_t)sent;
+    }
+    return 0;
+}
+
+
+// send header and payload together -- one syscall for the common case
+int frame_send(int fd, char type, const void* payload, size_t len) {
+    return frame_send_start(fd, type, len, payload, len);
+}
+
+// header for total payload bytes, then the first len of them -- the caller sends the remaining total - len
+int frame_send_start(int fd, char type, size_t total, const void* payload, size_t len) {
+    char header[FRAME_HEADER_MAX];
+    int header_len = snprintf(header, sizeof(header), "%c %zu\n", type, total);
+
+    struct iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = (size_t)header_len;
+    iov[1].iov_base = (void*)payload;
+    iov[1].iov_len = len;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (len > 0) ? 2 : 1;
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    } while (sent == -1 && errno == EINTR);
+    if (sent == -1) return -1;
+
+    // partial write -- finish the rest of the header, then the rest of the payload
+    size_t done = (size_t)sent;
+    if (done < (size_t)header_len) {
+        if (send_all(fd, header + done, (size_t)header_len - done) == -1) return -1;
+        done = (size_t)header_len;
+    }
+    done -= (size_t)header_len;
+    if (done < len) return send_all(fd, (const char*)payload + done, len - done);
+    return 0;
+}
+
+int frame_send_end(int fd, int exit_code, reply_status_t status) {
+    char payload[64];
+    int len = snprintf(payload, sizeof(payload), "exit=%d status=%s", exit_code, reply_status_name(status));
+    return frame_send(fd, FRAME_END, payload, (size_t)len);
+}
+
+
+// header looks like "O 1234\n"
+int frame_parse_header(const char* buf, size_t avail, char* type, size_t* payload_len) {
+    const char* newline = memchr(buf, '\n', avail < FRAME_HEADER_MAX ? avail : FRAME_HEADER_MAX);
+    if (newline == NULL) {
+        // no newline yet -- need more bytes unless the header is already too long
+        return (avail < FRAME_HEADER_MAX) ? 0 : -1;
+    }
+    if (newline - buf < 3 || buf[1] != ' ') return -1;
+
+    size_t len = 0;
+    for (const char* p = buf + 2; p < newline; p++) {
+        if (*p < '0' || *p > '9') return -1;
+        len = len * 10 + (size_t)(*p - '0');
+    }
+
+    *type = buf[0];
+    *payload_len = len;
+    return (int)(newline - buf) + 1;
+}
+
+// payload looks like "exit=0 status=ok"
+int frame_parse_end(const char* payload, size_t len, int* exit_code, reply_status_t* status) {
+    char text[64];
+    char name[32];
+    if (len >= sizeof(text)) return -1;
+    memcpy(text, payload, len);
+    text[len] = '\0';
+
+    if (sscanf(text, "exit=%d status=%31s", exit_code, name) != 2) return -1;
+    *status = reply_status_from_name(name);
+    return 0;
+}
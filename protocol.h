@@ -0,0 +1,83 @@
+// header guard to prevent multiple inclusions of this file
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+// protocol.h -- wire format shared by the server and the client
+//
+// client -> server: one request per line, terminated by '\n'
+//   a request may start with options --> "@key=value,key=value <command>"
+//
+// server -> client: each reply is a sequence of frames
+//   frame = text header "<type> <length>\n" followed by <length> payload bytes
+//   every reply ends with exactly one FRAME_END frame carrying the command status
+//   FRAME_NOTICE frames may arrive between replies -- they belong to no request
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// frame types
+#define FRAME_OUTPUT 'O'          // command output bytes (stdout and stderr in arrival order) -- a streamed reply has several
+#define FRAME_END    'E'          // end of reply -- payload is "exit=<code> status=<name>"
+#define FRAME_TRACE  'T'          // optional trailer before FRAME_END (@trace) -- "phase=<ms> ..." latency breakdown
+#define FRAME_USAGE  'U'          // optional trailer before FRAME_END (@time) -- one "key=value ... cmd=<argv>" line per stage
+#define FRAME_LIST   'L'          // optional trailer before FRAME_END (command lists) -- one "exit=<code|skipped> cmd=<text>" line per entry
+#define FRAME_NOTICE 'N'          // between replies, never inside one -- a background job finished, payload is one line of text
+#define FRAME_CURSOR 'C'          // optional trailer before FRAME_END (@page, cursor) -- "cursor=<id> offset=<bytes> total=<bytes>",
+                                  // the output from offset on is kept by the server until asked for
+
+// longest possible frame header -- type, space, 20 digit length, newline
+#define FRAME_HEADER_MAX 32
+
+// largest FRAME_TRACE payload the server sends
+#define FRAME_TRACE_MAX 256
+
+// largest FRAME_USAGE payload the server sends
+#define FRAME_USAGE_MAX 8192
+
+// largest FRAME_LIST payload the server sends
+#define FRAME_LIST_MAX 1024
+
+// largest FRAME_CURSOR payload the server sends
+#define FRAME_CURSOR_MAX 96
+
+// prefix that marks per-request options at the start of a request line
+#define REQUEST_OPTION_PREFIX '@'
+
+// status carried in the FRAME_END frame of every reply
+typedef enum {
+    REPLY_OK,                 // command exited with status 0
+    REPLY_FAILED,             // command exited with a non-zero status
+    REPLY_TIMEOUT,            // killed by the server -- wall-clock timeout
+    REPLY_CPU_LIMIT,          // killed by the kernel -- CPU time limit (SIGXCPU)
+    REPLY_OUTPUT_LIMIT,       // killed by the server -- output byte limit, output truncated
+    REPLY_ERROR               // server could not run the command at all
+} reply_status_t;
+
+
+// returns the wire name of a reply status ("ok", "timeout", ...)
+const char* reply_status_name(reply_status_t status);
+
+// maps a wire name back to a reply status -- returns REPLY_ERROR for unknown names
+reply_status_t reply_status_from_name(const char* name);
+
+// sends the whole buffer, retrying on partial writes -- returns 0 on success, -1 on failure
+int send_all(int fd, const void* data, size_t len);
+
+// sends one frame (header + payload) with a single sendmsg() where possible -- returns 0 on success, -1 on failure
+int frame_send(int fd, char type, const void* payload, size_t len);
+
+// sends the header of a frame with total payload bytes and the first len of them -- the caller sends the rest
+// (a payload that is partly in memory and partly in a file) -- returns 0 on success, -1 on failure
+int frame_send_start(int fd, char type, size_t total, const void* payload, size_t len);
+
+// sends a FRAME_END frame for the given exit code and status -- returns 0 on success, -1 on failure
+int frame_send_end(int fd, int exit_code, reply_status_t status);
+
+// parses a frame header at the start of buf
+// returns header length on success, 0 if more bytes are needed, -1 if the header is malformed
+int frame_parse_header(const char* buf, size_t avail, char* type, size_t* payload_len);
+
+// parses a FRAME_END payload into exit code and status -- returns 0 on success, -1 if malformed
+int frame_parse_end(const char* payload, size_t len, int* exit_code, reply_status_t* status);
+
+#endif /* PROTOCOL_H */
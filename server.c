@@ -3,7 +3,8 @@
 // shell commands received from the client using the Phase 1 shell implementation
 // server captures command output and sends it back to the client
 
-#define _POSIX_C_SOURCE 200809L
+// _GNU_SOURCE for pipe2() and accept4() -- descriptors are close-on-exec from birth
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,83 +15,719 @@
 #include <sys/socket.h>  // socket(), bind(), listen(), accept(), send(), recv()
 #include <netinet/in.h>  // struct sockaddr_in, INADDR_ANY
 #include <arpa/inet.h>   // htons()
+#include <netinet/tcp.h> // TCP_NODELAY
 
 // system includes
 #include <errno.h>       // errno for error handling
+#include <signal.h>      // kill(), SIGXCPU
+#include <poll.h>        // poll() over the capture pipes
+#include <time.h>        // clock_gettime() for deadlines
 #include <sys/wait.h>    // waitpid() for waiting on child processes
+#include <sys/resource.h> // setrlimit() for per-command limits
+#include <sys/syscall.h> // close_range
+#include <pthread.h>     // one thread per client session
+#include <stdint.h>      // intptr_t
+#include <limits.h>      // SSIZE_MAX
+#include <sys/mman.h>    // memfd_create() for session environments
+#include <sys/stat.h>    // fstat() of a session environment
+#include <sys/time.h>    // struct timeval for SO_SNDTIMEO
 
 // need to include Phase 1 shell implementation -- already corrected the mistakes
 #include "shell_utils.h"
 
+// framing shared with the client
+#include "protocol.h"
+
+// per-phase latency statistics (stats request, @trace)
+#include "stats.h"
+
+// Prometheus metrics listener (-M port)
+#include "metrics.h"
+
+// asynchronous structured logging -- the console output of the server
+#include "log.h"
+
+// always-on flight recorder -- per-thread binary event rings dumped on SIGUSR1 or a crash
+#include "flight.h"
+
+// USDT tracepoints for perf / bpftrace -- no-ops unless <sys/sdt.h> was available at build time
+#include "probes.h"
+
+// spawn helper -- a small process forked at startup that forks every command child
+#include "spawn.h"
+
+// captured output -- in memory up to the session's budget, in a spill file past it
+#include "spool.h"
+
 
 // SERVER configuration constants
 #define PORT 8080                 // server listens on port 8080
 #define BUFFER_SIZE 4096          // size of buffers for receiving/sending data
-#define BACKLOG 5                 // max number of pending connections in listen queue
-
-
-// server display functions -- print formatted messages to server console
-void print_info(const char* message);
-void print_received(const char* command);
-void print_executing(const char* command);
-void print_output(const char* message);
-void print_error(const char* message);
+#define BACKLOG 64                // max number of pending connections in listen queue
+#define MAX_SESSIONS 256          // concurrent client sessions, each served by its own thread
+
+// default per-command limits -- overridable on the command line, tightened per request
+#define DEFAULT_TIMEOUT_SEC 300             // wall-clock seconds before a command is killed
+#define DEFAULT_MAX_OUTPUT (64UL << 20)     // captured output bytes before a command is killed
+#define DEFAULT_SPOOL_BUDGET (16UL << 20)   // captured output a session holds in memory before spilling to files
+#define DEFAULT_STREAM_QUEUE (1UL << 20)    // unsent output of a streamed command before its pipes are left unread
+#define DEFAULT_SEND_STALL_SEC 30           // seconds a client may take no reply bytes before its session is closed
+
+// per-command resource limits -- 0 means unlimited
+typedef struct {
+    double timeout_sec;       // wall-clock limit, enforced by the server
+    long cpu_sec;             // RLIMIT_CPU, inherited by every process of the command
+    size_t max_output;        // captured bytes (stdout + stderr), enforced by the server
+    size_t max_memory;        // RLIMIT_AS, inherited by every process of the command
+    int parallel;             // replicas per line-stateless pipeline stage (pipeline_parallel), 1 = no sharding
+} exec_limits_t;
+
+// outcome of one command execution
+typedef struct {
+    int exit_code;            // exit status, 128 + signal if killed, -1 if unknown
+    reply_status_t status;    // status sent to the client in the end frame
+    size_t output_len;        // captured bytes (the output may contain NUL bytes)
+    request_timing_t timing;  // fork, parse, spawn, exec, run, capture and reap phases
+    pipeline_report_t stages; // pid, exit code and rusage of every stage, num_stages 0 if not reported
+    char list[FRAME_LIST_MAX];  // FRAME_LIST payload -- every entry's outcome of a command list
+    size_t list_len;          // 0 if the command was a single pipeline (or the child did not report)
+} exec_result_t;
+
+// what the command child reports on REPORT_FD once its command list has finished
+// about 2.8 KB -- below PIPE_BUF, so it arrives in one piece or not at all
+typedef struct {
+    request_timing_t timing;  // parse, spawn, exec and run phases
+    pipeline_report_t stages; // a single pipeline's stages -- num_stages 0 for a list
+    size_t list_len;
+    char list[FRAME_LIST_MAX];  // per-entry outcome of a list (see format_list_report())
+} child_report_t;
+
+// per-request options -- the "@key=value,..." prefix of a request line
+typedef struct {
+    exec_limits_t limits;     // starts from server_limits, can only be tightened
+    int trace;                // send a FRAME_TRACE phase breakdown before the end frame
+    int time;                 // send a FRAME_USAGE per-stage exit status and rusage report before the end frame
+    size_t page;              // @page -- send this many output bytes, keep the rest in a cursor; 0 = all at once
+} request_options_t;
+
+// a reply streamed while its command runs -- output frames go out as the output arrives, from a
+// non-blocking socket, so a slow client holds up neither the capture loop nor the server
+// every frame covers what was captured but unsent when it started; once a frame and everything before
+// it are sent, the spool is cleared and the next bytes reuse its memory
+typedef struct {
+    int client_fd;
+    int flags;                // the socket's file status flags before the stream, restored by finish_output_stream()
+    size_t sent;              // spool offset sent so far
+    size_t frame_end;         // spool offset the current frame ends at -- == sent between frames
+    char header[FRAME_HEADER_MAX];
+    size_t header_len;
+    size_t header_sent;
+    size_t dropped;           // output bytes sent and cleared from the spool -- output offset = spool offset + dropped
+    int can_clear;            // 0 with -b, whose command record logs the output from its start
+    int blocked;              // the last send hit a full socket buffer -- wait for POLLOUT
+    int throttled;            // the command's pipes were left unread at least once
+    double progress_at;       // the client last took bytes (or had nothing to take)
+    int error;                // errno of the failed send, ETIMEDOUT for a stalled client -- 0 while it keeps up
+} output_stream_t;
+
+// session state -- what cd, export and unset change for the rest of a session
+// every command child of the session starts in cwd_fd, with the env block as its whole environment
+typedef struct {
+    int cwd_fd;               // O_PATH descriptor of the session's directory, -1 = the server's own
+    int env_fd;               // memfd holding env, -1 = the server's environment
+    char* env;                // "NAME=value\0NAME=value\0..." -- NULL until the first export or unset
+    size_t env_len;
+} session_state_t;
+
+// background jobs -- "command &" runs on a job thread of its own while the session serves further requests
+// its output is spooled until fetched; a job that finishes is announced with a FRAME_NOTICE
+#define JOBS_MAX 16                       // jobs per session -- finished ones count until fetched
+
+typedef struct session_jobs session_jobs_t;
+
+// one background job -- a slot is free while id is 0
+typedef struct {
+    int id;                   // job number shown to the client, counting from 1 per session
+    char* command;
+    exec_limits_t limits;     // the request's limits
+    spool_t output;           // spooled output -- charged to the session's budget like any other
+    int launched;             // the command ran -- output and result are valid once done
+    exec_result_t result;
+    double started;           // monotonic time the job was started
+    int done;                 // set by the job thread under the table's lock
+    int notified;             // the client has heard the job is done (notice, wait or fetch)
+    pthread_t thread;
+    session_jobs_t* table;
+    session_state_t state;    // the session's directory and environment when the job started (descriptors only)
+} background_job_t;
+
+// a session's job table -- shared by the session thread and its job threads
+struct session_jobs {
+    background_job_t jobs[JOBS_MAX];
+    int next_id;
+    unsigned long session;    // log and flight recorder tag of the session
+    int notify_pipe[2];       // a job thread writes a byte here when its job is done -- wakes the session
+    int cancel_pipe[2];       // write end closed when the session ends -- kills the jobs still running
+    spool_budget_t* budget;   // the session's output memory budget
+    pthread_mutex_t lock;
+    pthread_cond_t changed;   // a job finished
+};
+
+// paged output -- "@page" sends the first page of a long output and keeps the rest in a cursor of the session,
+// read on with the cursor builtin; only the session thread touches its cursors
+#define CURSORS_MAX 8                     // open cursors per session -- a new one replaces the least recently used
+#define DEFAULT_PAGE_SIZE (64UL << 10)    // @page without a size
+#define PAGE_LINE_MAX 4096                // pages end (and search results start) at a line boundary this close by
+
+typedef struct {
+    int id;                   // cursor number shown to the client, counting from 1 per session -- 0 = free slot
+    char* command;
+    spool_t output;           // the whole output -- stays charged to the session's budget until closed
+    size_t offset;            // first byte not sent yet
+    size_t page;              // page size the cursor was opened with
+    unsigned long used;       // session's cursor clock at the last use
+} output_cursor_t;
+
+// what a session keeps between its requests -- owned by its session thread, handed to server builtins
+typedef struct {
+    session_jobs_t* jobs;     // background jobs, NULL if the table could not be set up
+    session_state_t state;    // working directory and environment
+    spool_budget_t budget;    // memory every captured output of the session shares (see spool.h)
+    output_cursor_t cursors[CURSORS_MAX];
+    int next_cursor_id;
+    unsigned long cursor_clock;
+} session_context_t;
+
+// server builtins -- requests the server answers itself instead of running a command
+// a handler sends the whole reply (end frame included) and returns -1 only if sending failed
+typedef int (*server_builtin_fn)(int client_fd, char* args, const request_options_t* options, session_context_t* session);
+
+typedef struct {
+    const char* name;
+    server_builtin_fn handler;
+    int simple_only;          // only a request without list, pipe, redirection or job syntax -- others run as commands
+                              // (0: such a request is refused, the builtin's output cannot take part in a pipeline)
+} server_builtin_t;
+
+// parallel builtin -- "template ::: args", at most PARALLEL_WORKERS_MAX jobs of one request at once
+#define PARALLEL_SEPARATOR ":::"
+#define PARALLEL_PLACEHOLDER "{}"
+#define PARALLEL_WORKERS_MAX 64
+#define PARALLEL_EXIT_MAX 101             // reply exit code is the failed job count, capped here
+
+// one job of a parallel request
+typedef struct {
+    char* command;            // template with the argument filled in
+    spool_t output;           // captured output
+    int launched;             // the command ran -- output and result are valid once done
+    exec_result_t result;
+    int done;                 // set by the worker under the run's lock
+} parallel_job_t;
+
+// a parallel request -- shared by the session thread (sender) and its worker threads
+typedef struct {
+    parallel_job_t* jobs;
+    int num_jobs;
+    int next;                 // next job a worker takes
+    int sent;                 // jobs whose output the session has sent
+    int window;               // workers stay this many jobs ahead of sent at most
+    int cancelled;            // session gone -- start nothing more
+    const exec_limits_t* limits;
+    const session_state_t* state;
+    spool_budget_t* budget;
+    unsigned long session;    // log and flight recorder tag of the session
+    pthread_mutex_t lock;
+    pthread_cond_t changed;   // a job finished, or sent / cancelled moved
+} parallel_run_t;
+
+// descriptor the command child reports its own phase timings on (see execute_command_with_capture)
+#define REPORT_FD 3
+
+// what a command child is launched with besides its command -- the spawn helper's argument blob
+// the descriptors are stdout, stderr and report, then the session's directory and environment if the flags say so
+typedef struct {
+    exec_limits_t limits;
+    int has_cwd;              // a directory descriptor follows the three pipes
+    int has_env;              // an environment memfd comes last
+} child_args_t;
+
+// stage command text kept in stage reports (slow log, @time) -- longer argv lists are cut
+#define STAGE_ARGV_MAX 256
+typedef char stage_argv_t[STAGE_ARGV_MAX];
+
+// buffered reader for request lines -- several pipelined requests may arrive in one recv()
+typedef struct {
+    char data[BUFFER_SIZE];   // received bytes not yet returned as requests
+    size_t len;
+    int discarding;           // skipping the rest of an over-long line
+    double recv_at;           // monotonic time of the last recv() -- lower bound for when a buffered request arrived
+} request_reader_t;
+
+#define REQUEST_TOO_LONG 2        // read_request_line() result for a line longer than BUFFER_SIZE - 1
+#define REQUEST_NOTIFY 3          // read_request_line() result when notify_fd became readable first
+
+// server-wide default limits -- set from the command line in main()
+exec_limits_t server_limits = { DEFAULT_TIMEOUT_SEC, 0, DEFAULT_MAX_OUTPUT, 0, 1 };
+
+// listening port -- set from the command line in main()
+int server_port = PORT;
+
+// metrics listener port on 127.0.0.1, 0 = disabled -- set from the command line in main()
+int metrics_port = 0;
+
+// sessions currently being served -- updated with atomic builtins from the accept loop and session threads
+int active_sessions = 0;
+
+// last session id handed out -- accept loop only
+unsigned long last_session_id = 0;
+
+// logging configuration -- set from the command line in main()
+log_level_t log_level = LOG_INFO;
+unsigned log_sample = 1;
+log_output_mode_t log_output = LOG_OUTPUT_SIZE;
+
+// captured output a session may hold in memory, 0 = unlimited -- set from the command line in main()
+size_t spool_budget = DEFAULT_SPOOL_BUDGET;
+
+// directory for spill files past the budget, NULL = memfds -- set from the command line in main()
+const char* spool_dir = NULL;
+
+// unsent output of a streamed command before the server stops reading its pipes, 0 = no streaming
+// -- set from the command line in main()
+size_t stream_queue_max = DEFAULT_STREAM_QUEUE;
+
+// seconds a client may take no reply bytes before its session is closed, 0 = wait forever
+// -- set from the command line in main()
+double send_stall_sec = DEFAULT_SEND_STALL_SEC;
+
+// slow-command log thresholds, 0 = off -- set from the command line in main()
+double slow_latency_sec = 1.0;    // queued + served time
+size_t slow_output = 0;           // captured output bytes
+
+// flight recorder dump file, NULL = flight-<pid>.bin in the working directory -- set from the command line in main()
+const char* flight_path = NULL;
+
+// dump file to decode instead of serving (-D) -- set from the command line in main()
+const char* flight_decode_path = NULL;
+
+// launch command children through the spawn helper (spawn.h), 0 = fork them here (-Z) -- cleared if the helper dies
+int use_spawn_helper = 1;
+
+
+// server logging -- structured records through the asynchronous logger (log.h)
+void log_command(const char* command, const exec_result_t* result, const spool_t* output);
+void log_slow_command(const char* command, const exec_result_t* result, double queued);
+int is_slow_command(const exec_result_t* result, double queued);
+
+// per-stage reports
+int describe_stages(const char* command, stage_argv_t* argv, int count);
+size_t format_usage_report(const char* command, const pipeline_report_t* stages, char* buf, size_t size);
+size_t format_list_report(const command_list_t* list, char* buf, size_t size);
+void log_errno(log_level_t level, const char* event);
 
 // socket management functions
-int create_server_socket(void);
+int create_server_socket(int port);
 int accept_client_connection(int server_fd);
 
+// one client session -- owned by its session thread
+typedef struct {
+    int client_fd;
+    unsigned long id;         // sequential, tags the session's log records
+} session_t;
+
 // client handling and command execution
+int start_session(int client_fd);
+void* session_thread(void* arg);
 void handle_client(int client_fd);
-char* execute_command_with_capture(const char* command, int* success);
+void close_inherited_fds(int first_fd);
+int read_request_line(int client_fd, int notify_fd, request_reader_t* reader, char* line);
+int execute_command_with_capture(const char* command, const exec_limits_t* limits, const session_state_t* state,
+                                 int cancel_fd, output_stream_t* stream, spool_t* output, exec_result_t* result);
+void run_command_child(const char* command, const exec_limits_t* limits, int stdout_fd, int stderr_fd, int report_fd,
+                       int cwd_fd, int env_fd);
+int reap_command_child(pid_t pid, int wait_fd, int* status);
+void spawn_command_child(const char* command, const void* arg, const int* fds, int num_fds);
+void apply_resource_limits(const exec_limits_t* limits);
+
+// server builtins
+const server_builtin_t* find_server_builtin(char* command, char** args);
+int has_shell_operator(const char* text);
+int builtin_stats(int client_fd, char* args, const request_options_t* options, session_context_t* session);
+int builtin_parallel(int client_fd, char* args, const request_options_t* options, session_context_t* session);
+int builtin_jobs(int client_fd, char* args, const request_options_t* options, session_context_t* session);
+int builtin_wait(int client_fd, char* args, const request_options_t* options, session_context_t* session);
+int builtin_fetch(int client_fd, char* args, const request_options_t* options, session_context_t* session);
+int builtin_session_cd(int client_fd, char* args, const request_options_t* options, session_context_t* session);
+int builtin_session_export(int client_fd, char* args, const request_options_t* options, session_context_t* session);
+int builtin_session_unset(int client_fd, char* args, const request_options_t* options, session_context_t* session);
+int builtin_cursor(int client_fd, char* args, const request_options_t* options, session_context_t* session);
+void* parallel_worker(void* arg);
+char* expand_parallel_template(const char* template, const char* arg);
+int send_text_reply(int client_fd, const char* text, size_t len, reply_status_t status);
+
+// background jobs
+session_jobs_t* create_session_jobs(spool_budget_t* budget);
+void destroy_session_jobs(session_jobs_t* jobs);
+int is_background_request(char* command);
+int start_background_job(int client_fd, session_context_t* session, const char* command, const exec_limits_t* limits);
+void* background_job_thread(void* arg);
+int send_job_notices(int client_fd, session_jobs_t* jobs);
+background_job_t* find_background_job(session_jobs_t* jobs, const char* text);
+int format_job_line(const background_job_t* job, char* buf, size_t size);
+void release_background_job(background_job_t* job);
+
+// paged output
+int reply_output(int client_fd, const spool_t* output, size_t page, size_t* sent);
+output_cursor_t* open_output_cursor(session_context_t* session, const char* command, spool_t* output, size_t offset,
+                                    size_t page);
+int reply_cursor(int client_fd, int id, size_t offset, size_t total);
+int keep_output_rest(int client_fd, session_context_t* session, const char* command, spool_t* output, size_t offset,
+                     size_t page, int* cursor_id);
+output_cursor_t* find_output_cursor(session_context_t* session, const char* text);
+void close_output_cursor(output_cursor_t* cursor);
+size_t page_end(const spool_t* output, size_t offset, size_t page);
+size_t line_start(const spool_t* output, size_t offset);
+
+// streamed replies
+void start_output_stream(output_stream_t* stream, int client_fd);
+int stream_output(output_stream_t* stream, spool_t* output);
+int stream_backlog(const output_stream_t* stream, const spool_t* output);
+int finish_output_stream(output_stream_t* stream, spool_t* output);
+
+// session state
+void init_session_state(session_state_t* state);
+void free_session_state(session_state_t* state);
+int copy_session_state(const session_state_t* from, session_state_t* to);
+const char* session_getenv(const session_state_t* state, const char* name);
+int set_session_env(session_state_t* state, const char* name, const char* value);
+size_t keep_env_var(char* block, size_t used, const char* var, const char* name, size_t name_len);
+void apply_session_state(int cwd_fd, int env_fd);
+
+// reply frames, counted in the sent-bytes metric
+int reply_frame(int client_fd, char type, const void* payload, size_t len);
+int reply_spool(int client_fd, const spool_t* output, size_t offset, size_t len);
+size_t frame_wire_size(size_t len);
+int reply_end(int client_fd, int exit_code, reply_status_t status);
+size_t count_queued_requests(const request_reader_t* reader);
+
+// request and command line option parsing
+int parse_request_options(char** command, request_options_t* options);
+int parse_server_options(int argc, char* argv[]);
+void print_server_usage(const char* program);
+int parse_seconds(const char* text, double* seconds);
+int parse_size(const char* text, size_t* bytes);
+double monotonic_seconds(void);
+
+
+// server builtins, looked up by the first word of a request
+const server_builtin_t server_builtins[] = {
+    { "stats", builtin_stats, 0 },
+    { "parallel", builtin_parallel, 0 },
+    { "jobs", builtin_jobs, 0 },
+    { "wait", builtin_wait, 0 },
+    { "fetch", builtin_fetch, 0 },
+    { "cd", builtin_session_cd, 1 },
+    { "export", builtin_session_export, 1 },
+    { "unset", builtin_session_unset, 1 },
+    { "cursor", builtin_cursor, 0 },
+};
 
 
 // server entry point
-int main(void) {
+int main(int argc, char* argv[]) {
     int server_fd;  // server socket file descriptor
     int client_fd;  // client socket file descriptor
 
+    // default command limits from the command line
+    if (parse_server_options(argc, argv) == -1) {
+        return EXIT_FAILURE;
+    }
+
+    // -D only decodes a flight recorder dump
+    if (flight_decode_path != NULL) {
+        return (flight_decode(flight_decode_path) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // the spawn helper is forked first -- before any thread, socket or buffer exists, so its address space
+    // (which every command child starts as a copy of) stays as small as the server ever was
+    if (use_spawn_helper && spawn_helper_start(spawn_command_child) == -1) {
+        fprintf(stderr, "Warning: no spawn helper, forking commands from the server\n");
+        use_spawn_helper = 0;
+    }
+
+    // the flight recorder is armed before the first session, so every session is in the rings
+    char default_flight_path[64];
+    if (flight_path == NULL) {
+        snprintf(default_flight_path, sizeof(default_flight_path), "flight-%ld.bin", (long)getpid());
+        flight_path = default_flight_path;
+    }
+    // every failure from here on stops the helper too, it would otherwise outlive the server
+    if (flight_start(flight_path) == -1) {
+        spawn_helper_stop();
+        return EXIT_FAILURE;
+    }
+
+    // spill files for output past a session's budget -- a bad -T directory fails here, not on the first big output
+    if (spool_set_directory(spool_dir) == -1) {
+        spawn_helper_stop();
+        return EXIT_FAILURE;
+    }
+
     // create and configure server socket
-    server_fd = create_server_socket();
+    server_fd = create_server_socket(server_port);
     if (server_fd == -1) {
         fprintf(stderr, "Error -- Failed to create server socket\n");
+        spawn_helper_stop();
         return EXIT_FAILURE;
     }
 
-    // print startup message to indicate server is ready
-    print_info("Server started, waiting for client connections...");
+    // metrics listener runs on its own thread, next to the accept loop
+    if (metrics_port > 0 && metrics_start(metrics_port) == -1) {
+        close(server_fd);
+        spawn_helper_stop();
+        return EXIT_FAILURE;
+    }
 
-    // accept one client connection -- for now, handling one client at a time
-    client_fd = accept_client_connection(server_fd);
-    if (client_fd == -1) {
+    // from here on the console is the log -- one JSON record per line, written by a background thread
+    log_configure(log_level, log_sample, log_output);
+    if (log_start() == -1) {
         close(server_fd);
+        spawn_helper_stop();
         return EXIT_FAILURE;
     }
 
-    // print client connected message
-    print_info("Client connected.");
+    // startup record to indicate server is ready
+    log_record_t* rec = log_begin(LOG_INFO, "server_start", 0);
+    if (rec != NULL) {
+        log_int(rec, "port", server_port);
+        if (metrics_port > 0) log_int(rec, "metrics_port", metrics_port);
+        log_str(rec, "flight_dump", flight_path);
+        log_str(rec, "spawn", use_spawn_helper ? "helper" : "fork");
+        if (server_limits.parallel > 1) log_int(rec, "parallel", server_limits.parallel);
+        log_int(rec, "spool_budget", (long long)spool_budget);
+        log_str(rec, "spill", (spool_dir != NULL) ? spool_dir : "memfd");
+        log_int(rec, "stream_queue", (long long)stream_queue_max);
+        log_double(rec, "stall_sec", send_stall_sec);
+        log_commit(rec);
+    }
+
+    // accept clients until the server is stopped -- each session gets its own thread
+    while (1) {
+        client_fd = accept_client_connection(server_fd);
+        if (client_fd == -1) {
+            // transient failure (e.g. out of descriptors) -- back off briefly instead of spinning
+            struct timespec backoff = { 0, 10 * 1000 * 1000 };
+            nanosleep(&backoff, NULL);
+            continue;
+        }
 
-    // handle all commands from this client until disconnection
-    handle_client(client_fd);
+        if (start_session(client_fd) == -1) {
+            close(client_fd);
+        }
+    }
 
-    // cleanup - close both client and server sockets
-    close(client_fd);
+    // cleanup - close server socket
     close(server_fd);
+    log_shutdown();
+    spawn_helper_stop();
 
     return EXIT_SUCCESS;
 }
 
 
+// client sessions
+// hands an accepted client to a new detached session thread
+// returns 0 on success, -1 if the session was refused (caller closes the socket)
+int start_session(int client_fd) {
+    if (__atomic_add_fetch(&active_sessions, 1, __ATOMIC_RELAXED) > MAX_SESSIONS) {
+        __atomic_sub_fetch(&active_sessions, 1, __ATOMIC_RELAXED);
+        const char* error_msg = "Error: Server busy, too many sessions\n";
+        log_message(LOG_WARN, "session_refused", "too many sessions");
+        metrics_add(METRIC_SESSIONS_REFUSED, 1);
+        flight_commit(flight_begin(FLIGHT_SESSION_REFUSED));
+        reply_frame(client_fd, FRAME_OUTPUT, error_msg, strlen(error_msg));
+        reply_end(client_fd, -1, REPLY_ERROR);
+        return -1;
+    }
+
+    session_t* session = malloc(sizeof(session_t));
+    if (session == NULL) {
+        log_message(LOG_ERROR, "session_refused", "out of memory");
+        __atomic_sub_fetch(&active_sessions, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    session->client_fd = client_fd;
+    session->id = ++last_session_id;
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int err = pthread_create(&thread, &attr, session_thread, session);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        log_record_t* rec = log_begin(LOG_ERROR, "session_refused", 0);
+        if (rec != NULL) {
+            log_str(rec, "error", strerror(err));
+            log_commit(rec);
+        }
+        free(session);
+        __atomic_sub_fetch(&active_sessions, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    metrics_add(METRIC_SESSIONS, 1);
+    return 0;
+}
+
+// session thread -- handles all commands from one client until disconnection, then closes its socket
+void* session_thread(void* arg) {
+    session_t* session = arg;
+    int client_fd = session->client_fd;
+
+    // every record from this thread carries the session id
+    log_set_session(session->id);
+    log_message(LOG_INFO, "session_open", "client connected");
+    flight_set_session(session->id);
+    flight_commit(flight_begin(FLIGHT_SESSION_OPEN));
+
+    handle_client(client_fd);
+
+    flight_commit(flight_begin(FLIGHT_SESSION_CLOSE));
+    flight_thread_done();
+    close(client_fd);
+    free(session);
+    __atomic_sub_fetch(&active_sessions, 1, __ATOMIC_RELAXED);
+    metrics_add(METRIC_SESSIONS_CLOSED, 1);
+    metrics_thread_done();
+    return NULL;
+}
+
+
+// command line options
+// Usage: ./server [-p port] [-M metrics_port] [-t timeout_sec] [-c cpu_sec] [-o max_output] [-m max_memory]
+//                 [-B spool_budget] [-T spill_dir] [-Q stream_queue] [-W stall_sec]
+//                 [-l log_level] [-s sample] [-b] [-L slow_sec] [-O slow_output] [-F flight_dump] [-Z]
+//        ./server -D flight_dump
+// sizes accept K/M/G suffixes, 0 disables a limit
+// returns 0 on success, -1 on invalid options (usage already printed)
+int parse_server_options(int argc, char* argv[]) {
+    int opt;
+    double seconds;
+
+    while ((opt = getopt(argc, argv, "p:M:t:c:o:m:P:B:T:Q:W:l:s:bL:O:F:D:Z")) != -1) {
+        int valid = 1;
+        switch (opt) {
+            case 'p':
+                server_port = atoi(optarg);
+                valid = (server_port > 0 && server_port <= 65535);
+                break;
+            case 'M':
+                metrics_port = atoi(optarg);
+                valid = (metrics_port > 0 && metrics_port <= 65535);
+                break;
+            case 'l':
+                valid = (log_parse_level(optarg, &log_level) == 0);
+                break;
+            case 's':
+                log_sample = (unsigned)atoi(optarg);
+                valid = (atoi(optarg) > 0);
+                break;
+            case 'b':
+                log_output = LOG_OUTPUT_BODY;
+                break;
+            case 'L':
+                valid = (parse_seconds(optarg, &seconds) == 0);
+                if (valid) slow_latency_sec = seconds;
+                break;
+            case 'O':
+                valid = (parse_size(optarg, &slow_output) == 0);
+                break;
+            case 'F':
+                flight_path = optarg;
+                break;
+            case 'D':
+                flight_decode_path = optarg;
+                break;
+            case 'Z':
+                use_spawn_helper = 0;
+                break;
+            case 't':
+                valid = (parse_seconds(optarg, &seconds) == 0);
+                if (valid) server_limits.timeout_sec = seconds;
+                break;
+            case 'c':
+                valid = (parse_seconds(optarg, &seconds) == 0);
+                if (valid) server_limits.cpu_sec = (long)seconds + ((seconds > (long)seconds) ? 1 : 0);
+                break;
+            case 'o':
+                valid = (parse_size(optarg, &server_limits.max_output) == 0);
+                break;
+            case 'm':
+                valid = (parse_size(optarg, &server_limits.max_memory) == 0);
+                break;
+            case 'P':
+                server_limits.parallel = atoi(optarg);
+                valid = (server_limits.parallel >= 1 && server_limits.parallel <= PIPELINE_PARALLEL_MAX);
+                break;
+            case 'B':
+                valid = (parse_size(optarg, &spool_budget) == 0);
+                break;
+            case 'T':
+                spool_dir = optarg;
+                break;
+            case 'Q':
+                valid = (parse_size(optarg, &stream_queue_max) == 0);
+                break;
+            case 'W':
+                valid = (parse_seconds(optarg, &send_stall_sec) == 0);
+                break;
+            default:
+                valid = 0;
+                break;
+        }
+        if (!valid) {
+            print_server_usage(argv[0]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void print_server_usage(const char* program) {
+    fprintf(stderr, "Usage: %s [-p port] [-M metrics_port] [-t timeout_sec] [-c cpu_sec] [-o max_output] [-m max_memory] [-P replicas]\n", program);
+    fprintf(stderr, "          [-B spool_budget] [-T spill_dir] [-Q stream_queue] [-W stall_sec]\n");
+    fprintf(stderr, "          [-l debug|info|warn|error] [-s sample] [-b] [-L slow_sec] [-O slow_output] [-F flight_dump] [-Z]\n");
+    fprintf(stderr, "       %s -D flight_dump\n", program);
+    fprintf(stderr, "  defaults: -t %d -c 0 -o %luM -m 0 (0 = unlimited, sizes accept K/M/G)\n",
+            DEFAULT_TIMEOUT_SEC, DEFAULT_MAX_OUTPUT >> 20);
+    fprintf(stderr, "  logging:  -l info, -s 1 (log 1 in N successful commands), -b logs output bodies instead of sizes\n");
+    fprintf(stderr, "  slow log: -L 1 -O 0 -- commands over either threshold get a slow_command record (0 = off)\n");
+    fprintf(stderr, "  flight recorder: kill -USR1 dumps to -F (default flight-<pid>.bin), -D prints a dump\n");
+    fprintf(stderr, "  sharding: -P 1 -- grep, cut, tr and sed s/// stages run as up to %d replicas over chunks of their input\n",
+            PIPELINE_PARALLEL_MAX);
+    fprintf(stderr, "  spawn:    -Z forks commands from the server itself instead of the spawn helper\n");
+    fprintf(stderr, "  spooling: -B %luM -- output a session holds in memory (0 = unlimited), the rest goes to memfds\n",
+            DEFAULT_SPOOL_BUDGET >> 20);
+    fprintf(stderr, "            or to unlinked files in -T spill_dir\n");
+    fprintf(stderr, "  streaming: -Q %luM -- unsent output before a command is paused (0 = reply after the command),\n",
+            DEFAULT_STREAM_QUEUE >> 20);
+    fprintf(stderr, "             -W %d -- seconds a client may read nothing before its session is closed (0 = never)\n",
+            DEFAULT_SEND_STALL_SEC);
+}
+
+
 // socket creation and configuration
 // creates, binds, and configures a TCP server socket
 // returns: server socket file descriptor on success, -1 on failure
-int create_server_socket(void) {
+int create_server_socket(int port) {
     int server_fd;
     struct sockaddr_in server_addr;
     int opt = 1;
 
     // create TCP socket (AF_INET = IPv4, SOCK_STREAM = TCP)
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    // close-on-exec so command processes never inherit the listening socket
+    server_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (server_fd == -1) {
         perror("Error: Socket creation failed");
         return -1;
@@ -108,7 +745,7 @@ int create_server_socket(void) {
     memset(&server_addr, 0, sizeof(server_addr));         
     server_addr.sin_family = AF_INET;                     
     server_addr.sin_addr.s_addr = INADDR_ANY;             
-    server_addr.sin_port = htons(PORT);                   
+    server_addr.sin_port = htons(port);                   
 
     // bind socket to the configured address and port
     if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1) {
@@ -137,11 +774,31 @@ int accept_client_connection(int server_fd) {
     socklen_t client_len = sizeof(client_addr);
 
     // accept incoming connection - this blocks until a client connects
-    client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_len);
+    // close-on-exec so command processes never hold a client connection open
+    client_fd = accept4(server_fd, (struct sockaddr *)&client_addr, &client_len, SOCK_CLOEXEC);
     if (client_fd == -1) {
         perror("Error -- Accept failed");
         return -1;
     }
+    PROBE1(accept, client_fd);
+
+    // replies end with a small status frame -- without TCP_NODELAY, Nagle holds it
+    // back until the previous frame is acknowledged, adding a delayed-ACK wait per command
+    int nodelay = 1;
+    if (setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) == -1) {
+        perror("Error: setsockopt(TCP_NODELAY) failed");
+    }
+
+    // a client that stops reading must not hold its session thread forever -- every blocking send
+    // (text replies, trailers, fetch and cursor pages) fails with EAGAIN once it waited this long
+    if (send_stall_sec > 0) {
+        struct timeval stall;
+        stall.tv_sec = (time_t)send_stall_sec;
+        stall.tv_usec = (suseconds_t)((send_stall_sec - (double)stall.tv_sec) * 1e6);
+        if (setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &stall, sizeof(stall)) == -1) {
+            perror("Error: setsockopt(SO_SNDTIMEO) failed");
+        }
+    }
 
     return client_fd;
 }
@@ -363,199 +1020,462 @@ int accept_client_connection(int server_fd) {
 // executes a shell command and captures all its output (stdout and stderr)
 // integrates Phase 1 shell with Phase 2 networking
 // create two pipes: one for stdout, one for stderr -- fork child process
-// child --> redirect stdout/stderr to pipes
-// parent --> read from pipes to capture all output, wait for child to finish
-char* execute_command_with_capture(const char* command, int* success) {
+// child --> becomes a process group leader, applies resource limits, redirects stdout/stderr to pipes
+// parent --> poll() both pipes until they close, enforcing the wall-clock and output limits
+// a third pipe carries the child's own phase timings (parse, spawn, exec, run) back to the parent
+// state (NULL for none) is the session's directory and environment the command starts with
+// cancel_fd (-1 for none) kills the command once it polls readable or hung up -- nobody is left for the output
+// stream (NULL for none) sends the output to the client while the command runs (start_output_stream()) --
+// the pipes are left unread while the client is stream_queue_max bytes behind, so the command blocks in
+// write() until the client catches up; the caller completes the stream with finish_output_stream()
+// output is an empty spool (spool_init()) that receives the captured bytes -- the caller frees it in any case
+// returns 0 and fills in result, -1 if the command could not be started (output is left empty)
+int execute_command_with_capture(const char* command, const exec_limits_t* limits, const session_state_t* state,
+                                 int cancel_fd, output_stream_t* stream, spool_t* output, exec_result_t* result) {
     // create pipes for capturing stdout and stderr separately -- [0] = read end, [1] = write end
-    int stdout_pipe[2]; 
+    int stdout_pipe[2];
     int stderr_pipe[2];
-    
+    int report_pipe[2];
+
+    result->exit_code = -1;
+    result->status = REPLY_ERROR;
+    result->output_len = 0;
+    timing_clear(&result->timing);
+    result->stages.num_stages = 0;
+    result->list_len = 0;
+
     // create stdout pipe
-    if (pipe(stdout_pipe) == -1) {
+    // close-on-exec: another session's child must never inherit our write ends
+    if (pipe2(stdout_pipe, O_CLOEXEC) == -1) {
         perror("Error: pipe creation failed for stdout");
-        *success = 0;
-        return NULL;
+        return -1;
     }
-    
+
     // create stderr pipe
-    if (pipe(stderr_pipe) == -1) {
+    if (pipe2(stderr_pipe, O_CLOEXEC) == -1) {
         perror("Error: pipe creation failed for stderr");
         close(stdout_pipe[0]);
         close(stdout_pipe[1]);
-        *success = 0;
-        return NULL;
+        return -1;
     }
-    
-    // fork a child process to execute the command
-    pid_t pid = fork();
-    if (pid == -1) {
-        // fork failed
-        perror("Error -- fork failed");
+
+    // create timing report pipe -- non-blocking so a missing report never stalls the parent
+    if (pipe2(report_pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+        perror("Error: pipe creation failed for timing report");
         close(stdout_pipe[0]);
         close(stdout_pipe[1]);
         close(stderr_pipe[0]);
         close(stderr_pipe[1]);
-        *success = 0;
-        return NULL;
+        return -1;
     }
-    
-    if (pid == 0) {
-        // child process
-        // execute the command with redirected output
-        
-        // close read ends of pipes -- child only writes to pipes
-        close(stdout_pipe[0]);
-        close(stderr_pipe[0]);
-        
-        // redirect stdout to the write end of stdout_pipe
-        // anything printed to stdout goes into the pipe
-        dup2(stdout_pipe[1], STDOUT_FILENO);
-        
-        // redirect stderr to the write end of stderr_pipe
-        // anything printed to stderr goes into the pipe
-        dup2(stderr_pipe[1], STDERR_FILENO);
-        
-        // Close the original write ends after duplication
-        // file descriptors are now duplicated onto STDOUT/STDERR
-        close(stdout_pipe[1]);
-        close(stderr_pipe[1]);
-        
-        // make a copy of the command string
-        char* cmd_copy = malloc(strlen(command) + 1);
-        if (cmd_copy == NULL) {
-            fprintf(stderr, "Error: Memory allocation failed\n");
-            exit(EXIT_FAILURE);
+
+    // launch the command child -- through the spawn helper when it runs, so the fork() cost does not
+    // grow with the server; the helper reaps the child and hands its wait status back on wait_fd
+    double fork_start = monotonic_seconds();
+    pid_t pid = -1;
+    int wait_fd = -1;
+    int launched = SPAWN_HELPER_GONE;
+    int cwd_fd = (state != NULL) ? state->cwd_fd : -1;
+    int env_fd = (state != NULL) ? state->env_fd : -1;
+    if (use_spawn_helper) {
+        child_args_t args = { *limits, cwd_fd >= 0, env_fd >= 0 };
+        int child_fds[5] = { stdout_pipe[1], stderr_pipe[1], report_pipe[1] };
+        int num_fds = 3;
+        if (cwd_fd >= 0) child_fds[num_fds++] = cwd_fd;
+        if (env_fd >= 0) child_fds[num_fds++] = env_fd;
+        launched = spawn_helper_launch(command, &args, sizeof(args), child_fds, num_fds, &pid, &wait_fd);
+        if (launched == SPAWN_HELPER_GONE && __atomic_exchange_n(&use_spawn_helper, 0, __ATOMIC_RELAXED)) {
+            log_message(LOG_ERROR, "spawn_helper_gone", "spawn helper died -- forking commands from the server");
         }
-        strcpy(cmd_copy, command);
-        
-        // parse the command using Phase 1 parser
-        // handles: simple commands, pipes, redirections, compound commands
-        pipeline_t* pipeline = parse_pipeline(cmd_copy);
-        free(cmd_copy);
-        
-        if (pipeline == NULL) {
-            // Parsing failed - invalid command syntax
-            fprintf(stderr, "Error -- Invalid command: %s\n", command);
-            exit(EXIT_FAILURE);
+    }
+    if (launched == SPAWN_HELPER_GONE) {
+        pid = fork();
+        if (pid == 0) {
+            // child process -- close read ends of pipes, child only writes to pipes
+            close(stdout_pipe[0]);
+            close(stderr_pipe[0]);
+            close(report_pipe[0]);
+            run_command_child(command, limits, stdout_pipe[1], stderr_pipe[1], report_pipe[1], cwd_fd, env_fd);
         }
-        
-        // execute the parsed pipeline using Phase 1 features
-        int status = execute_pipeline(pipeline);
-        
-        // clean up allocated memory
-        free_pipeline(pipeline);
-        
-        // exit with the command's exit status
-        // Exit code 0 -> success, != 0 -> error
-        exit(status);
-    } else {
-        // parent
-        // read the captured output from pipes
-        
-        // close write ends of pipes (parent only reads from pipes)
+    }
+    if (pid == -1) {
+        // fork failed
+        perror("Error -- fork failed");
+        metrics_add(METRIC_FORK_FAILURES, 1);
+        flight_record_t* rec = flight_begin(FLIGHT_FORK);
+        rec->pid = -1;
+        flight_commit(rec);
+        close(stdout_pipe[0]);
         close(stdout_pipe[1]);
+        close(stderr_pipe[0]);
         close(stderr_pipe[1]);
-        
-        // buffers for reading from pipes
-        char stdout_buffer[BUFFER_SIZE];
-        char stderr_buffer[BUFFER_SIZE];
-        ssize_t stdout_bytes = 0;
-        ssize_t stderr_bytes = 0;
-        
-        // allocate initial memory for combined output
-        // dynamically grow this buffer as needed
-        size_t total_size = BUFFER_SIZE * 2;
-        char* output = malloc(total_size);
-        if (output == NULL) {
-            perror("Error: malloc failed for output");
-            close(stdout_pipe[0]);
-            close(stderr_pipe[0]);
-            waitpid(pid, NULL, 0);
-            *success = 0;
-            return NULL;
-        }
-        output[0] = '\0';  // start with empty string
-        size_t output_len = 0;
-        
-        // read all data from stdout pipe
-        // loop continues until pipe is closed
-        while ((stdout_bytes = read(stdout_pipe[0], stdout_buffer, BUFFER_SIZE - 1)) > 0) {
-            // dynamically resize output buffer if needed
-            // ensure we have space for the new data plus null terminator
-            while (output_len + stdout_bytes + 1 > total_size) {
-                total_size *= 2;
-                char* new_output = realloc(output, total_size);
-                if (new_output == NULL) {
-                    perror("Error: realloc failed");
-                    free(output);
-                    close(stdout_pipe[0]);
-                    close(stderr_pipe[0]);
-                    waitpid(pid, NULL, 0);
-                    *success = 0;
-                    return NULL;
+        close(report_pipe[0]);
+        close(report_pipe[1]);
+        return -1;
+    }
+
+    // parent
+    double capture_start = monotonic_seconds();
+    result->timing.phase[PHASE_FORK] = capture_start - fork_start;
+    PROBE2(command_fork, pid, command);
+    flight_record_t* rec = flight_begin(FLIGHT_FORK);
+    rec->pid = (int32_t)pid;
+    rec->duration_ns = (uint64_t)(result->timing.phase[PHASE_FORK] * 1e9);
+    flight_commit(rec);
+
+    // set the group from this side too so kill(-pid) can never race the child's setpgid()
+    // (the spawn helper has already done so for its children)
+    if (wait_fd == -1) setpgid(pid, pid);
+
+    // close write ends of pipes (parent only reads from pipes)
+    close(stdout_pipe[1]);
+    close(stderr_pipe[1]);
+    close(report_pipe[1]);
+
+    // the spool holds the output in memory while the session's budget allows, in a spill file past it
+    size_t output_len = 0;
+    reply_status_t kill_reason = REPLY_OK;
+
+    // read both pipes as data arrives -- reading them one after the other
+    // deadlocks once the child fills the pipe we are not reading
+    // the child's exit is a third event in the same loop: the spawn helper's wait socket, or a pidfd
+    // when we forked it ourselves -- it is reaped the moment it exits, never with a blocking wait
+    // (without pidfd_open(), before Linux 5.3, it is reaped after the loop as before)
+    // a streamed reply adds the client socket -- polled for POLLOUT while the socket buffer is full
+    int exit_fd = (wait_fd >= 0) ? wait_fd : open_child_pidfd(pid);
+    int pipe_fds[2] = { stdout_pipe[0], stderr_pipe[0] };
+    struct pollfd fds[5];
+    fds[0].events = POLLIN;
+    fds[1].events = POLLIN;
+    fds[2].fd = exit_fd;
+    fds[2].events = POLLIN;
+    fds[3].fd = cancel_fd;
+    fds[3].events = POLLIN;
+    fds[4].events = POLLOUT;
+    int open_pipes = 2;
+    double deadline = (limits->timeout_sec > 0) ? monotonic_seconds() + limits->timeout_sec : 0;
+    int status = 0;
+    int exited = 0;           // exit event handled (or no exit event to wait for)
+    int reaped = 0;           // status is the child's -- not if the spawn helper died first
+
+    while (kill_reason == REPLY_OK && (open_pipes > 0 || fds[2].fd >= 0)) {
+        double now = monotonic_seconds();
+        int wait_ms = -1;
+        if (deadline > 0) {
+            double remaining = deadline - now;
+            if (remaining <= 0) {
+                kill_reason = REPLY_TIMEOUT;
+                break;
+            }
+            wait_ms = (int)(remaining * 1000.0) + 1;
+        }
+
+        // the client is stream_queue_max bytes behind -- stop reading, the command blocks once its pipes fill
+        // a client that takes nothing for send_stall_sec is given up on, with the command killed
+        int throttled = 0;
+        fds[4].fd = -1;
+        if (stream != NULL && stream_backlog(stream, output)) {
+            throttled = (spool_length(output) - stream->sent >= stream_queue_max);
+            if (throttled && !stream->throttled) {
+                stream->throttled = 1;
+                metrics_add(METRIC_THROTTLED, 1);
+            }
+            if (stream->blocked) fds[4].fd = stream->client_fd;
+            if (send_stall_sec > 0) {
+                double remaining = stream->progress_at + send_stall_sec - now;
+                if (remaining <= 0) {
+                    stream->error = ETIMEDOUT;
+                    kill_reason = REPLY_ERROR;
+                    break;
                 }
-                output = new_output;
+                if (wait_ms == -1 || remaining * 1000.0 < wait_ms) wait_ms = (int)(remaining * 1000.0) + 1;
             }
-            
-            // FIXED: use memcpy instead of strcat for better safety
-            // copy the new data directly into the buffer at the correct position
-            memcpy(output + output_len, stdout_buffer, stdout_bytes);
-            output_len += stdout_bytes;
-            output[output_len] = '\0';  // null-terminate after adding data
-        }
-        
-        // read all data from stderr pipe
-        // Same process as stdout - read until pipe closes
-        while ((stderr_bytes = read(stderr_pipe[0], stderr_buffer, BUFFER_SIZE - 1)) > 0) {
-            // dynamically resize if needed
-            while (output_len + stderr_bytes + 1 > total_size) {
-                total_size *= 2;
-                char* new_output = realloc(output, total_size);
-                if (new_output == NULL) {
-                    perror("Error: realloc failed");
-                    free(output);
-                    close(stdout_pipe[0]);
-                    close(stderr_pipe[0]);
-                    waitpid(pid, NULL, 0);
-                    *success = 0;
-                    return NULL;
+        }
+        fds[0].fd = throttled ? -1 : pipe_fds[0];
+        fds[1].fd = throttled ? -1 : pipe_fds[1];
+
+        int ready = poll(fds, 5, wait_ms);
+        if (ready == -1) {
+            if (errno == EINTR) continue;
+            perror("Error: poll failed on output pipes");
+            kill_reason = REPLY_ERROR;
+            break;
+        }
+
+        // cancelled -- the session that would have read the output is gone
+        if (fds[3].fd >= 0 && fds[3].revents != 0) {
+            kill_reason = REPLY_ERROR;
+            break;
+        }
+
+        // exited -- stages are all reaped by now, so the pipes are at or near end of file
+        if (fds[2].fd >= 0 && fds[2].revents != 0) {
+            reaped = reap_command_child(pid, wait_fd, &status);
+            exited = 1;
+            fds[2].fd = -1;
+        }
+
+        for (int i = 0; i < 2 && kill_reason == REPLY_OK; i++) {
+            if (fds[i].fd < 0 || fds[i].revents == 0) continue;
+
+            // one byte past the output limit is enough to detect overflow
+            size_t room = (limits->max_output > 0) ? limits->max_output - output_len + 1 : (size_t)SSIZE_MAX;
+            ssize_t bytes = spool_read(output, fds[i].fd, room);
+            if (bytes > 0) {
+                if (output_len == 0) PROBE2(first_output, pid, bytes);
+                output_len += (size_t)bytes;
+                if (limits->max_output > 0 && output_len > limits->max_output) {
+                    // keep exactly max_output bytes and stop the command -- streamed bytes are no longer in the spool
+                    output_len = limits->max_output;
+                    spool_truncate(output, output_len - ((stream != NULL) ? stream->dropped : 0));
+                    kill_reason = REPLY_OUTPUT_LIMIT;
                 }
-                output = new_output;
+            } else if (bytes == SPOOL_FAILED) {
+                log_errno(LOG_ERROR, "spill_failed");
+                kill_reason = REPLY_ERROR;
+            } else if (bytes == 0 || errno != EINTR) {
+                // pipe closed (or broken) -- stop polling it
+                close(pipe_fds[i]);
+                pipe_fds[i] = -1;
+                open_pipes--;
             }
-            
-            // FIXED: use memcpy instead of strcat
-            // append stderr to output (after stdout)
-            memcpy(output + output_len, stderr_buffer, stderr_bytes);
-            output_len += stderr_bytes;
-            output[output_len] = '\0';  // null-terminate
-        }
-        
-        // close read ends of pipes
-        close(stdout_pipe[0]);
-        close(stderr_pipe[0]);
-        
-        // wait for child process to finish and get its exit status
-        int status;
-        waitpid(pid, &status, 0);
-        
-        // FIXED: determine success based solely on exit status
-        // don't rely on fragile string matching in output
-        if (WIFEXITED(status)) {
-            int exit_status = WEXITSTATUS(status);
-            // command succeeded if exit status is 0
-            *success = (exit_status == 0) ? 1 : 0;
-        } else {
-            // child process did not exit normally (e.g., killed by signal)
-            *success = 0;
         }
-        
-        // return the captured output
-        // caller responsible for freeing this memory
-        return output;
+
+        // send what arrived right away -- after a full socket buffer only once POLLOUT says there is room
+        if (stream != NULL && (!stream->blocked || fds[4].revents != 0) && stream_output(stream, output) == -1) {
+            kill_reason = REPLY_ERROR;
+        }
+    }
+
+    // a tripped limit kills every process of the command, not just the direct child
+    // once the child is reaped its group is gone and the id may already belong to another command's group
+    // (the limit tripped on output left in the pipes) -- never signal it then
+    if (kill_reason != REPLY_OK && !exited) {
+        kill(-pid, SIGKILL);
+    }
+
+    // close read ends of pipes that are still open
+    for (int i = 0; i < 2; i++) {
+        if (pipe_fds[i] >= 0) close(pipe_fds[i]);
+    }
+
+    // largest capture buffer so far -- sizes the memory a burst of big outputs needs
+    metrics_capture_buffer(output->mem_cap);
+    if (output->file_len > 0) metrics_add(METRIC_SPILLED_BYTES, output->file_len);
+
+    // wait for child process to finish and get its exit status -- only left to do if it was killed
+    // or there is no exit event, otherwise it was reaped inside the loop and the reap phase is 0
+    double reap_start = monotonic_seconds();
+    result->timing.phase[PHASE_CAPTURE] = reap_start - capture_start;
+    if (!exited) reaped = reap_command_child(pid, wait_fd, &status);
+    result->timing.phase[PHASE_REAP] = exited ? 0 : monotonic_seconds() - reap_start;
+    if (exit_fd >= 0 && exit_fd != wait_fd) close(exit_fd);
+    PROBE2(command_exit, pid, status);
+
+    // child-side phases and stages -- absent if the child was killed before it finished
+    child_report_t report;
+    if (read(report_pipe[0], &report, sizeof(report)) == (ssize_t)sizeof(report)) {
+        result->timing.phase[PHASE_PARSE] = report.timing.phase[PHASE_PARSE];
+        if (report.timing.phase[PHASE_SPAWN] >= 0) {
+            result->timing.phase[PHASE_SPAWN] = report.timing.phase[PHASE_SPAWN];
+            result->timing.phase[PHASE_EXEC] = report.timing.phase[PHASE_EXEC];
+            result->timing.phase[PHASE_RUN] = report.timing.phase[PHASE_RUN];
+        }
+        result->stages = report.stages;
+        result->list_len = (report.list_len <= sizeof(result->list)) ? report.list_len : 0;
+        memcpy(result->list, report.list, result->list_len);
+    }
+    close(report_pipe[0]);
+
+    // a killed child reports 128 + signal, like the shell does
+    if (!reaped) {
+        // exit code stays -1
+    } else if (WIFEXITED(status)) {
+        result->exit_code = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        result->exit_code = 128 + WTERMSIG(status);
+    }
+
+    // determine the reply status -- limits first, then the exit status alone
+    if (kill_reason != REPLY_OK) {
+        result->status = kill_reason;
+    } else if (result->exit_code == 0) {
+        result->status = REPLY_OK;
+    } else if (limits->cpu_sec > 0 && result->exit_code == 128 + SIGXCPU) {
+        // a stage (or the child itself) hit RLIMIT_CPU
+        result->status = REPLY_CPU_LIMIT;
+    } else {
+        result->status = REPLY_FAILED;
+    }
+
+    rec = flight_begin(FLIGHT_REAP);
+    rec->pid = (int32_t)pid;
+    rec->exit_code = result->exit_code;
+    rec->status = (uint16_t)result->status;
+    rec->bytes_out = output_len;
+    rec->duration_ns = (uint64_t)(result->timing.phase[PHASE_REAP] * 1e9);
+    flight_commit(rec);
+
+    if (kill_reason == REPLY_ERROR) {
+        spool_free(output);
+        return -1;
+    }
+
+    result->output_len = output_len;
+    return 0;
+}
+
+// the command child -- runs one command with the Phase 1 parser and executor and exits with its status
+// stdout_fd and stderr_fd become its stdout and stderr, report_fd its REPORT_FD
+// cwd_fd and env_fd (-1 for none) are the session's directory and environment
+// runs in a child of the server (-Z, or no spawn helper) or of the spawn helper, never returns
+void run_command_child(const char* command, const exec_limits_t* limits, int stdout_fd, int stderr_fd, int report_fd,
+                       int cwd_fd, int env_fd) {
+    // own process group so the server can kill every stage of the pipeline at once
+    setpgid(0, 0);
+
+    // rlimits are inherited by every stage that execute_pipeline() forks
+    apply_resource_limits(limits);
+    pipeline_parallel = limits->parallel;
+
+    // redirect stdout to the write end of stdout_pipe
+    // anything printed to stdout goes into the pipe
+    dup2(stdout_fd, STDOUT_FILENO);
+
+    // redirect stderr to the write end of stderr_pipe
+    // anything printed to stderr goes into the pipe
+    dup2(stderr_fd, STDERR_FILENO);
+
+    // Close the original write ends after duplication
+    // file descriptors are now duplicated onto STDOUT/STDERR
+    close(stdout_fd);
+    close(stderr_fd);
+
+    // the session's cd and export -- before REPORT_FD is set up, which may be one of their descriptors
+    apply_session_state(cwd_fd, env_fd);
+
+    // timing reports go to a fixed descriptor, still close-on-exec so no stage inherits it
+    if (report_fd != REPORT_FD) {
+        dup2(report_fd, REPORT_FD);
+        fcntl(REPORT_FD, F_SETFD, FD_CLOEXEC);
+        close(report_fd);
+    }
+
+    // this child never execs itself, so close-on-exec alone does not help --
+    // drop every descriptor other sessions had open when we forked (client sockets, their pipes)
+    close_inherited_fds(REPORT_FD + 1);
+
+    // make a copy of the command string
+    char* cmd_copy = malloc(strlen(command) + 1);
+    if (cmd_copy == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(cmd_copy, command);
+
+    // parse the command using Phase 1 parser
+    // handles: simple commands, pipes, redirections, ;, && and || lists, ( ) groups
+    child_report_t report;
+    timing_clear(&report.timing);
+    report.stages.num_stages = 0;
+    report.list_len = 0;
+    PROBE1(parse_start, cmd_copy);
+    double parse_start = monotonic_seconds();
+    command_list_t* list = parse_command_list(cmd_copy);
+    report.timing.phase[PHASE_PARSE] = monotonic_seconds() - parse_start;
+    PROBE2(parse_end, command, (list != NULL) ? list->num_entries : 0);
+    free(cmd_copy);
+
+    if (list == NULL) {
+        // Parsing failed - invalid command syntax
+        fprintf(stderr, "Error -- Invalid command: %s\n", command);
+        exit(EXIT_FAILURE);
+    }
+
+    // execute the parsed list using Phase 1 features
+    // with pipeline_timing set, execute_pipeline() timestamps the spawn, exec and run phases of each pipeline,
+    // with pipeline_report set it keeps every stage's pid, exit code and rusage (from wait4()) --
+    // only for a lone pipeline, the stages of several would not fit one @time report (nor would a group's in front of one)
+    int single = (list->num_entries == 1 && list->entries[0].pipeline != NULL && list->entries[0].group == NULL);
+    pipeline_timing_t stages = { 0, 0, 0, 0 };
+    pipeline_timing = &stages;
+    pipeline_report = single ? &report.stages : NULL;
+    double list_start = monotonic_seconds();
+    int status = execute_command_list(list);
+    double list_end = monotonic_seconds();
+    pipeline_timing = NULL;
+    pipeline_report = NULL;
+
+    if (list->num_entries > 1) report.list_len = format_list_report(list, report.list, sizeof(report.list));
+
+    // clean up allocated memory
+    free_command_list(list);
+
+    // report the child-side phases and stages -- below PIPE_BUF, so the write is atomic
+    // spawn and exec are the last pipeline's, run is the rest of the list's time
+    report.timing.phase[PHASE_SPAWN] = stages.forked - stages.start;
+    report.timing.phase[PHASE_EXEC] = stages.execed - stages.forked;
+    report.timing.phase[PHASE_RUN] = (list_end - list_start) - report.timing.phase[PHASE_SPAWN] - report.timing.phase[PHASE_EXEC];
+    if (write(REPORT_FD, &report, sizeof(report)) == -1) {
+        // the parent treats a missing report as "not measured"
+    }
+
+    // exit with the command's exit status
+    // Exit code 0 -> success, != 0 -> error
+    exit(status);
+}
+
+// reaps the command child -- blocks unless its exit was already signalled
+// wait_fd is the spawn helper's wait socket (closed here), -1 if the server forked the child itself
+// returns 1 with *status set, 0 if the status is unknown (the spawn helper died first)
+int reap_command_child(pid_t pid, int wait_fd, int* status) {
+    if (wait_fd >= 0) return (spawn_helper_wait(wait_fd, status) == 0);
+    while (waitpid(pid, status, 0) == -1) {
+        if (errno != EINTR) return 0;
+    }
+    return 1;
+}
+
+// spawn helper entry point (spawn.h) -- fds are stdout, stderr and report, then the session's directory and
+// environment as arg (a child_args_t) says
+void spawn_command_child(const char* command, const void* arg, const int* fds, int num_fds) {
+    child_args_t args;
+    memcpy(&args, arg, sizeof(args));
+    if (num_fds != 3 + (args.has_cwd != 0) + (args.has_env != 0)) exit(EXIT_FAILURE);
+    int cwd_fd = args.has_cwd ? fds[3] : -1;
+    int env_fd = args.has_env ? fds[num_fds - 1] : -1;
+    run_command_child(command, &args.limits, fds[0], fds[1], fds[2], cwd_fd, env_fd);
+}
+
+// closes every descriptor from first_fd up in the calling process
+// used in the command child, which runs the Phase 1 executor in-process and only needs 0, 1, 2 and REPORT_FD
+void close_inherited_fds(int first_fd) {
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, (unsigned)first_fd, ~0U, 0U) == 0) return;
+#endif
+    // older kernels -- close descriptors one by one
+    long max_fd = sysconf(_SC_OPEN_MAX);
+    if (max_fd < 0 || max_fd > 65536) max_fd = 65536;
+    for (long fd = first_fd; fd < max_fd; fd++) close((int)fd);
+}
+
+// applies the CPU and address space limits to the calling process
+// called in the command child before it execs anything -- every stage inherits the limits
+void apply_resource_limits(const exec_limits_t* limits) {
+    struct rlimit rl;
+
+    if (limits->cpu_sec > 0) {
+        // soft limit delivers SIGXCPU, hard limit one second later is a SIGKILL for stages that ignore it
+        rl.rlim_cur = (rlim_t)limits->cpu_sec;
+        rl.rlim_max = (rlim_t)limits->cpu_sec + 1;
+        if (setrlimit(RLIMIT_CPU, &rl) == -1) perror("Error: setrlimit(RLIMIT_CPU) failed");
+    }
+
+    if (limits->max_memory > 0) {
+        rl.rlim_cur = (rlim_t)limits->max_memory;
+        rl.rlim_max = (rlim_t)limits->max_memory;
+        if (setrlimit(RLIMIT_AS, &rl) == -1) perror("Error: setrlimit(RLIMIT_AS) failed");
     }
-    
-    // should never reach here
-    return NULL;
 }
 
 //
@@ -667,174 +1587,1790 @@ char* execute_command_with_capture(const char* command, int* success) {
 
 // client command handling loop
 // receives commands from client via socket, executes each command, sends the captured output back to client, displays messages
+// every reply is framed: output frame(s) followed by one end frame with the exit code and status (see protocol.h)
 // continue until client disconnects or sends "exit" command
 void handle_client(int client_fd) {
     char buffer[BUFFER_SIZE];
-    ssize_t bytes_received;
-    
+    request_reader_t reader;
+    reader.len = 0;
+    reader.discarding = 0;
+    reader.recv_at = 0;
+
+    // background jobs of this session -- without a table "command &" and the job builtins report an error
+    session_context_t session;
+    init_session_state(&session.state);
+    spool_budget_init(&session.budget, spool_budget);
+    session.jobs = create_session_jobs(&session.budget);
+    memset(session.cursors, 0, sizeof(session.cursors));
+    session.next_cursor_id = 0;
+    session.cursor_clock = 0;
+    session_jobs_t* jobs = session.jobs;
+    if (jobs == NULL) log_message(LOG_ERROR, "jobs_unavailable", "could not create the session's job table");
+
     // continues until client disconnects or sends "exit"
     while (1) {
-        // clear buffer before receiving new command
-        memset(buffer, 0, BUFFER_SIZE);
-        
-        // receive command from client
-        // recv() blocks until data is available or connection closes
-        bytes_received = recv(client_fd, buffer, BUFFER_SIZE - 1, 0);
-        
+        // finished background jobs are announced between replies, never inside one
+        if (jobs != NULL && send_job_notices(client_fd, jobs) == -1) {
+            log_errno(LOG_ERROR, "send_failed");
+            break;
+        }
+
+        // receive the next request line from client -- or wake up for a job that finished meanwhile
+        // pipelined requests stay buffered in the reader and are served in order
+        int got = read_request_line(client_fd, (jobs != NULL) ? jobs->notify_pipe[0] : -1, &reader, buffer);
+        if (got == REQUEST_NOTIFY) continue;
+
         // check for errors or connection closed
-        if (bytes_received <= 0) {
-            if (bytes_received == 0) {
+        if (got <= 0) {
+            if (got == 0) {
                 // client closed connection gracefully
-                printf("[INFO] Client disconnected.\n");
+                log_message(LOG_INFO, "session_close", "client disconnected");
             } else {
                 // recv() error
-                perror("Error: recv failed");
+                log_errno(LOG_ERROR, "recv_failed");
             }
             break;
         }
-        
-        // null-terminate the received data to make it a valid C string
-        buffer[bytes_received] = '\0';
-        
-        // remove trailing newline if present
-        size_t len = strlen(buffer);
-        if (len > 0 && buffer[len - 1] == '\n') {
-            buffer[len - 1] = '\0';
-        }
-        
-        // display received command on server console with formatting
-        print_received(buffer);
-        
+
+        // the request's total time starts once its line is complete -- before that it sat in the reader
+        double received_at = monotonic_seconds();
+        double queued = (reader.recv_at > 0) ? received_at - reader.recv_at : 0;
+        PROBE2(request_received, client_fd, (const char*)buffer);
+        metrics_set_queued(count_queued_requests(&reader));
+        flight_next_request();
+        flight_record_t* event = flight_begin(FLIGHT_REQUEST);
+        event->bytes_in = (got == REQUEST_TOO_LONG) ? 0 : strlen(buffer);
+        flight_commit(event);
+
+        if (got == REQUEST_TOO_LONG) {
+            const char* error_msg = "Error: Request too long\n";
+            log_message(LOG_WARN, "bad_request", "request too long");
+            if (reply_frame(client_fd, FRAME_OUTPUT, error_msg, strlen(error_msg)) == -1 ||
+                reply_end(client_fd, -1, REPLY_ERROR) == -1) {
+                log_errno(LOG_ERROR, "send_failed");
+                break;
+            }
+            continue;
+        }
+
+        // received command -- debug level, the command record below carries the same text
+        log_record_t* rec = log_begin(LOG_DEBUG, "received", 1);
+        if (rec != NULL) {
+            log_str(rec, "cmd", buffer);
+            log_commit(rec);
+        }
+
         // check for exit command
         if (strcmp(buffer, "exit") == 0) {
-            printf("[INFO] Client requested exit.\n");
-            // send empty response to acknowledge exit
-            const char* exit_msg = "";
-            send(client_fd, exit_msg, strlen(exit_msg), 0);
+            log_message(LOG_INFO, "session_close", "client requested exit");
+            // acknowledge exit with an empty reply
+            reply_end(client_fd, 0, REPLY_OK);
             break;  // exit the command loop
         }
-        
-        // display executing message on server console
-        print_executing(buffer);
-        
-        // execute the command and capture its output
-        int success = 0;
-        char* output = execute_command_with_capture(buffer, &success);
-        
-        if (output != NULL) {
-            // command execution completed (successfully or with error)
-            if (success) {
-                // command executed successfully (exit code 0)
-                print_output("Sending output to client:");
-                // display the actual output on server console
-                if (strlen(output) > 0) {
-                    printf("%s", output);
-                    // add newline if output doesn't end with one
-                    if (output[strlen(output) - 1] != '\n') {
-                        printf("\n");
-                    }
-                } else {
-                    // command succeeded but produced no output (e.g., redirected to file)
-                    printf("(empty output)\n");
-                }
-            } else {
-                // command failed (non-zero exit code or didn't execute)
-                // check if it's a "command not found" error by examining the output
-                if (strstr(output, "Command not found") != NULL) {
-                    // display error in the format: [ERROR] Command not found: "commandname"
-                    printf("[ERROR] Command not found: \"%s\"\n", buffer);
-                } else {
-                    // other types of errors (permission denied, file not found, etc.)
-                    printf("[ERROR] Command execution failed\n");
-                }
-                
-                // display that we're sending the error message with opening quote
-                printf("[OUTPUT] Sending error message to client: \"");
-                
-                // display the actual error output (trim newline if present for clean formatting)
-                if (strlen(output) > 0 && output[strlen(output) - 1] == '\n') {
-                    // output has newline - print without it, then add closing quote and newline
-                    printf("%.*s\"\n", (int)(strlen(output) - 1), output);
-                } else {
-                    // output has no newline - print it, then add closing quote and newline
-                    printf("%s\"\n", output);
-                }
+
+        // per-request limits start from the server defaults and can only tighten them
+        request_options_t options;
+        options.limits = server_limits;
+        options.trace = 0;
+        options.time = 0;
+        options.page = 0;
+        char* command = buffer;
+        if (parse_request_options(&command, &options) == -1) {
+            const char* error_msg = "Error: Invalid request options\n";
+            log_message(LOG_WARN, "bad_request", "invalid request options");
+            if (reply_frame(client_fd, FRAME_OUTPUT, error_msg, strlen(error_msg)) == -1 ||
+                reply_end(client_fd, -1, REPLY_ERROR) == -1) {
+                log_errno(LOG_ERROR, "send_failed");
+                break;
+            }
+            continue;
+        }
+
+        // requests the server answers itself (stats, ...)
+        // an unquoted operator would otherwise end up among the builtin's arguments
+        char* args;
+        const server_builtin_t* builtin = find_server_builtin(command, &args);
+        if (builtin != NULL && has_shell_operator(args)) {
+            char error_msg[128];
+            int len = snprintf(error_msg, sizeof(error_msg),
+                               "Error: %s is a server builtin and cannot be piped, redirected or combined with other commands\n",
+                               builtin->name);
+            log_message(LOG_WARN, "bad_request", "shell operator in a server builtin");
+            if (send_text_reply(client_fd, error_msg, (size_t)len, REPLY_ERROR) == -1) {
+                log_errno(LOG_ERROR, "send_failed");
+                break;
+            }
+            continue;
+        }
+        if (builtin != NULL) {
+            if (builtin->handler(client_fd, args, &options, &session) == -1) {
+                log_errno(LOG_ERROR, "send_failed");
+                break;
+            }
+            continue;
+        }
+
+        // "command &" -- the reply is the job number, the command runs on
+        if (is_background_request(command)) {
+            if (start_background_job(client_fd, &session, command, &options.limits) == -1) {
+                log_errno(LOG_ERROR, "send_failed");
+                break;
+            }
+            continue;
+        }
+
+        // execute the command and capture its output -- streamed to the client as it arrives,
+        // unless @page keeps it for a cursor (or -Q 0 turned streaming off)
+        exec_result_t result;
+        spool_t output;
+        output_stream_t stream;
+        int streaming = (options.page == 0 && stream_queue_max > 0);
+        spool_init(&output, &session.budget, options.limits.max_output);
+        if (streaming) start_output_stream(&stream, client_fd);
+        int executed = execute_command_with_capture(command, &options.limits, &session.state, -1,
+                                                    streaming ? &stream : NULL, &output, &result);
+
+        // the rest of a streamed output goes out before anything else -- a client that is gone or stopped
+        // reading (or an output frame cut short) leaves the session nothing it could send
+        double send_start = monotonic_seconds();
+        if (streaming && finish_output_stream(&stream, &output) == -1) {
+            log_errno(LOG_ERROR, (errno == ETIMEDOUT) ? "client_stalled" : "send_failed");
+            spool_free(&output);
+            break;
+        }
+
+        if (executed == 0) {
+            size_t output_len = result.output_len;
+
+            // send the captured output (or error message) back to client, then the status
+            // an empty output is just the end frame -- no filler newline needed to unblock the client
+            // with @page, a long output only up to the end of its first page
+            size_t sent_len = output_len;
+            if (!streaming && reply_output(client_fd, &output, options.page, &sent_len) == -1) {
+                log_errno(LOG_ERROR, "send_failed");
+                spool_free(&output);
+                break;
+            }
+            double send_end = monotonic_seconds();
+            result.timing.phase[PHASE_SEND] = send_end - send_start;
+            result.timing.phase[PHASE_TOTAL] = send_end - received_at;
+            stats_record(&result.timing, result.status);
+            metrics_record_request(&result.timing, result.status);
+
+            // one record per command -- failures are never sampled out
+            log_command(command, &result, &output);
+            if (is_slow_command(&result, queued)) log_slow_command(command, &result, queued);
+
+            // @page -- the rest of a long output stays in a cursor, announced by a trailer below
+            int cursor_id = 0;
+            if (sent_len < output_len &&
+                keep_output_rest(client_fd, &session, command, &output, sent_len, options.page, &cursor_id) == -1) {
+                log_errno(LOG_ERROR, "send_failed");
+                spool_free(&output);
+                break;
             }
-            
-            // send the captured output (or error message) back to client
-            // ssize_t bytes_sent = send(client_fd, output, strlen(output), 0);
-            // if (bytes_sent == -1) {
-            //     perror("Error: send failed");
-            //     free(output);
-            //     break;
-            // }
-
-            // send the captured output (or error message) back to client
-            // if output is empty, send at least a newline so client doesn't hang
-            if (strlen(output) == 0) {
-                // send a single newline for empty output
-                ssize_t bytes_sent = send(client_fd, "\n", 1, 0);
-                if (bytes_sent == -1) {
-                    perror("Error: send failed");
-                    free(output);
+
+            // @trace -- the phase breakdown goes out as a trailer just before the end frame
+            if (options.trace) {
+                char trace[FRAME_TRACE_MAX];
+                int trace_len = timing_format(&result.timing, trace, sizeof(trace));
+                if (reply_frame(client_fd, FRAME_TRACE, trace, (size_t)trace_len) == -1) {
+                    log_errno(LOG_ERROR, "send_failed");
+                    spool_free(&output);
                     break;
                 }
-            } else {
-                // send the actual output
-                ssize_t bytes_sent = send(client_fd, output, strlen(output), 0);
-                if (bytes_sent == -1) {
-                    perror("Error: send failed");
-                    free(output);
+            }
+
+            // @time -- every stage's exit status and resource usage, also a trailer
+            if (options.time) {
+                char usage[FRAME_USAGE_MAX];
+                size_t usage_len = format_usage_report(command, &result.stages, usage, sizeof(usage));
+                if (reply_frame(client_fd, FRAME_USAGE, usage, usage_len) == -1) {
+                    log_errno(LOG_ERROR, "send_failed");
+                    spool_free(&output);
                     break;
                 }
             }
-            
-            // free the dynamically allocated output string
-            free(output);
+
+            // a command list -- every entry's status, skipped ones included, as the last trailer
+            if (result.list_len > 0 && reply_frame(client_fd, FRAME_LIST, result.list, result.list_len) == -1) {
+                log_errno(LOG_ERROR, "send_failed");
+                spool_free(&output);
+                break;
+            }
+
+            // the cursor trailer says where to read on
+            if (cursor_id != 0 && reply_cursor(client_fd, cursor_id, sent_len, output_len) == -1) {
+                log_errno(LOG_ERROR, "send_failed");
+                break;
+            }
+
+            if (reply_end(client_fd, result.exit_code, result.status) == -1) {
+                log_errno(LOG_ERROR, "send_failed");
+                spool_free(&output);
+                break;
+            }
+            PROBE3(reply_sent, client_fd, result.exit_code, output_len);
+            event = flight_begin(FLIGHT_REPLY);
+            event->exit_code = result.exit_code;
+            event->status = (uint16_t)result.status;
+            event->bytes_out = output_len;
+            event->duration_ns = (uint64_t)(result.timing.phase[PHASE_TOTAL] * 1e9);
+            flight_commit(event);
+
+            // free the spooled output -- memory back to the session's budget, spill file closed
+            spool_free(&output);
         } else {
             // memory allocation failed or other critical error
             const char* error_msg = "Error: Server failed to execute command\n";
-            printf("[ERROR] Server failed to execute command\n");
-            print_output("Sending error message to client:");
-            printf("%s", error_msg);
-            send(client_fd, error_msg, strlen(error_msg), 0);
+            rec = log_begin(LOG_ERROR, "command_error", 0);
+            if (rec != NULL) {
+                log_str(rec, "cmd", command);
+                log_commit(rec);
+            }
+            if (reply_frame(client_fd, FRAME_OUTPUT, error_msg, strlen(error_msg)) == -1 ||
+                reply_end(client_fd, -1, REPLY_ERROR) == -1) {
+                log_errno(LOG_ERROR, "send_failed");
+                break;
+            }
         }
     }
+
+    // jobs still running die with the session -- nobody could fetch their output
+    destroy_session_jobs(jobs);
+    for (int i = 0; i < CURSORS_MAX; i++) {
+        if (session.cursors[i].id != 0) close_output_cursor(&session.cursors[i]);
+    }
+    free_session_state(&session.state);
 }
 
 
+// logging helpers
+// one record per finished command -- exit code, status, output size (or body with -b), spilled bytes and latency
+// successful commands are sampled (-s), anything else is always logged at warn level
+void log_command(const char* command, const exec_result_t* result, const spool_t* output) {
+    int ok = (result->status == REPLY_OK);
+    log_record_t* rec = log_begin(ok ? LOG_INFO : LOG_WARN, "command", ok);
+    if (rec == NULL) return;
+
+    log_str(rec, "cmd", command);
+    log_int(rec, "exit", result->exit_code);
+    log_str(rec, "status", reply_status_name(result->status));
+    log_int(rec, "output_bytes", (long long)result->output_len);
+    log_double(rec, "ms", result->timing.phase[PHASE_TOTAL] * 1e3);
+    // a body is what the spool holds in memory -- a spilled tail is only counted
+    if (output->file_len > 0) log_int(rec, "spilled_bytes", (long long)output->file_len);
+    if (log_output_mode() == LOG_OUTPUT_BODY) log_bytes(rec, "output", output->data, output->mem_len);
+    log_commit(rec);
+}
 
+// true if a command crossed a slow-log threshold (-L latency including queueing, -O output size)
+int is_slow_command(const exec_result_t* result, double queued) {
+    double latency = queued + result->timing.phase[PHASE_TOTAL];
+    if (slow_latency_sec > 0 && latency >= slow_latency_sec) return 1;
+    if (slow_output > 0 && result->output_len >= slow_output) return 1;
+    return 0;
+}
 
-//
+// slow-command record -- never sampled, carries everything needed to find out what hurt:
+// the command, where its time went (queued, running, sending) and each stage's argv, pid, exit code and rusage
+void log_slow_command(const char* command, const exec_result_t* result, double queued) {
+    log_record_t* rec = log_begin(LOG_WARN, "slow_command", 0);
+    if (rec == NULL) return;
+
+    const request_timing_t* timing = &result->timing;
+    double running = timing->phase[PHASE_FORK] + timing->phase[PHASE_CAPTURE] + timing->phase[PHASE_REAP];
+    log_str(rec, "cmd", command);
+    log_int(rec, "exit", result->exit_code);
+    log_str(rec, "status", reply_status_name(result->status));
+    log_int(rec, "output_bytes", (long long)result->output_len);
+    log_double(rec, "queued_ms", queued * 1e3);
+    log_double(rec, "running_ms", running * 1e3);
+    log_double(rec, "sending_ms", timing->phase[PHASE_SEND] * 1e3);
+    log_double(rec, "total_ms", (queued + timing->phase[PHASE_TOTAL]) * 1e3);
+
+    const pipeline_report_t* stages = &result->stages;
+    int reported = (stages->num_stages < PIPELINE_REPORT_STAGES) ? stages->num_stages : PIPELINE_REPORT_STAGES;
+    stage_argv_t argv[PIPELINE_REPORT_STAGES];
+    int described = describe_stages(command, argv, reported);
+
+    log_array_begin(rec, "stages");
+    for (int i = 0; i < reported; i++) {
+        const pipeline_stage_t* stage = &stages->stages[i];
+        log_object_begin(rec, NULL);
+        if (i < described) log_str(rec, "argv", argv[i]);
+
+        const struct rusage* usage = &stage->usage;
+        log_int(rec, "pid", stage->pid);
+        log_int(rec, "exit", stage->exit_code);
+        log_double(rec, "user_ms", (double)usage->ru_utime.tv_sec * 1e3 + (double)usage->ru_utime.tv_usec / 1e3);
+        log_double(rec, "sys_ms", (double)usage->ru_stime.tv_sec * 1e3 + (double)usage->ru_stime.tv_usec / 1e3);
+        log_int(rec, "maxrss_kb", usage->ru_maxrss);
+        log_int(rec, "minflt", usage->ru_minflt);
+        log_int(rec, "majflt", usage->ru_majflt);
+        log_int(rec, "inblock", usage->ru_inblock);
+        log_int(rec, "oublock", usage->ru_oublock);
+        log_int(rec, "nvcsw", usage->ru_nvcsw);
+        log_int(rec, "nivcsw", usage->ru_nivcsw);
+        log_object_end(rec);
+    }
+    log_array_end(rec);
+    if (stages->num_stages > reported) log_int(rec, "stages_not_reported", stages->num_stages - reported);
+    log_commit(rec);
+}
+
+// records a failed system call with its errno text
+void log_errno(log_level_t level, const char* event) {
+    char text[128];
+    int saved = errno;
+    log_record_t* rec = log_begin(level, event, 0);
+    if (rec == NULL) return;
+    log_str(rec, "error", strerror_r(saved, text, sizeof(text)));
+    log_commit(rec);
+}
+
+
+// per-stage reports
+// fills argv[i] with the space-separated argv of stage i, for up to count stages
+// the child parsed the command, the server parses it again here -- only reported commands pay for that
+// returns the number of stages filled, 0 if the command does not parse
+int describe_stages(const char* command, stage_argv_t* argv, int count) {
+    if (count <= 0) return 0;
+    char* cmd_copy = strdup(command);
+    if (cmd_copy == NULL) return 0;
+    pipeline_t* pipeline = parse_pipeline(cmd_copy);
+    free(cmd_copy);
+    if (pipeline == NULL) return 0;
+
+    int described = (pipeline->num_commands < count) ? pipeline->num_commands : count;
+    for (int i = 0; i < described; i++) {
+        size_t used = 0;
+        argv[i][0] = '\0';
+        for (char** arg = pipeline->commands[i]->argv; arg != NULL && *arg != NULL; arg++) {
+            int n = snprintf(argv[i] + used, STAGE_ARGV_MAX - used, "%s%s", (used > 0) ? " " : "", *arg);
+            if (n < 0 || (size_t)n >= STAGE_ARGV_MAX - used) break;
+            used += (size_t)n;
+        }
+    }
+    free_pipeline(pipeline);
+    return described;
+}
 
+// the FRAME_USAGE payload of @time -- one line per stage, in pipeline order, e.g.
+//   pid=4242 exit=0 user_ms=85.120 sys_ms=3.210 maxrss_kb=3812 minflt=97 majflt=0 nvcsw=2 nivcsw=131 cmd=grep x
+// cmd comes last so it can hold spaces; a pipeline longer than the report ends with a not_reported=<n> line
+// returns the payload length -- lines that do not fit are left out
+size_t format_usage_report(const char* command, const pipeline_report_t* stages, char* buf, size_t size) {
+    int reported = (stages->num_stages < PIPELINE_REPORT_STAGES) ? stages->num_stages : PIPELINE_REPORT_STAGES;
+    stage_argv_t argv[PIPELINE_REPORT_STAGES];
+    int described = describe_stages(command, argv, reported);
+
+    size_t used = 0;
+    for (int i = 0; i <= reported; i++) {
+        int n;
+        if (i == reported) {
+            if (stages->num_stages <= reported) break;
+            n = snprintf(buf + used, size - used, "not_reported=%d\n", stages->num_stages - reported);
+        } else {
+            const pipeline_stage_t* stage = &stages->stages[i];
+            const struct rusage* usage = &stage->usage;
+            n = snprintf(buf + used, size - used,
+                         "pid=%d exit=%d user_ms=%.3f sys_ms=%.3f maxrss_kb=%ld minflt=%ld majflt=%ld nvcsw=%ld nivcsw=%ld cmd=%s\n",
+                         (int)stage->pid, stage->exit_code,
+                         (double)usage->ru_utime.tv_sec * 1e3 + (double)usage->ru_utime.tv_usec / 1e3,
+                         (double)usage->ru_stime.tv_sec * 1e3 + (double)usage->ru_stime.tv_usec / 1e3,
+                         usage->ru_maxrss, usage->ru_minflt, usage->ru_majflt, usage->ru_nvcsw, usage->ru_nivcsw,
+                         (i < described) ? argv[i] : "");
+        }
+        if (n < 0 || (size_t)n >= size - used) break;
+        used += (size_t)n;
+    }
+    return used;
+}
+
+// the FRAME_LIST payload of a command list -- one line per top-level entry, in the order written, e.g.
+//   exit=0 cmd=cd /tmp
+//   exit=1 cmd=grep -q x log
+//   exit=skipped cmd=make install
+// a ( ) group is one entry; entries past the payload limit are counted in a final not_reported=<n> line
+// returns the payload length
+#define LIST_REPORT_RESERVE 32    // kept free for the not_reported line
+size_t format_list_report(const command_list_t* list, char* buf, size_t size) {
+    size_t used = 0;
+    for (int i = 0; i < list->num_entries; i++) {
+        const list_entry_t* entry = &list->entries[i];
+        char code[16] = "skipped";
+        if (entry->ran) snprintf(code, sizeof(code), "%d", entry->exit_code);
+        int n = snprintf(buf + used, size - LIST_REPORT_RESERVE - used, "exit=%s cmd=%s\n", code, entry->text);
+        if (n < 0 || (size_t)n >= size - LIST_REPORT_RESERVE - used) {
+            n = snprintf(buf + used, size - used, "not_reported=%d\n", list->num_entries - i);
+            return (n < 0) ? used : used + (size_t)n;
+        }
+        used += (size_t)n;
+    }
+    return used;
+}
 
 
+// request line reading
+// returns the next newline-terminated request in line (newline and any '\r' removed)
+// one recv() may carry several pipelined requests -- the rest stays in the reader for later calls
+// returns 1 for a request, REQUEST_TOO_LONG for a line that does not fit, 0 on disconnect, -1 on error,
+// REQUEST_NOTIFY if notify_fd (-1 for none) became readable while no complete request was buffered
+int read_request_line(int client_fd, int notify_fd, request_reader_t* reader, char* line) {
+    while (1) {
+        char* newline = memchr(reader->data, '\n', reader->len);
+        if (newline != NULL) {
+            size_t line_len = (size_t)(newline - reader->data);
+            int was_discarding = reader->discarding;
+            if (!was_discarding) {
+                memcpy(line, reader->data, line_len);
+                if (line_len > 0 && line[line_len - 1] == '\r') line_len--;
+                line[line_len] = '\0';
+            }
+
+            // drop the line (and its newline) from the buffer
+            reader->len -= line_len + 1;
+            memmove(reader->data, newline + 1, reader->len);
+            reader->discarding = 0;
+            return was_discarding ? REQUEST_TOO_LONG : 1;
+        }
+
+        if (reader->len == sizeof(reader->data)) {
+            // no newline in a full buffer -- drop what we have and skip to the next newline
+            reader->len = 0;
+            reader->discarding = 1;
+        }
+
+        // wait for the client or a notification, whichever comes first
+        if (notify_fd >= 0) {
+            struct pollfd fds[2] = { { client_fd, POLLIN, 0 }, { notify_fd, POLLIN, 0 } };
+            if (poll(fds, 2, -1) == -1) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            if (fds[1].revents != 0 && fds[0].revents == 0) return REQUEST_NOTIFY;
+        }
 
+        // recv() blocks until data is available or connection closes
+        ssize_t bytes_received = recv(client_fd, reader->data + reader->len, sizeof(reader->data) - reader->len, 0);
+        if (bytes_received == -1 && errno == EINTR) continue;
+        if (bytes_received <= 0) return (int)bytes_received;
+        reader->len += (size_t)bytes_received;
+        reader->recv_at = monotonic_seconds();
+        metrics_add(METRIC_BYTES_IN, (uint64_t)bytes_received);
+    }
+}
 
-// server console output formatting functions
 
-// format and display messages on the server console
-// match the exact format shown in the assignment screenshots
-void print_info(const char* message) {
-    printf("[INFO] %s\n", message);
-    fflush(stdout);  // ensure output is displayed immediately
+// server builtins
+// finds the builtin named by the first word of command -- args points at the rest of the line
+// returns NULL when the request is an ordinary command -- "cd dir && make" is one, the cd applies to it alone
+const server_builtin_t* find_server_builtin(char* command, char** args) {
+    // the name ends at an operator too -- "wait; echo hi" is the wait builtin in a list, not a command "wait;"
+    size_t name_len = strcspn(command, " \t;&|<>()");
+    for (size_t i = 0; i < sizeof(server_builtins) / sizeof(server_builtins[0]); i++) {
+        if (strlen(server_builtins[i].name) == name_len && strncmp(command, server_builtins[i].name, name_len) == 0) {
+            if (server_builtins[i].simple_only && strpbrk(command, ";&|<>()") != NULL) return NULL;
+            *args = trim_whitespace(command + name_len);
+            return &server_builtins[i];
+        }
+    }
+    return NULL;
 }
 
-void print_received(const char* command) {
-    printf("[RECEIVED] Received command: \"%s\" from client.\n", command);
-    fflush(stdout);
+// 1 if text holds ; & | < > ( or ) outside quotes (and not escaped with a backslash) -- the shell would treat it
+// as an operator, so a builtin taking text as its arguments would run something other than what was typed
+int has_shell_operator(const char* text) {
+    char quote = '\0';
+    for (const char* p = text; *p; p++) {
+        if (quote) {
+            if (*p == quote) quote = '\0';
+            else if (*p == '\\' && quote == '"' && p[1]) p++;
+            continue;
+        }
+        if (*p == '\\' && p[1]) p++;
+        else if (*p == '\'' || *p == '"') quote = *p;
+        else if (strchr(";&|<>()", *p) != NULL) return 1;
+    }
+    return 0;
 }
 
-void print_executing(const char* command) {
-    printf("[EXECUTING] Executing command: \"%s\"\n", command);
-    fflush(stdout);
+// stats -- per-phase latency table for every command since start (or the last "stats reset")
+int builtin_stats(int client_fd, char* args, const request_options_t* options, session_context_t* session) {
+    (void)options;
+    (void)session;
+    if (strcmp(args, "reset") == 0) {
+        stats_reset();
+        log_message(LOG_INFO, "stats_reset", "statistics reset");
+        return send_text_reply(client_fd, "", 0, REPLY_OK);
+    }
+    if (*args != '\0') {
+        const char* usage = "Usage: stats [reset]\n";
+        return send_text_reply(client_fd, usage, strlen(usage), REPLY_FAILED);
+    }
+
+    size_t len;
+    char* report = stats_report(&len);
+    if (report == NULL) {
+        const char* error_msg = "Error: Server failed to build statistics\n";
+        return send_text_reply(client_fd, error_msg, strlen(error_msg), REPLY_ERROR);
+    }
+    int sent = send_text_reply(client_fd, report, len, REPLY_OK);
+    free(report);
+    return sent;
 }
-void print_output(const char* message) {
-    printf("[OUTPUT] %s\n", message);
-    fflush(stdout);
+
+// parallel -- runs one command template over many arguments through a bounded pool of worker threads
+// "parallel [-j jobs] template ::: arg arg ..." -- every {} in the template becomes the argument,
+// a template without {} gets it appended; arguments are split at whitespace
+// each job is an ordinary command (limits, stats, log record); outputs go out in argument order, each
+// after a "[job k/n exit=N status=name] command" line, and the reply's exit code is the number of failed jobs
+int builtin_parallel(int client_fd, char* args, const request_options_t* options, session_context_t* session) {
+    const char* usage = "Usage: parallel [-j jobs] command [{}] ::: arg ...\n";
+
+    // "-j N" or "-jN" in front of the template
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (strncmp(args, "-j", 2) == 0) {
+        char* value = args + 2;
+        while (*value == ' ' || *value == '\t') value++;
+        char* end;
+        workers = strtol(value, &end, 10);
+        if (end == value || (*end != ' ' && *end != '\t') || workers < 1) {
+            return send_text_reply(client_fd, usage, strlen(usage), REPLY_FAILED);
+        }
+        args = trim_whitespace(end);
+    }
+    if (workers < 1) workers = 1;
+    if (workers > PARALLEL_WORKERS_MAX) workers = PARALLEL_WORKERS_MAX;
+
+    // template ::: arguments
+    char* separator = strstr(args, " " PARALLEL_SEPARATOR);
+    if (separator == NULL) return send_text_reply(client_fd, usage, strlen(usage), REPLY_FAILED);
+    *separator = '\0';
+    char* template = trim_whitespace(args);
+    char* list = separator + 1 + strlen(PARALLEL_SEPARATOR);
+    if (*template == '\0' || (*list != '\0' && *list != ' ' && *list != '\t')) {
+        return send_text_reply(client_fd, usage, strlen(usage), REPLY_FAILED);
+    }
+
+    char* words[BUFFER_SIZE / 2];
+    int num_jobs = 0;
+    char* save = NULL;
+    for (char* word = strtok_r(list, " \t", &save); word != NULL; word = strtok_r(NULL, " \t", &save)) {
+        words[num_jobs++] = word;
+    }
+    if (num_jobs == 0) return send_text_reply(client_fd, usage, strlen(usage), REPLY_FAILED);
+    if (workers > num_jobs) workers = num_jobs;
+
+    parallel_run_t run;
+    run.jobs = calloc((size_t)num_jobs, sizeof(parallel_job_t));
+    if (run.jobs == NULL) {
+        const char* error_msg = "Error: Server failed to start parallel jobs\n";
+        return send_text_reply(client_fd, error_msg, strlen(error_msg), REPLY_ERROR);
+    }
+    for (int k = 0; k < num_jobs; k++) {
+        run.jobs[k].command = expand_parallel_template(template, words[k]);
+        if (run.jobs[k].command == NULL) {
+            const char* error_msg = "Error: parallel command too long\n";
+            for (int j = 0; j < k; j++) free(run.jobs[j].command);
+            free(run.jobs);
+            return send_text_reply(client_fd, error_msg, strlen(error_msg), REPLY_FAILED);
+        }
+        spool_init(&run.jobs[k].output, &session->budget, options->limits.max_output);
+    }
+    run.num_jobs = num_jobs;
+    run.next = 0;
+    run.sent = 0;
+    run.window = 2 * (int)workers;
+    run.cancelled = 0;
+    run.limits = &options->limits;
+    run.state = &session->state;
+    run.budget = &session->budget;
+    run.session = log_session();
+    pthread_mutex_init(&run.lock, NULL);
+    pthread_cond_init(&run.changed, NULL);
+
+    pthread_t threads[PARALLEL_WORKERS_MAX];
+    int started = 0;
+    for (int w = 0; w < workers; w++) {
+        if (pthread_create(&threads[started], NULL, parallel_worker, &run) == 0) started++;
+    }
+
+    // replies in argument order -- job k goes out once it and every job before it has finished
+    int sent_ok = (started > 0);
+    int failed = 0;
+    for (int k = 0; k < num_jobs && sent_ok; k++) {
+        parallel_job_t* job = &run.jobs[k];
+        pthread_mutex_lock(&run.lock);
+        while (!job->done) pthread_cond_wait(&run.changed, &run.lock);
+        pthread_mutex_unlock(&run.lock);
+
+        char header[FRAME_HEADER_MAX + SPAWN_COMMAND_MAX];
+        int exit_code = job->launched ? job->result.exit_code : -1;
+        reply_status_t status = job->launched ? job->result.status : REPLY_ERROR;
+        int header_len = snprintf(header, sizeof(header), "[job %d/%d exit=%d status=%s] %s\n", k + 1, num_jobs,
+                                  exit_code, reply_status_name(status), job->command);
+        if (status != REPLY_OK) failed++;
+        sent_ok = (reply_frame(client_fd, FRAME_OUTPUT, header, (size_t)header_len) == 0);
+        if (sent_ok && !job->launched) {
+            const char* error_msg = "Error: Server failed to execute command\n";
+            sent_ok = (reply_frame(client_fd, FRAME_OUTPUT, error_msg, strlen(error_msg)) == 0);
+        } else if (sent_ok && job->result.output_len > 0) {
+            sent_ok = (reply_spool(client_fd, &job->output, 0, job->result.output_len) == 0);
+        }
+        spool_free(&job->output);
+
+        pthread_mutex_lock(&run.lock);
+        run.sent = k + 1;
+        pthread_cond_broadcast(&run.changed);
+        pthread_mutex_unlock(&run.lock);
+    }
+
+    // a broken session starts no further jobs -- the ones running finish and are dropped
+    pthread_mutex_lock(&run.lock);
+    run.cancelled = 1;
+    pthread_cond_broadcast(&run.changed);
+    pthread_mutex_unlock(&run.lock);
+    for (int w = 0; w < started; w++) pthread_join(threads[w], NULL);
+    for (int k = 0; k < num_jobs; k++) {
+        free(run.jobs[k].command);
+        spool_free(&run.jobs[k].output);
+    }
+    free(run.jobs);
+    pthread_mutex_destroy(&run.lock);
+    pthread_cond_destroy(&run.changed);
+
+    if (started == 0) {
+        const char* error_msg = "Error: Server failed to start parallel jobs\n";
+        return send_text_reply(client_fd, error_msg, strlen(error_msg), REPLY_ERROR);
+    }
+    if (!sent_ok) return -1;
+    return reply_end(client_fd, (failed > PARALLEL_EXIT_MAX) ? PARALLEL_EXIT_MAX : failed,
+                     (failed == 0) ? REPLY_OK : REPLY_FAILED);
+}
+
+// worker thread of a parallel request -- runs jobs in order until none are left or the request is cancelled
+// stays at most run->window jobs ahead of what the session has sent, so finished outputs waiting for a slow
+// earlier job cannot pile up
+void* parallel_worker(void* arg) {
+    parallel_run_t* run = arg;
+    log_set_session(run->session);
+    flight_set_session(run->session);
+
+    pthread_mutex_lock(&run->lock);
+    while (!run->cancelled && run->next < run->num_jobs) {
+        if (run->next >= run->sent + run->window) {
+            pthread_cond_wait(&run->changed, &run->lock);
+            continue;
+        }
+        parallel_job_t* job = &run->jobs[run->next++];
+        pthread_mutex_unlock(&run->lock);
+
+        double start = monotonic_seconds();
+        job->launched = (execute_command_with_capture(job->command, run->limits, run->state, -1, NULL,
+                                                     &job->output, &job->result) == 0);
+        if (job->launched) {
+            job->result.timing.phase[PHASE_TOTAL] = monotonic_seconds() - start;
+            stats_record(&job->result.timing, job->result.status);
+            metrics_record_request(&job->result.timing, job->result.status);
+            log_command(job->command, &job->result, &job->output);
+        }
+
+        pthread_mutex_lock(&run->lock);
+        job->done = 1;
+        pthread_cond_broadcast(&run->changed);
+    }
+    pthread_mutex_unlock(&run->lock);
+
+    flight_thread_done();
+    metrics_thread_done();
+    return NULL;
+}
+
+// the command of one job -- every {} in template replaced by arg, or arg appended if there is none
+// returns a new string (caller frees), NULL if it would not fit in a spawn request
+char* expand_parallel_template(const char* template, const char* arg) {
+    size_t arg_len = strlen(arg);
+    size_t placeholders = 0;
+    for (const char* p = template; (p = strstr(p, PARALLEL_PLACEHOLDER)) != NULL; p += 2) placeholders++;
+    size_t len = strlen(template) - 2 * placeholders + ((placeholders > 0) ? placeholders * arg_len : arg_len + 1);
+    if (len >= SPAWN_COMMAND_MAX) return NULL;
+
+    char* command = malloc(len + 1);
+    if (command == NULL) return NULL;
+    char* out = command;
+    const char* p = template;
+    for (const char* hole; (hole = strstr(p, PARALLEL_PLACEHOLDER)) != NULL; p = hole + 2) {
+        memcpy(out, p, (size_t)(hole - p));
+        out += hole - p;
+        memcpy(out, arg, arg_len);
+        out += arg_len;
+    }
+    out += sprintf(out, "%s", p);
+    if (placeholders == 0) sprintf(out, " %s", arg);
+    return command;
+}
+
+// background jobs
+// the session's job table -- NULL if it could not be set up
+session_jobs_t* create_session_jobs(spool_budget_t* budget) {
+    session_jobs_t* jobs = calloc(1, sizeof(session_jobs_t));
+    if (jobs == NULL) return NULL;
+    // the notify pipe never blocks a job thread, one pending byte is enough to wake the session
+    if (pipe2(jobs->notify_pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+        free(jobs);
+        return NULL;
+    }
+    if (pipe2(jobs->cancel_pipe, O_CLOEXEC) == -1) {
+        close(jobs->notify_pipe[0]);
+        close(jobs->notify_pipe[1]);
+        free(jobs);
+        return NULL;
+    }
+    jobs->session = log_session();
+    jobs->budget = budget;
+    pthread_mutex_init(&jobs->lock, NULL);
+    pthread_cond_init(&jobs->changed, NULL);
+    return jobs;
+}
+
+// ends the session's jobs -- closing the cancel pipe kills the ones still running, then every job thread is joined
+void destroy_session_jobs(session_jobs_t* jobs) {
+    if (jobs == NULL) return;
+    close(jobs->cancel_pipe[1]);
+    for (int i = 0; i < JOBS_MAX; i++) {
+        if (jobs->jobs[i].id != 0) release_background_job(&jobs->jobs[i]);
+    }
+    close(jobs->cancel_pipe[0]);
+    close(jobs->notify_pipe[0]);
+    close(jobs->notify_pipe[1]);
+    pthread_mutex_destroy(&jobs->lock);
+    pthread_cond_destroy(&jobs->changed);
+    free(jobs);
+}
+
+// true if command ends in a lone '&' -- which is then stripped, with the blanks around it
+// "a && b" is a command list and "a \&" an escaped argument, neither is a job
+int is_background_request(char* command) {
+    size_t len = strlen(command);
+    while (len > 0 && (command[len - 1] == ' ' || command[len - 1] == '\t')) len--;
+    if (len == 0 || command[len - 1] != '&') return 0;
+    if (len >= 2 && (command[len - 2] == '&' || command[len - 2] == '\\')) return 0;
+    len--;
+    while (len > 0 && (command[len - 1] == ' ' || command[len - 1] == '\t')) len--;
+    command[len] = '\0';
+    return 1;
+}
+
+// starts command as a background job of the session and replies with its number, "[1] command"
+// the job's output counts against the session's memory budget until fetched -- past it, it waits in a spill file
+// returns -1 only if sending the reply failed
+int start_background_job(int client_fd, session_context_t* session, const char* command, const exec_limits_t* limits) {
+    session_jobs_t* jobs = session->jobs;
+    if (*command == '\0') {
+        const char* error_msg = "Error: Missing command before '&'\n";
+        return send_text_reply(client_fd, error_msg, strlen(error_msg), REPLY_FAILED);
+    }
+    if (jobs == NULL) {
+        const char* error_msg = "Error: Background jobs are unavailable\n";
+        return send_text_reply(client_fd, error_msg, strlen(error_msg), REPLY_ERROR);
+    }
+
+    // slots are taken and freed by the session thread only -- no lock needed to find one
+    background_job_t* job = NULL;
+    for (int i = 0; i < JOBS_MAX && job == NULL; i++) {
+        if (jobs->jobs[i].id == 0) job = &jobs->jobs[i];
+    }
+    if (job == NULL) {
+        char error_msg[128];
+        int len = snprintf(error_msg, sizeof(error_msg), "Error: Too many background jobs (%d) -- fetch finished ones first\n", JOBS_MAX);
+        return send_text_reply(client_fd, error_msg, (size_t)len, REPLY_ERROR);
+    }
+
+    job->command = strdup(command);
+    job->limits = *limits;
+    spool_init(&job->output, jobs->budget, limits->max_output);
+    job->launched = 0;
+    job->started = monotonic_seconds();
+    job->done = 0;
+    job->notified = 0;
+    job->table = jobs;
+    // a cd or export after this request does not move the job
+    int copied = copy_session_state(&session->state, &job->state);
+    if (job->command == NULL || copied == -1 || pthread_create(&job->thread, NULL, background_job_thread, job) != 0) {
+        const char* error_msg = "Error: Server failed to start background job\n";
+        free(job->command);
+        job->command = NULL;
+        if (copied == 0) free_session_state(&job->state);
+        return send_text_reply(client_fd, error_msg, strlen(error_msg), REPLY_ERROR);
+    }
+    job->id = ++jobs->next_id;
+
+    log_record_t* rec = log_begin(LOG_INFO, "job_start", 1);
+    if (rec != NULL) {
+        log_int(rec, "job", job->id);
+        log_str(rec, "cmd", job->command);
+        log_commit(rec);
+    }
+
+    char reply[BUFFER_SIZE + 32];
+    int len = snprintf(reply, sizeof(reply), "[%d] %s\n", job->id, job->command);
+    return send_text_reply(client_fd, reply, (size_t)len, REPLY_OK);
+}
+
+// thread of one background job -- runs the command, records it like any other, then wakes the session
+void* background_job_thread(void* arg) {
+    background_job_t* job = arg;
+    session_jobs_t* jobs = job->table;
+    log_set_session(jobs->session);
+    flight_set_session(jobs->session);
+
+    // the session thread looks at the output and result only once done is set
+    exec_result_t result;
+    double start = monotonic_seconds();
+    int launched = (execute_command_with_capture(job->command, &job->limits, &job->state, jobs->cancel_pipe[0], NULL,
+                                                &job->output, &result) == 0);
+    if (launched) {
+        result.timing.phase[PHASE_TOTAL] = monotonic_seconds() - start;
+        stats_record(&result.timing, result.status);
+        metrics_record_request(&result.timing, result.status);
+        log_command(job->command, &result, &job->output);
+    } else {
+        log_record_t* rec = log_begin(LOG_ERROR, "command_error", 0);
+        if (rec != NULL) {
+            log_str(rec, "cmd", job->command);
+            log_commit(rec);
+        }
+    }
+
+    pthread_mutex_lock(&jobs->lock);
+    job->result = result;
+    job->launched = launched;
+    job->done = 1;
+    pthread_cond_broadcast(&jobs->changed);
+    pthread_mutex_unlock(&jobs->lock);
+    if (write(jobs->notify_pipe[1], "", 1) == -1) {
+        // pipe full -- the session has a wake-up pending already
+    }
+
+    flight_thread_done();
+    metrics_thread_done();
+    return NULL;
+}
+
+// sends a FRAME_NOTICE for every job that finished since the last call -- returns -1 if sending failed
+int send_job_notices(int client_fd, session_jobs_t* jobs) {
+    char drain[64];
+    while (read(jobs->notify_pipe[0], drain, sizeof(drain)) > 0) {
+        // every finished job is found by the scan below, however many bytes it took to wake us
+    }
+
+    for (int i = 0; i < JOBS_MAX; i++) {
+        background_job_t* job = &jobs->jobs[i];
+        if (job->id == 0 || job->notified) continue;
+        pthread_mutex_lock(&jobs->lock);
+        int done = job->done;
+        pthread_mutex_unlock(&jobs->lock);
+        if (!done) continue;
+
+        char line[BUFFER_SIZE + 128];
+        int len = format_job_line(job, line, sizeof(line));
+        job->notified = 1;
+        // the notice is the job line without its newline
+        if (reply_frame(client_fd, FRAME_NOTICE, line, (size_t)len - 1) == -1) return -1;
+    }
+    return 0;
+}
+
+// the job named by text -- "3" or "%3"; NULL if there is no such job
+background_job_t* find_background_job(session_jobs_t* jobs, const char* text) {
+    if (*text == '%') text++;
+    char* end;
+    long id = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || id <= 0) return NULL;
+    for (int i = 0; i < JOBS_MAX; i++) {
+        if (jobs->jobs[i].id == id) return &jobs->jobs[i];
+    }
+    return NULL;
+}
+
+// one line describing a job, newline included -- for jobs, wait and (without the newline) completion notices
+//   [1] running seconds=12.5 cmd=make -j4
+//   [2] done exit=0 status=ok output_bytes=5120 cmd=cp -r src dst
+// returns the length -- a command too long for buf is cut
+int format_job_line(const background_job_t* job, char* buf, size_t size) {
+    pthread_mutex_lock(&job->table->lock);
+    int done = job->done;
+    pthread_mutex_unlock(&job->table->lock);
+
+    int len;
+    if (!done) {
+        len = snprintf(buf, size, "[%d] running seconds=%.1f cmd=%s\n", job->id,
+                       monotonic_seconds() - job->started, job->command);
+    } else {
+        int started = job->launched;
+        len = snprintf(buf, size, "[%d] done exit=%d status=%s output_bytes=%zu cmd=%s\n", job->id,
+                       started ? job->result.exit_code : -1, reply_status_name(started ? job->result.status : REPLY_ERROR),
+                       started ? job->result.output_len : 0, job->command);
+    }
+    return (len < 0) ? 0 : ((size_t)len < size) ? len : (int)size - 1;
+}
+
+// joins a job's thread and frees its slot -- the job is done, or the cancel pipe is closed
+void release_background_job(background_job_t* job) {
+    pthread_join(job->thread, NULL);
+    free(job->command);
+    spool_free(&job->output);
+    free_session_state(&job->state);
+    job->command = NULL;
+    job->id = 0;
+}
+
+// jobs -- every background job of the session, running or finished and not yet fetched
+int builtin_jobs(int client_fd, char* args, const request_options_t* options, session_context_t* session) {
+    (void)options;
+    session_jobs_t* jobs = session->jobs;
+    if (*args != '\0') {
+        const char* usage = "Usage: jobs\n";
+        return send_text_reply(client_fd, usage, strlen(usage), REPLY_FAILED);
+    }
+    if (jobs == NULL) return send_text_reply(client_fd, "", 0, REPLY_OK);
+
+    // in job number order -- slots are reused, so their order is not
+    background_job_t* sorted[JOBS_MAX];
+    int count = 0;
+    for (int i = 0; i < JOBS_MAX; i++) {
+        if (jobs->jobs[i].id == 0) continue;
+        int k = count++;
+        while (k > 0 && sorted[k - 1]->id > jobs->jobs[i].id) {
+            sorted[k] = sorted[k - 1];
+            k--;
+        }
+        sorted[k] = &jobs->jobs[i];
+    }
+
+    char* text = malloc((size_t)JOBS_MAX * (BUFFER_SIZE + 128));
+    if (text == NULL) {
+        const char* error_msg = "Error: Server failed to list jobs\n";
+        return send_text_reply(client_fd, error_msg, strlen(error_msg), REPLY_ERROR);
+    }
+    size_t used = 0;
+    for (int k = 0; k < count; k++) used += (size_t)format_job_line(sorted[k], text + used, BUFFER_SIZE + 128);
+    int sent = send_text_reply(client_fd, text, used, REPLY_OK);
+    free(text);
+    return sent;
+}
+
+// wait [job] -- blocks until the job (or every job) is done, then shows how it ended
+// with a job, the reply carries that job's exit code and status; without, it is always ok
+int builtin_wait(int client_fd, char* args, const request_options_t* options, session_context_t* session) {
+    (void)options;
+    session_jobs_t* jobs = session->jobs;
+    background_job_t* target = NULL;
+    if (*args != '\0') {
+        target = (jobs != NULL) ? find_background_job(jobs, args) : NULL;
+        if (target == NULL) {
+            char error_msg[BUFFER_SIZE + 32];
+            int len = snprintf(error_msg, sizeof(error_msg), "wait: no such job: %s\n", args);
+            return send_text_reply(client_fd, error_msg, (size_t)len, REPLY_FAILED);
+        }
+    }
+    if (jobs == NULL) return send_text_reply(client_fd, "", 0, REPLY_OK);
+
+    pthread_mutex_lock(&jobs->lock);
+    for (int i = 0; i < JOBS_MAX; i++) {
+        background_job_t* job = &jobs->jobs[i];
+        if (job->id == 0 || (target != NULL && job != target)) continue;
+        while (!job->done) pthread_cond_wait(&jobs->changed, &jobs->lock);
+    }
+    pthread_mutex_unlock(&jobs->lock);
+
+    // the reply says how each job ended -- no separate notice for them
+    char* text = malloc((size_t)JOBS_MAX * (BUFFER_SIZE + 128));
+    if (text == NULL) {
+        const char* error_msg = "Error: Server failed to list jobs\n";
+        return send_text_reply(client_fd, error_msg, strlen(error_msg), REPLY_ERROR);
+    }
+    size_t used = 0;
+    for (int i = 0; i < JOBS_MAX; i++) {
+        background_job_t* job = &jobs->jobs[i];
+        if (job->id == 0 || (target != NULL && job != target)) continue;
+        used += (size_t)format_job_line(job, text + used, BUFFER_SIZE + 128);
+        job->notified = 1;
+    }
+    int sent;
+    if (target == NULL) {
+        sent = send_text_reply(client_fd, text, used, REPLY_OK);
+    } else if (!target->launched) {
+        sent = send_text_reply(client_fd, text, used, REPLY_ERROR);
+    } else {
+        sent = reply_frame(client_fd, FRAME_OUTPUT, text, used);
+        if (sent == 0) sent = reply_end(client_fd, target->result.exit_code, target->result.status);
+    }
+    free(text);
+    return sent;
+}
+
+// fetch job -- the spooled output of a finished job, with the job's own exit code and status; frees the job
+// with @page, a long output is paged like a command's -- the rest moves from the job to a cursor
+int builtin_fetch(int client_fd, char* args, const request_options_t* options, session_context_t* session) {
+    session_jobs_t* jobs = session->jobs;
+    if (*args == '\0') {
+        const char* usage = "Usage: fetch job\n";
+        return send_text_reply(client_fd, usage, strlen(usage), REPLY_FAILED);
+    }
+    background_job_t* job = (jobs != NULL) ? find_background_job(jobs, args) : NULL;
+    if (job == NULL) {
+        char error_msg[BUFFER_SIZE + 32];
+        int len = snprintf(error_msg, sizeof(error_msg), "fetch: no such job: %s\n", args);
+        return send_text_reply(client_fd, error_msg, (size_t)len, REPLY_FAILED);
+    }
+
+    pthread_mutex_lock(&jobs->lock);
+    int done = job->done;
+    pthread_mutex_unlock(&jobs->lock);
+    if (!done) {
+        char error_msg[64];
+        int len = snprintf(error_msg, sizeof(error_msg), "fetch: job %d is still running -- wait %d first\n", job->id, job->id);
+        return send_text_reply(client_fd, error_msg, (size_t)len, REPLY_FAILED);
+    }
+
+    int sent;
+    if (!job->launched) {
+        const char* error_msg = "Error: Server failed to execute command\n";
+        sent = send_text_reply(client_fd, error_msg, strlen(error_msg), REPLY_ERROR);
+    } else {
+        size_t sent_len;
+        int cursor_id = 0;
+        sent = reply_output(client_fd, &job->output, options->page, &sent_len);
+        if (sent == 0 && sent_len < job->result.output_len) {
+            sent = keep_output_rest(client_fd, session, job->command, &job->output, sent_len, options->page, &cursor_id);
+        }
+        if (sent == 0 && job->result.list_len > 0) sent = reply_frame(client_fd, FRAME_LIST, job->result.list, job->result.list_len);
+        if (sent == 0 && cursor_id != 0) sent = reply_cursor(client_fd, cursor_id, sent_len, job->result.output_len);
+        if (sent == 0) sent = reply_end(client_fd, job->result.exit_code, job->result.status);
+    }
+    release_background_job(job);
+    return sent;
+}
+
+// session state
+// a new session starts in the server's directory with the server's environment
+void init_session_state(session_state_t* state) {
+    state->cwd_fd = -1;
+    state->env_fd = -1;
+    state->env = NULL;
+    state->env_len = 0;
+}
+
+void free_session_state(session_state_t* state) {
+    if (state->cwd_fd >= 0) close(state->cwd_fd);
+    if (state->env_fd >= 0) close(state->env_fd);
+    free(state->env);
+    init_session_state(state);
+}
+
+// a copy of from's descriptors for a command that outlives the request -- to has no env block of its own
+// returns 0 on success, -1 if a descriptor could not be duplicated
+int copy_session_state(const session_state_t* from, session_state_t* to) {
+    init_session_state(to);
+    if (from->cwd_fd >= 0 && (to->cwd_fd = fcntl(from->cwd_fd, F_DUPFD_CLOEXEC, 0)) == -1) return -1;
+    if (from->env_fd >= 0 && (to->env_fd = fcntl(from->env_fd, F_DUPFD_CLOEXEC, 0)) == -1) {
+        free_session_state(to);
+        return -1;
+    }
+    return 0;
+}
+
+// value of name in the session's environment, NULL if unset
+// a session whose every variable was unset has an empty block (env_len 0) -- nothing is set, not the server's
+const char* session_getenv(const session_state_t* state, const char* name) {
+    if (state->env == NULL) return getenv(name);
+    size_t name_len = strlen(name);
+    for (const char* var = state->env; var < state->env + state->env_len; var += strlen(var) + 1) {
+        if (strncmp(var, name, name_len) == 0 && var[name_len] == '=') return var + name_len + 1;
+    }
+    return NULL;
+}
+
+// sets name to value in the session's environment, or removes it if value is NULL
+// the first change copies the server's environment; every change publishes the block as a new memfd, so
+// children already launched keep reading the block they were given
+// returns 0 on success, -1 on failure (the environment is unchanged)
+int set_session_env(session_state_t* state, const char* name, const char* value) {
+    size_t name_len = strlen(name);
+    size_t size = name_len + ((value != NULL) ? strlen(value) : 0) + 2;
+    if (state->env != NULL) {
+        size += state->env_len;
+    } else {
+        for (char** var = environ; *var != NULL; var++) size += strlen(*var) + 1;
+    }
+
+    char* block = malloc(size);
+    if (block == NULL) return -1;
+    // the session's block is walked by env_len alone -- once everything is unset it is empty, none of it written
+    size_t used = 0;
+    if (state->env != NULL) {
+        for (const char* var = state->env; var < state->env + state->env_len; var += strlen(var) + 1) {
+            used = keep_env_var(block, used, var, name, name_len);
+        }
+    } else {
+        for (char** var = environ; *var != NULL; var++) used = keep_env_var(block, used, *var, name, name_len);
+    }
+    if (value != NULL) used += (size_t)sprintf(block + used, "%s=%s", name, value) + 1;
+
+    int fd = memfd_create("session-env", MFD_CLOEXEC);
+    size_t written = 0;
+    while (fd >= 0 && written < used) {
+        ssize_t n = write(fd, block + written, used - written);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) break;
+        written += (size_t)n;
+    }
+    if (fd == -1 || written < used) {
+        if (fd >= 0) close(fd);
+        free(block);
+        return -1;
+    }
+
+    if (state->env_fd >= 0) close(state->env_fd);
+    free(state->env);
+    state->env_fd = fd;
+    state->env = block;
+    state->env_len = used;
+    return 0;
+}
+
+// appends var to block at used unless it sets name -- returns the new used
+size_t keep_env_var(char* block, size_t used, const char* var, const char* name, size_t name_len) {
+    if (strncmp(var, name, name_len) == 0 && var[name_len] == '=') return used;
+    size_t len = strlen(var) + 1;
+    memcpy(block + used, var, len);
+    return used + len;
+}
+
+// command child side -- enters the session's directory and takes the session's environment as its own,
+// which execvp() hands to every stage as its envp; closes both descriptors (-1 for none)
+// a child that cannot do either exits rather than run the command somewhere else
+void apply_session_state(int cwd_fd, int env_fd) {
+    if (cwd_fd >= 0) {
+        if (fchdir(cwd_fd) == -1) {
+            perror("Error: cannot enter the session's directory");
+            exit(EXIT_FAILURE);
+        }
+        close(cwd_fd);
+    }
+    if (env_fd < 0) return;
+
+    // pread() -- the memfd's offset is shared with every other child of the session
+    struct stat st;
+    char* block = NULL;
+    size_t len = 0;
+    if (fstat(env_fd, &st) == 0 && (block = malloc((size_t)st.st_size + 1)) != NULL) {
+        while (len < (size_t)st.st_size) {
+            ssize_t n = pread(env_fd, block + len, (size_t)st.st_size - len, (off_t)len);
+            if (n == -1 && errno == EINTR) continue;
+            if (n <= 0) break;
+            len += (size_t)n;
+        }
+    }
+    close(env_fd);
+    if (block == NULL || len < (size_t)st.st_size) {
+        fprintf(stderr, "Error: cannot read the session's environment\n");
+        exit(EXIT_FAILURE);
+    }
+    block[len] = '\0';
+
+    // an empty memfd (every variable unset) is an empty environment, not a failure
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++) if (block[i] == '\0') count++;
+    if (count == 0) {
+        static char* empty_env[] = { NULL };
+        free(block);
+        environ = empty_env;
+        return;
+    }
+    char** envp = malloc((count + 1) * sizeof(char*));
+    if (envp == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t n = 0;
+    for (char* var = block; var < block + len; var += strlen(var) + 1) envp[n++] = var;
+    envp[n] = NULL;
+    environ = envp;
+}
+
+// cd [dir] -- moves the session: its later commands start in dir (HOME without one)
+// dir is relative to the session's directory and held open, so the session stays in it even if it is renamed
+int builtin_session_cd(int client_fd, char* args, const request_options_t* options, session_context_t* session) {
+    (void)options;
+    session_state_t* state = &session->state;
+    char** argv = parse_input(args);
+    if (argv == NULL) {
+        const char* error_msg = "Error: Server failed to parse cd\n";
+        return send_text_reply(client_fd, error_msg, strlen(error_msg), REPLY_ERROR);
+    }
+    int argc = 0;
+    while (argv[argc] != NULL) argc++;
+
+    char error_msg[BUFFER_SIZE + 64];
+    int error_len = 0;
+    const char* dir = (argc > 0) ? argv[0] : session_getenv(state, "HOME");
+    int base = (state->cwd_fd >= 0) ? state->cwd_fd : AT_FDCWD;
+    if (argc > 1) {
+        error_len = snprintf(error_msg, sizeof(error_msg), "cd: too many arguments\n");
+    } else if (dir == NULL) {
+        error_len = snprintf(error_msg, sizeof(error_msg), "cd: HOME not set\n");
+    } else {
+        // search permission like chdir() would check -- an O_PATH open needs none
+        int fd = (faccessat(base, dir, X_OK, 0) == 0) ? openat(base, dir, O_PATH | O_DIRECTORY | O_CLOEXEC) : -1;
+        if (fd == -1) {
+            error_len = snprintf(error_msg, sizeof(error_msg), "cd: %s: %s\n", dir, strerror(errno));
+        } else {
+            if (state->cwd_fd >= 0) close(state->cwd_fd);
+            state->cwd_fd = fd;
+        }
+    }
+    free_argv(argv);
+    if (error_len > 0) return send_text_reply(client_fd, error_msg, (size_t)error_len, REPLY_FAILED);
+    return send_text_reply(client_fd, "", 0, REPLY_OK);
+}
+
+// export [NAME=value ...] -- sets variables for the session's later commands, no argument lists them
+int builtin_session_export(int client_fd, char* args, const request_options_t* options, session_context_t* session) {
+    (void)options;
+    session_state_t* state = &session->state;
+    char** argv = parse_input(args);
+    if (argv == NULL) {
+        const char* error_msg = "Error: Server failed to parse export\n";
+        return send_text_reply(client_fd, error_msg, strlen(error_msg), REPLY_ERROR);
+    }
+
+    // no argument -- the environment, one NAME=value per line
+    if (argv[0] == NULL) {
+        free_argv(argv);
+        size_t size = 1;
+        if (state->env != NULL) size += state->env_len;
+        else for (char** var = environ; *var != NULL; var++) size += strlen(*var) + 1;
+        char* text = malloc(size);
+        if (text == NULL) {
+            const char* error_msg = "Error: Server failed to list the environment\n";
+            return send_text_reply(client_fd, error_msg, strlen(error_msg), REPLY_ERROR);
+        }
+        size_t used = 0;
+        if (state->env != NULL) {
+            for (const char* var = state->env; var < state->env + state->env_len; var += strlen(var) + 1) {
+                used += (size_t)sprintf(text + used, "%s\n", var);
+            }
+        } else {
+            for (char** var = environ; *var != NULL; var++) used += (size_t)sprintf(text + used, "%s\n", *var);
+        }
+        int sent = send_text_reply(client_fd, text, used, REPLY_OK);
+        free(text);
+        return sent;
+    }
+
+    char errors[BUFFER_SIZE];
+    size_t errors_len = 0;
+    for (int i = 0; argv[i] != NULL; i++) {
+        char* eq = strchr(argv[i], '=');
+        size_t len = (eq != NULL) ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+        int n = 0;
+        if (!is_valid_env_name(argv[i], len)) {
+            n = snprintf(errors + errors_len, sizeof(errors) - errors_len, "export: not a valid identifier: %s\n", argv[i]);
+        } else if (eq != NULL) {
+            // "export NAME" only marks a variable for export -- every variable already is
+            *eq = '\0';
+            if (set_session_env(state, argv[i], eq + 1) == -1) {
+                n = snprintf(errors + errors_len, sizeof(errors) - errors_len, "export: cannot set %s\n", argv[i]);
+            }
+        }
+        if (n > 0) errors_len += ((size_t)n < sizeof(errors) - errors_len) ? (size_t)n : sizeof(errors) - errors_len - 1;
+    }
+    free_argv(argv);
+    return send_text_reply(client_fd, errors, errors_len, (errors_len > 0) ? REPLY_FAILED : REPLY_OK);
+}
+
+// unset NAME ... -- removes variables from the session's environment
+int builtin_session_unset(int client_fd, char* args, const request_options_t* options, session_context_t* session) {
+    (void)options;
+    char** argv = parse_input(args);
+    if (argv == NULL) {
+        const char* error_msg = "Error: Server failed to parse unset\n";
+        return send_text_reply(client_fd, error_msg, strlen(error_msg), REPLY_ERROR);
+    }
+
+    char errors[BUFFER_SIZE];
+    size_t errors_len = 0;
+    for (int i = 0; argv[i] != NULL; i++) {
+        int n = 0;
+        if (!is_valid_env_name(argv[i], strlen(argv[i]))) {
+            n = snprintf(errors + errors_len, sizeof(errors) - errors_len, "unset: not a valid identifier: %s\n", argv[i]);
+        } else if (session_getenv(&session->state, argv[i]) != NULL && set_session_env(&session->state, argv[i], NULL) == -1) {
+            n = snprintf(errors + errors_len, sizeof(errors) - errors_len, "unset: cannot unset %s\n", argv[i]);
+        }
+        if (n > 0) errors_len += ((size_t)n < sizeof(errors) - errors_len) ? (size_t)n : sizeof(errors) - errors_len - 1;
+    }
+    free_argv(argv);
+    return send_text_reply(client_fd, errors, errors_len, (errors_len > 0) ? REPLY_FAILED : REPLY_OK);
+}
+
+// streamed replies
+// sets up a reply streamed while its command runs -- the socket is non-blocking until finish_output_stream()
+void start_output_stream(output_stream_t* stream, int client_fd) {
+    memset(stream, 0, sizeof(*stream));
+    stream->client_fd = client_fd;
+    stream->can_clear = (log_output != LOG_OUTPUT_BODY);
+    stream->progress_at = monotonic_seconds();
+    stream->flags = fcntl(client_fd, F_GETFL);
+    if (stream->flags != -1) fcntl(client_fd, F_SETFL, stream->flags | O_NONBLOCK);
+}
+
+// 1 while a frame header or captured output is still to be sent
+int stream_backlog(const output_stream_t* stream, const spool_t* output) {
+    return stream->header_sent < stream->header_len || stream->sent < spool_length(output);
+}
+
+// sends as much of the output as the socket takes without waiting -- each frame covers the bytes
+// captured since the last one; a full socket buffer sets blocked, the caller waits for POLLOUT
+// returns 0 on success, -1 if the client is gone (error set)
+int stream_output(output_stream_t* stream, spool_t* output) {
+    while (stream->error == 0) {
+        ssize_t sent;
+        if (stream->header_sent < stream->header_len) {
+            // MSG_MORE -- the header leaves in one segment with the payload after it
+            sent = send(stream->client_fd, stream->header + stream->header_sent,
+                        stream->header_len - stream->header_sent, MSG_DONTWAIT | MSG_NOSIGNAL | MSG_MORE);
+            if (sent > 0) stream->header_sent += (size_t)sent;
+        } else if (stream->sent < stream->frame_end) {
+            sent = spool_send_some(stream->client_fd, output, stream->sent, stream->frame_end - stream->sent);
+            if (sent > 0) stream->sent += (size_t)sent;
+        } else if (stream->sent < spool_length(output)) {
+            stream->frame_end = spool_length(output);
+            stream->header_len = (size_t)snprintf(stream->header, sizeof(stream->header), "%c %zu\n",
+                                                  FRAME_OUTPUT, stream->frame_end - stream->sent);
+            stream->header_sent = 0;
+            continue;
+        } else {
+            // caught up -- nothing in the spool is needed again, its memory takes the next bytes
+            if (stream->can_clear && stream->sent > 0) {
+                if (output->file_len > 0) metrics_add(METRIC_SPILLED_BYTES, output->file_len);
+                stream->dropped += stream->sent;
+                spool_clear(output);
+                stream->sent = 0;
+                stream->frame_end = 0;
+            }
+            stream->blocked = 0;
+            stream->progress_at = monotonic_seconds();
+            return 0;
+        }
+
+        if (sent > 0) {
+            metrics_add(METRIC_BYTES_OUT, (size_t)sent);
+            stream->blocked = 0;
+            stream->progress_at = monotonic_seconds();
+        } else if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            stream->blocked = 1;
+            return 0;
+        } else {
+            stream->error = (sent == -1) ? errno : EIO;
+        }
+    }
+    errno = stream->error;
+    return -1;
+}
+
+// sends the rest of a streamed reply once its command is done, giving the client send_stall_sec to take
+// each part, and makes the socket blocking again for the trailers and the end frame
+// returns 0 on success, -1 if the client is gone or stalled (errno set, ETIMEDOUT for a stall)
+int finish_output_stream(output_stream_t* stream, spool_t* output) {
+    // the spool is kept from here on -- the command record and the metrics see what it still holds
+    stream->can_clear = 0;
+    while (stream_output(stream, output) == 0 && stream_backlog(stream, output)) {
+        int wait_ms = -1;
+        if (send_stall_sec > 0) {
+            double remaining = stream->progress_at + send_stall_sec - monotonic_seconds();
+            if (remaining <= 0) {
+                stream->error = ETIMEDOUT;
+                break;
+            }
+            wait_ms = (int)(remaining * 1000.0) + 1;
+        }
+        struct pollfd pfd = { stream->client_fd, POLLOUT, 0 };
+        if (poll(&pfd, 1, wait_ms) == -1 && errno != EINTR) {
+            stream->error = errno;
+            break;
+        }
+    }
+    if (stream->flags != -1) fcntl(stream->client_fd, F_SETFL, stream->flags);
+
+    if (stream->error == 0) return 0;
+    if (stream->error == ETIMEDOUT) metrics_add(METRIC_SEND_STALLS, 1);
+    errno = stream->error;
+    return -1;
+}
+
+
+// paged output
+// the output frame of a reply -- the whole output, or with page > 0 only the first page of a longer one
+// *sent is the number of bytes sent; returns 0 on success, -1 if sending failed
+int reply_output(int client_fd, const spool_t* output, size_t page, size_t* sent) {
+    size_t len = spool_length(output);
+    *sent = (page > 0 && len > page) ? page_end(output, 0, page) : len;
+    if (*sent == 0) return 0;
+    return reply_spool(client_fd, output, 0, *sent);
+}
+
+// keeps output in a new cursor of the session, read on from offset -- the spool moves, output is left empty
+// a full table gives up its least recently used cursor; returns NULL if the cursor could not be made
+output_cursor_t* open_output_cursor(session_context_t* session, const char* command, spool_t* output, size_t offset,
+                                    size_t page) {
+    output_cursor_t* cursor = &session->cursors[0];
+    for (int i = 0; i < CURSORS_MAX && cursor->id != 0; i++) {
+        if (session->cursors[i].id == 0 || session->cursors[i].used < cursor->used) cursor = &session->cursors[i];
+    }
+    if (cursor->id != 0) {
+        log_record_t* rec = log_begin(LOG_INFO, "cursor_dropped", 1);
+        if (rec != NULL) {
+            log_int(rec, "cursor", cursor->id);
+            log_str(rec, "cmd", cursor->command);
+            log_commit(rec);
+        }
+        close_output_cursor(cursor);
+    }
+
+    cursor->command = strdup(command);
+    if (cursor->command == NULL) {
+        log_message(LOG_ERROR, "cursor_failed", "could not keep a paged output");
+        return NULL;
+    }
+    cursor->output = *output;
+    spool_init(output, output->budget, output->max_len);
+    cursor->offset = offset;
+    cursor->page = page;
+    cursor->id = ++session->next_cursor_id;
+    cursor->used = ++session->cursor_clock;
+    return cursor;
+}
+
+// the rest of a paged output, from offset -- moved into a new cursor, or sent right away as another output frame
+// when no cursor can be made, so a reply is never cut short; *cursor_id is the cursor's id, 0 if the rest was sent
+// returns 0 on success, -1 if sending failed
+int keep_output_rest(int client_fd, session_context_t* session, const char* command, spool_t* output, size_t offset,
+                     size_t page, int* cursor_id) {
+    output_cursor_t* cursor = open_output_cursor(session, command, output, offset, page);
+    if (cursor != NULL) {
+        *cursor_id = cursor->id;
+        return 0;
+    }
+    *cursor_id = 0;
+    return reply_spool(client_fd, output, offset, spool_length(output) - offset);
+}
+
+// FRAME_CURSOR trailer -- "cursor=<id> offset=<bytes> total=<bytes>", offset == total once the cursor is used up
+int reply_cursor(int client_fd, int id, size_t offset, size_t total) {
+    char payload[FRAME_CURSOR_MAX];
+    int len = snprintf(payload, sizeof(payload), "cursor=%d offset=%zu total=%zu", id, offset, total);
+    return reply_frame(client_fd, FRAME_CURSOR, payload, (size_t)len);
+}
+
+// the cursor named by text -- "3"; NULL if there is no such cursor
+output_cursor_t* find_output_cursor(session_context_t* session, const char* text) {
+    char* end;
+    long id = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || id <= 0) return NULL;
+    for (int i = 0; i < CURSORS_MAX; i++) {
+        if (session->cursors[i].id == id) return &session->cursors[i];
+    }
+    return NULL;
+}
+
+void close_output_cursor(output_cursor_t* cursor) {
+    free(cursor->command);
+    spool_free(&cursor->output);
+    cursor->command = NULL;
+    cursor->id = 0;
+}
+
+// end of the page that starts at offset -- just after the last newline of its last PAGE_LINE_MAX bytes,
+// or page bytes on if there is none; the end of the output if that is closer
+size_t page_end(const spool_t* output, size_t offset, size_t page) {
+    size_t total = spool_length(output);
+    if (page >= total - offset) return total;
+
+    size_t end = offset + page;
+    char tail[PAGE_LINE_MAX];
+    size_t back = (page < sizeof(tail)) ? page : sizeof(tail);
+    size_t got = spool_copy(output, end - back, tail, back);
+    const char* newline = memrchr(tail, '\n', got);
+    return (newline != NULL) ? end - back + (size_t)(newline - tail) + 1 : end;
+}
+
+// start of the line holding offset -- offset itself if that line began more than PAGE_LINE_MAX bytes earlier
+size_t line_start(const spool_t* output, size_t offset) {
+    char head[PAGE_LINE_MAX];
+    size_t back = (offset < sizeof(head)) ? offset : sizeof(head);
+    size_t got = spool_copy(output, offset - back, head, back);
+    const char* newline = memrchr(head, '\n', got);
+    if (newline != NULL) return offset - back + (size_t)(newline - head) + 1;
+    return (back == offset) ? 0 : offset;
+}
+
+// cursor                  -- every open cursor of the session
+// cursor n                -- the next page of cursor n
+// cursor n search text    -- the page from the start of the line holding the next "text" (taken verbatim)
+// cursor n close
+// a reply with a page carries a FRAME_CURSOR trailer; the page that reaches the end closes the cursor
+int builtin_cursor(int client_fd, char* args, const request_options_t* options, session_context_t* session) {
+    (void)options;
+    const char* usage = "Usage: cursor [n [search text | close]]\n";
+    if (*args == '\0') {
+        // in cursor number order -- slots are reused, so their order is not
+        output_cursor_t* sorted[CURSORS_MAX];
+        int count = 0;
+        for (int i = 0; i < CURSORS_MAX; i++) {
+            if (session->cursors[i].id == 0) continue;
+            int k = count++;
+            while (k > 0 && sorted[k - 1]->id > session->cursors[i].id) {
+                sorted[k] = sorted[k - 1];
+                k--;
+            }
+            sorted[k] = &session->cursors[i];
+        }
+
+        char text[CURSORS_MAX * (BUFFER_SIZE + 96)];
+        size_t used = 0;
+        for (int k = 0; k < count; k++) {
+            int n = snprintf(text + used, sizeof(text) - used, "[%d] offset=%zu total=%zu cmd=%s\n", sorted[k]->id,
+                             sorted[k]->offset, spool_length(&sorted[k]->output), sorted[k]->command);
+            if (n > 0) used += ((size_t)n < sizeof(text) - used) ? (size_t)n : sizeof(text) - used - 1;
+        }
+        return send_text_reply(client_fd, text, used, REPLY_OK);
+    }
+
+    char* rest = args;
+    while (*rest && *rest != ' ' && *rest != '\t') rest++;
+    if (*rest) *rest++ = '\0';
+    rest = trim_whitespace(rest);
+    output_cursor_t* cursor = find_output_cursor(session, args);
+    if (cursor == NULL) {
+        char error_msg[BUFFER_SIZE + 32];
+        int len = snprintf(error_msg, sizeof(error_msg), "cursor: no such cursor: %s\n", args);
+        return send_text_reply(client_fd, error_msg, (size_t)len, REPLY_FAILED);
+    }
+    cursor->used = ++session->cursor_clock;
+
+    if (strcmp(rest, "close") == 0) {
+        close_output_cursor(cursor);
+        return send_text_reply(client_fd, "", 0, REPLY_OK);
+    }
+
+    size_t total = spool_length(&cursor->output);
+    size_t offset = cursor->offset;
+    size_t end;
+    if (strncmp(rest, "search", 6) == 0 && (rest[6] == ' ' || rest[6] == '\t')) {
+        char* pattern = trim_whitespace(rest + 6);
+        size_t pattern_len = strlen(pattern);
+        // text with operator characters comes quoted -- one pair of enclosing quotes is not part of it
+        if (pattern_len >= 2 && (pattern[0] == '\'' || pattern[0] == '"') && pattern[pattern_len - 1] == pattern[0]) {
+            pattern[--pattern_len] = '\0';
+            pattern++;
+            pattern_len--;
+        }
+        size_t found;
+        if (spool_find(&cursor->output, offset, pattern, pattern_len, &found) == -1) {
+            char error_msg[BUFFER_SIZE + 64];
+            int len = snprintf(error_msg, sizeof(error_msg), "cursor: '%s' not found after byte %zu\n", pattern, offset);
+            return send_text_reply(client_fd, error_msg, (size_t)len, REPLY_FAILED);
+        }
+        // the match is always on the page, however long its line
+        offset = line_start(&cursor->output, found);
+        end = page_end(&cursor->output, offset, cursor->page);
+        if (end < found + pattern_len) end = found + pattern_len;
+    } else if (*rest == '\0') {
+        end = page_end(&cursor->output, offset, cursor->page);
+    } else {
+        return send_text_reply(client_fd, usage, strlen(usage), REPLY_FAILED);
+    }
+
+    int id = cursor->id;
+    if (end > offset && reply_spool(client_fd, &cursor->output, offset, end - offset) == -1) return -1;
+    cursor->offset = end;
+    if (end >= total) close_output_cursor(cursor);
+    if (reply_cursor(client_fd, id, end, total) == -1) return -1;
+    return reply_end(client_fd, 0, REPLY_OK);
+}
+
+// sends a complete reply made by the server itself -- output frame (if any) and end frame
+int send_text_reply(int client_fd, const char* text, size_t len, reply_status_t status) {
+    int exit_code = (status == REPLY_OK) ? 0 : (status == REPLY_FAILED) ? 1 : -1;
+    if (len > 0 && reply_frame(client_fd, FRAME_OUTPUT, text, len) == -1) return -1;
+    return reply_end(client_fd, exit_code, status);
+}
+
+// frame_send() plus the sent-bytes metric -- every reply frame the server sends goes through here
+int reply_frame(int client_fd, char type, const void* payload, size_t len) {
+    if (frame_send(client_fd, type, payload, len) == -1) return -1;
+    metrics_add(METRIC_BYTES_OUT, frame_wire_size(len));
+    return 0;
+}
+
+// len bytes of captured output from offset as one output frame -- header and the part in memory in one send,
+// then the part in the spill file by sendfile()
+int reply_spool(int client_fd, const spool_t* output, size_t offset, size_t len) {
+    size_t mem_len = (offset >= output->mem_len) ? 0 : (len < output->mem_len - offset) ? len : output->mem_len - offset;
+    if (mem_len == len) return reply_frame(client_fd, FRAME_OUTPUT, output->data + offset, len);
+
+    size_t file_offset = offset + mem_len - output->mem_len;
+    if (frame_send_start(client_fd, FRAME_OUTPUT, len, (mem_len > 0) ? output->data + offset : NULL, mem_len) == -1 ||
+        spool_send_file(client_fd, output, file_offset, len - mem_len) == -1) {
+        return -1;
+    }
+    metrics_add(METRIC_BYTES_OUT, frame_wire_size(len));
+    return 0;
+}
+
+// bytes a frame with a len-byte payload takes on the wire -- the header is "<type> <len>\n"
+size_t frame_wire_size(size_t len) {
+    size_t header_len = 3;
+    for (size_t n = len; n >= 10; n /= 10) header_len++;
+    return header_len + len;
+}
+
+int reply_end(int client_fd, int exit_code, reply_status_t status) {
+    char payload[64];
+    int len = snprintf(payload, sizeof(payload), "exit=%d status=%s", exit_code, reply_status_name(status));
+    return reply_frame(client_fd, FRAME_END, payload, (size_t)len);
+}
+
+// complete request lines still waiting in the reader -- the session's queue depth
+size_t count_queued_requests(const request_reader_t* reader) {
+    size_t queued = 0;
+    const char* p = reader->data;
+    const char* end = reader->data + reader->len;
+    while ((p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        queued++;
+        p++;
+    }
+    return queued;
+}
+
+
+// request options
+// strips a leading "@key=value,key=value" token from the request and applies it to the options
+// recognised keys: timeout (seconds), cpu (seconds), output (bytes), mem (bytes) -- sizes accept K/M/G,
+// par (replicas per line-stateless stage, at most the server's -P)
+// flags: trace (send the phase breakdown as a trailer), time (send every stage's exit status and rusage
+// as a trailer) -- a bare flag means flag=1
+// a request can only tighten a limit the server sets, never raise or remove it
+// returns 0 on success (command points at the rest of the line), -1 on a malformed option
+int parse_request_options(char** command, request_options_t* options) {
+    exec_limits_t* limits = &options->limits;
+    char* line = *command;
+    if (*line != REQUEST_OPTION_PREFIX) return 0;
+
+    // options end at the first whitespace -- the command follows
+    char* text = line + 1;
+    char* rest = text;
+    while (*rest && *rest != ' ' && *rest != '\t') rest++;
+    if (*rest) *rest++ = '\0';
+    *command = trim_whitespace(rest);
+
+    char* save = NULL;
+    for (char* opt = strtok_r(text, ",", &save); opt != NULL; opt = strtok_r(NULL, ",", &save)) {
+        char* value = strchr(opt, '=');
+        if (value == NULL) {
+            // a bare flag
+            if (strcmp(opt, "trace") == 0) {
+                options->trace = 1;
+                continue;
+            }
+            if (strcmp(opt, "time") == 0) {
+                options->time = 1;
+                continue;
+            }
+            if (strcmp(opt, "page") == 0) {
+                options->page = DEFAULT_PAGE_SIZE;
+                continue;
+            }
+            return -1;
+        }
+        *value++ = '\0';
+
+        double seconds;
+        size_t bytes;
+        if (strcmp(opt, "timeout") == 0) {
+            if (parse_seconds(value, &seconds) == -1) return -1;
+            if (server_limits.timeout_sec == 0 || (seconds > 0 && seconds < limits->timeout_sec)) limits->timeout_sec = seconds;
+        } else if (strcmp(opt, "cpu") == 0) {
+            if (parse_seconds(value, &seconds) == -1) return -1;
+            // RLIMIT_CPU has one second granularity -- round up so a limit is never zero
+            long cpu = (long)seconds + ((seconds > (long)seconds) ? 1 : 0);
+            if (server_limits.cpu_sec == 0 || (cpu > 0 && cpu < limits->cpu_sec)) limits->cpu_sec = cpu;
+        } else if (strcmp(opt, "output") == 0) {
+            if (parse_size(value, &bytes) == -1) return -1;
+            if (server_limits.max_output == 0 || (bytes > 0 && bytes < limits->max_output)) limits->max_output = bytes;
+        } else if (strcmp(opt, "mem") == 0) {
+            if (parse_size(value, &bytes) == -1) return -1;
+            if (server_limits.max_memory == 0 || (bytes > 0 && bytes < limits->max_memory)) limits->max_memory = bytes;
+        } else if (strcmp(opt, "par") == 0) {
+            char* end;
+            long replicas = strtol(value, &end, 10);
+            if (end == value || *end != '\0' || replicas < 1) return -1;
+            if (replicas < limits->parallel) limits->parallel = (int)replicas;
+        } else if (strcmp(opt, "trace") == 0) {
+            if (strcmp(value, "0") != 0 && strcmp(value, "1") != 0) return -1;
+            options->trace = (value[0] == '1');
+        } else if (strcmp(opt, "time") == 0) {
+            if (strcmp(value, "0") != 0 && strcmp(value, "1") != 0) return -1;
+            options->time = (value[0] == '1');
+        } else if (strcmp(opt, "page") == 0) {
+            if (parse_size(value, &options->page) == -1) return -1;
+        } else {
+            return -1;
+        }
+    }
+
+    // options with nothing to run are not a request
+    return (**command == '\0') ? -1 : 0;
+}
+
+// parses a non-negative number of seconds ("30", "0.5") -- returns 0 on success, -1 on failure
+int parse_seconds(const char* text, double* seconds) {
+    char* end;
+    errno = 0;
+    double value = strtod(text, &end);
+    if (end == text || *end != '\0' || errno != 0 || value < 0) return -1;
+    *seconds = value;
+    return 0;
+}
+
+// parses a byte count with an optional K/M/G suffix ("4096", "64M") -- returns 0 on success, -1 on failure
+int parse_size(const char* text, size_t* bytes) {
+    char* end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text || errno != 0 || *text == '-') return -1;
+
+    unsigned long long scale = 1;
+    switch (*end) {
+        case '\0': break;
+        case 'k': case 'K': scale = 1ULL << 10; end++; break;
+        case 'm': case 'M': scale = 1ULL << 20; end++; break;
+        case 'g': case 'G': scale = 1ULL << 30; end++; break;
+        default: return -1;
+    }
+    if (*end != '\0' || value > (unsigned long long)((size_t)-1) / scale) return -1;
+
+    *bytes = (size_t)(value * scale);
+    return 0;
 }
 
-void print_error(const char* message) {
-    printf("[ERROR] %s\n", message);
-    fflush(stdout);
+// current CLOCK_MONOTONIC time in seconds -- for deadlines, immune to wall clock changes
+double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
 }
@@ -850,10 +850,189 @@
 
 // new corrected version
 
-// define posix feature test
+// define posix feature test -- _DEFAULT_SOURCE adds wait4() for per-stage resource usage
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
 #include "shell_utils.h"
+#include "probes.h"
 #include <glob.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>       // kill() for pipeline teardown
+#include <sys/syscall.h>  // SYS_pidfd_open
+
+// phase timing -- see pipeline_timing_t in shell_utils.h
+pipeline_timing_t* pipeline_timing = NULL;
+
+// pipeline teardown -- upstream stages of an exited stage get SIGPIPE, then SIGKILL this much later
+#define PIPELINE_STOP_GRACE_MS 100
+
+// reap_next_stage() result when no stage exited within the time limit, and its polling interval without pidfds
+#define REAP_TIMEOUT (-2)
+#define REAP_POLL_MS 5
+
+// exec probe: a pipe whose ends are close-on-exec in every stage
+// the read end sees EOF once every stage holding the write end has exec'd or exited
+static int exec_probe[2] = { -1, -1 };
+
+// current CLOCK_MONOTONIC time in seconds
+static double timing_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// records the start of a pipeline and opens the exec probe -- no-op when timing is off
+static void timing_start(void) {
+    if (pipeline_timing == NULL) return;
+    pipeline_timing->start = timing_now();
+    pipeline_timing->forked = pipeline_timing->execed = pipeline_timing->finished = pipeline_timing->start;
+    if (pipe(exec_probe) == -1) {
+        exec_probe[0] = exec_probe[1] = -1;
+        return;
+    }
+    fcntl(exec_probe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(exec_probe[1], F_SETFD, FD_CLOEXEC);
+}
+
+// called in the parent once every stage is forked -- records that, then waits for every stage to exec
+static void timing_forked(void) {
+    if (pipeline_timing == NULL) return;
+    pipeline_timing->forked = timing_now();
+    if (exec_probe[0] != -1) {
+        char byte;
+        close(exec_probe[1]);
+        while (read(exec_probe[0], &byte, 1) == -1 && errno == EINTR) {
+            // interrupted -- keep waiting for EOF
+        }
+        close(exec_probe[0]);
+        exec_probe[0] = exec_probe[1] = -1;
+    }
+    pipeline_timing->execed = timing_now();
+}
+
+// per-stage report -- see pipeline_report_t in shell_utils.h
+pipeline_report_t* pipeline_report = NULL;
+
+// exit code of a reaped stage -- 128 + signal if it was killed, like the shell does
+static int stage_exit_code(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return -1;
+}
+
+// clears the report for a pipeline of num_stages stages -- no-op when reporting is off
+static void report_start(int num_stages) {
+    if (pipeline_report == NULL) return;
+    memset(pipeline_report, 0, sizeof(*pipeline_report));
+    pipeline_report->num_stages = num_stages;
+    for (int i = 0; i < PIPELINE_REPORT_STAGES; i++) pipeline_report->stages[i].exit_code = -1;
+}
+
+// records one reaped stage -- usage NULL for a built-in
+static void report_stage(int stage, pid_t pid, int exit_code, const struct rusage* usage) {
+    if (pipeline_report == NULL || stage >= PIPELINE_REPORT_STAGES) return;
+    pipeline_report->stages[stage].pid = pid;
+    pipeline_report->stages[stage].exit_code = exit_code;
+    if (usage != NULL) pipeline_report->stages[stage].usage = *usage;
+}
+
+int open_child_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// waits up to timeout_ms (-1 = no limit) for the next stage of a pipeline to exit and reaps it
+// returns its index (*pid its pid), REAP_TIMEOUT if none exited in time, -1 on failure
+// pids of reaped stages are set to 0; stages exit in any order and each is reaped as it does, not in pipeline order
+// with a pidfd for every stage the exits are poll() events, otherwise wait4(-1) takes whichever child exits first
+static int reap_next_stage(pid_t* pids, int* pidfds, int count, int timeout_ms, pid_t* pid, int* status,
+                           struct rusage* usage) {
+    struct pollfd fds[count];
+    int stage_of[count];
+    int watched = 0;
+    int all_pidfds = 1;
+    for (int i = 0; i < count; i++) {
+        if (pids[i] == 0) continue;
+        if (pidfds[i] == -1) { all_pidfds = 0; break; }
+        fds[watched].fd = pidfds[i];
+        fds[watched].events = POLLIN;
+        stage_of[watched++] = i;
+    }
+    if (watched == 0 && all_pidfds) return -1;
+
+    if (all_pidfds) {
+        int ready;
+        while ((ready = poll(fds, (nfds_t)watched, timeout_ms)) == -1) {
+            if (errno != EINTR) return -1;
+        }
+        if (ready == 0) return REAP_TIMEOUT;
+        for (int k = 0; k < watched; k++) {
+            if (fds[k].revents == 0) continue;
+            int i = stage_of[k];
+            // exited already -- wait4() only collects it
+            while (wait4(pids[i], status, 0, usage) == -1) {
+                if (errno != EINTR) return -1;
+            }
+            close(pidfds[i]);
+            pidfds[i] = -1;
+            *pid = pids[i];
+            pids[i] = 0;
+            return i;
+        }
+        return -1;
+    }
+
+    // no pidfds -- any child, skipping ones that are not stages of this pipeline
+    // a time limit turns the wait into polling every REAP_POLL_MS
+    double deadline = (timeout_ms >= 0) ? timing_now() + timeout_ms / 1000.0 : 0;
+    while (1) {
+        *pid = wait4(-1, status, (timeout_ms >= 0) ? WNOHANG : 0, usage);
+        if (*pid == 0) {
+            if (timing_now() >= deadline) return REAP_TIMEOUT;
+            struct timespec pause = { 0, REAP_POLL_MS * 1000000L };
+            nanosleep(&pause, NULL);
+            continue;
+        }
+        if (*pid == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        for (int i = 0; i < count; i++) {
+            if (pids[i] != *pid) continue;
+            if (pidfds[i] != -1) close(pidfds[i]);
+            pidfds[i] = -1;
+            pids[i] = 0;
+            return i;
+        }
+    }
+}
+
+// sends sig to every stage in [from, to) that has not been reaped yet
+// unreaped stages keep their pid even after exiting, so a pid here is never someone else's
+static void signal_stages(const pid_t* pids, int from, int to, int sig) {
+    for (int i = from; i < to; i++) {
+        if (pids[i] != 0) kill(pids[i], sig);
+    }
+}
+
+// records that every stage has been reaped
+static void timing_finished(void) {
+    if (pipeline_timing == NULL) return;
+    if (exec_probe[0] != -1) {
+        // nothing was forked (built-in or early failure) -- just drop the probe
+        close(exec_probe[0]);
+        close(exec_probe[1]);
+        exec_probe[0] = exec_probe[1] = -1;
+        pipeline_timing->forked = pipeline_timing->execed = timing_now();
+    }
+    pipeline_timing->finished = timing_now();
+}
 
 // trim leading and trailing ascii whitespace characters in place and return the start pointer
 char* trim_whitespace(char* str) {
@@ -1312,6 +1491,65 @@ int builtin_echo(command_t* cmd) {
     return 0;
 }
 
+// execute built-in cd command -- a forked stage could only change its own directory, so lists run it in-process
+int builtin_cd(command_t* cmd) {
+    if (cmd->argc > 2) { fprintf(stderr, "cd: too many arguments\n"); return 1; }
+    // no argument goes home, like the shell does
+    const char* dir = (cmd->argc > 1) ? cmd->argv[1] : getenv("HOME");
+    if (dir == NULL) { fprintf(stderr, "cd: HOME not set\n"); return 1; }
+    if (chdir(dir) == -1) { fprintf(stderr, "cd: %s: %s\n", dir, strerror(errno)); return 1; }
+    return 0;
+}
+
+// check whether name (its first len bytes) is a valid environment variable name
+int is_valid_env_name(const char* name, size_t len) {
+    if (len == 0 || (name[0] >= '0' && name[0] <= '9')) return 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_')) return 0;
+    }
+    return 1;
+}
+
+// execute built-in export command -- like cd, it has to change the shell process itself
+int builtin_export(command_t* cmd) {
+    extern char** environ;
+    if (cmd->argc == 1) {
+        for (char** var = environ; var != NULL && *var != NULL; var++) printf("%s\n", *var);
+        return 0;
+    }
+    int status = 0;
+    for (int i = 1; i < cmd->argc; i++) {
+        char* eq = strchr(cmd->argv[i], '=');
+        size_t len = (eq != NULL) ? (size_t)(eq - cmd->argv[i]) : strlen(cmd->argv[i]);
+        if (!is_valid_env_name(cmd->argv[i], len)) {
+            fprintf(stderr, "export: not a valid identifier: %s\n", cmd->argv[i]);
+            status = 1;
+            continue;
+        }
+        // "export NAME" only marks a variable for export -- every variable already is
+        if (eq == NULL) continue;
+        *eq = '\0';
+        if (setenv(cmd->argv[i], eq + 1, 1) == -1) status = 1;
+        *eq = '=';
+    }
+    return status;
+}
+
+// execute built-in unset command
+int builtin_unset(command_t* cmd) {
+    int status = 0;
+    for (int i = 1; i < cmd->argc; i++) {
+        if (!is_valid_env_name(cmd->argv[i], strlen(cmd->argv[i]))) {
+            fprintf(stderr, "unset: not a valid identifier: %s\n", cmd->argv[i]);
+            status = 1;
+            continue;
+        }
+        unsetenv(cmd->argv[i]);
+    }
+    return status;
+}
+
 // check if command is a built-in and execute it
 int is_builtin_command(command_t* cmd) {
     if (!cmd || !cmd->argv || !cmd->argv[0]) return 0;
@@ -1378,6 +1616,9 @@ int execute_simple_command(command_t* cmd) {
         if (strcmp(cmd->argv[0], "echo") == 0) {
             result = builtin_echo(cmd);
         }
+        report_stage(0, 0, result, NULL);
+        // the built-in printed through stdio -- push it out while stdout is still the redirection target
+        fflush(stdout);
         
         // restore original file descriptors
         if (saved_stdin != -1) {
@@ -1400,6 +1641,9 @@ int execute_simple_command(command_t* cmd) {
     pid_t pid = fork();
     // declare status container for wait()
     int status;
+    // the only stage is forked -- when timing, wait until it has exec'd
+    if (pid > 0) PROBE2(stage_spawn, 0, pid);
+    if (pid > 0) timing_forked();
     
     // handle fork failure
     if (pid == -1) {
@@ -1412,6 +1656,7 @@ int execute_simple_command(command_t* cmd) {
         if (setup_redirection(cmd) != 0) exit(EXIT_FAILURE);
         // attempt to replace process image with the requested program
         if (execvp(cmd->argv[0], cmd->argv) == -1) {
+            PROBE2(exec_failed, cmd->argv[0], errno);
             // provide user-friendly messages for not found and permission errors
             if (errno == ENOENT) fprintf(stderr, "Command not found: %s\n", cmd->argv[0]);
             else if (errno == EACCES) fprintf(stderr, "Permission denied: %s\n", cmd->argv[0]);
@@ -1421,11 +1666,14 @@ int execute_simple_command(command_t* cmd) {
         }
     // parent process branch
     } else {
-        // wait for the child to finish
-        if (wait(&status) == -1) { handle_error(ERROR_INVALID_COMMAND, "wait failed"); return -1; }
-        // if the child exited normally, return its exit status
-        if (WIFEXITED(status)) return WEXITSTATUS(status);
-        return -1;
+        // wait for the child to finish -- wait4() also collects its resource usage
+        struct rusage usage;
+        if (wait4(pid, &status, 0, &usage) == -1) { handle_error(ERROR_INVALID_COMMAND, "wait failed"); return -1; }
+        // exit status if the child exited normally, 128 + signal if killed (e.g. SIGXCPU from a CPU limit)
+        int exit_code = stage_exit_code(status);
+        PROBE3(stage_exit, 0, pid, exit_code);
+        report_stage(0, pid, exit_code, &usage);
+        return exit_code;
     }
     return 0;
 }
@@ -1707,23 +1955,434 @@ pipeline_t* parse_pipeline(char* input) {
     return pipeline;
 }
 
+// data-parallel stages -- see pipeline_parallel in shell_utils.h
+int pipeline_parallel = 1;
+
+// a sharded stage cuts its input after the first newline at or past this many bytes
+#define PARALLEL_CHUNK_SIZE (8 << 20)
+#define PARALLEL_READ_SIZE (64 * 1024)
+
+// one chunk of a sharded stage's input and the replica running over it
+typedef struct {
+    pid_t pid;                // replica
+    int in_fd;                // write end of the replica's stdin, -1 once the chunk is written
+    int out_fd;               // read end of the replica's stdout, -1 at end of file
+    char* input;              // the chunk -- freed once written
+    size_t input_len;
+    size_t input_sent;
+    char* output;             // replica output not yet passed on
+    size_t output_len;
+    size_t output_cap;
+} shard_t;
+
+// a whitelisted stage's words, split by scan_stage_args()
+typedef struct {
+    char* values[MAX_ARGS];   // values of valued options, in order
+    int num_values;
+    char* operands[MAX_ARGS]; // everything that is not an option
+    int num_operands;
+} stage_args_t;
+
+// options that only change how each line is matched, cut or rewritten -- grep -c, -n, -m, -A/-B/-C, -l and -q,
+// sed -i and -z, tr -s and cut -z carry state from line to line (or across the whole input) and are not in here
+static const char* const grep_long_options[] = {
+    "--ignore-case", "--no-ignore-case", "--invert-match", "--word-regexp", "--line-regexp", "--extended-regexp",
+    "--fixed-strings", "--basic-regexp", "--perl-regexp", "--only-matching", "--no-messages", "--text",
+    "--with-filename", "--no-filename", "--regexp=", "--file=", NULL
+};
+static const char* const cut_long_options[] = {
+    "--complement", "--only-delimited", "--bytes=", "--characters=", "--fields=", "--delimiter=",
+    "--output-delimiter=", NULL
+};
+static const char* const tr_long_options[] = { "--complement", "--delete", "--truncate-set1", NULL };
+static const char* const sed_long_options[] = {
+    "--quiet", "--silent", "--regexp-extended", "--posix", "--unbuffered", "--expression=", NULL
+};
+
+// splits argv[1..] of a whitelisted command into option values and operands
+// short options must be in flags (no value) or valued (value is the rest of the word or the next word),
+// long options in longs -- an entry ending in '=' takes a value after it
+// returns 0, -1 if any option is not allowed
+static int scan_stage_args(char** argv, const char* flags, const char* valued, const char* const* longs,
+                           stage_args_t* args) {
+    args->num_values = args->num_operands = 0;
+    int options_done = 0;
+    for (int i = 1; argv[i] != NULL; i++) {
+        char* word = argv[i];
+        if (options_done || word[0] != '-' || word[1] == '\0') {
+            args->operands[args->num_operands++] = word;
+            continue;
+        }
+        if (strcmp(word, "--") == 0) {
+            options_done = 1;
+            continue;
+        }
+        if (word[1] == '-') {
+            int known = 0;
+            for (int k = 0; longs[k] != NULL && !known; k++) {
+                size_t len = strlen(longs[k]);
+                if (longs[k][len - 1] != '=') {
+                    known = (strcmp(word, longs[k]) == 0);
+                } else if (strncmp(word, longs[k], len) == 0) {
+                    args->values[args->num_values++] = word + len;
+                    known = 1;
+                }
+            }
+            if (!known) return -1;
+            continue;
+        }
+        for (char* c = word + 1; *c != '\0'; c++) {
+            if (strchr(valued, *c) != NULL) {
+                char* value = (c[1] != '\0') ? c + 1 : argv[++i];
+                if (value == NULL) return -1;
+                args->values[args->num_values++] = value;
+                break;
+            }
+            if (strchr(flags, *c) == NULL) return -1;
+        }
+    }
+    return 0;
+}
+
+// a sed script of a single s or y command without an address -- s/re/text/ with flags from g, p, i, I and digits
+// nothing else in sed is safe to cut at a line boundary: addresses count lines, and N, D, h, g and x carry
+// text from one line to the next
+static int is_sed_substitution(const char* script) {
+    if ((script[0] != 's' && script[0] != 'y') || script[1] == '\0' || script[1] == '\\' || script[1] == '\n') {
+        return 0;
+    }
+    char delimiter = script[1];
+    const char* p = script + 2;
+    for (int part = 0; part < 2; part++) {
+        while (*p != '\0' && *p != delimiter) {
+            if (*p == '\\' && p[1] != '\0') p++;
+            p++;
+        }
+        if (*p == '\0') return 0;
+        p++;
+    }
+    if (script[0] == 'y') return (*p == '\0');
+    return (strspn(p, "gpiI0123456789") == strlen(p));
+}
+
+int is_line_stateless(command_t* cmd) {
+    if (cmd == NULL || cmd->argv == NULL || cmd->argv[0] == NULL || cmd->has_input_redir) return 0;
+    if (cmd->argc >= MAX_ARGS) return 0;
+
+    const char* name = cmd->argv[0];
+    stage_args_t args;
+    if (strcmp(name, "grep") == 0 || strcmp(name, "egrep") == 0 || strcmp(name, "fgrep") == 0) {
+        // the pattern is the only operand unless -e or -f gave it -- a file operand means no stdin
+        if (scan_stage_args(cmd->argv, "EFGPivwxyohHsa", "ef", grep_long_options, &args) == -1) return 0;
+        return (args.num_operands == ((args.num_values > 0) ? 0 : 1));
+    }
+    if (strcmp(name, "cut") == 0) {
+        if (scan_stage_args(cmd->argv, "sn", "bcfd", cut_long_options, &args) == -1) return 0;
+        return (args.num_operands == 0);
+    }
+    if (strcmp(name, "tr") == 0) {
+        if (scan_stage_args(cmd->argv, "cCdt", "", tr_long_options, &args) == -1) return 0;
+        return (args.num_operands == 1 || args.num_operands == 2);
+    }
+    if (strcmp(name, "sed") == 0) {
+        // the script is the first operand unless -e gave it
+        if (scan_stage_args(cmd->argv, "nEru", "e", sed_long_options, &args) == -1) return 0;
+        char** scripts = (args.num_values > 0) ? args.values : args.operands;
+        int num_scripts = (args.num_values > 0) ? args.num_values : 1;
+        if (args.num_operands != ((args.num_values > 0) ? 0 : 1)) return 0;
+        for (int k = 0; k < num_scripts; k++) {
+            if (!is_sed_substitution(scripts[k])) return 0;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// forks a replica of cmd reading shard->input and writing to a pipe of its own -- 0 on success, -1 on failure
+static int start_shard(command_t* cmd, shard_t* shard) {
+    int in_pipe[2], out_pipe[2];
+    if (pipe(in_pipe) == -1) {
+        handle_error(ERROR_PIPE_FAILED, "shard input");
+        return -1;
+    }
+    if (pipe(out_pipe) == -1) {
+        handle_error(ERROR_PIPE_FAILED, "shard output");
+        close(in_pipe[0]);
+        close(in_pipe[1]);
+        return -1;
+    }
+    // close-on-exec -- no replica may hold another one's pipes open
+    for (int k = 0; k < 2; k++) {
+        fcntl(in_pipe[k], F_SETFD, FD_CLOEXEC);
+        fcntl(out_pipe[k], F_SETFD, FD_CLOEXEC);
+    }
+
+    shard->pid = fork();
+    if (shard->pid == -1) {
+        handle_error(ERROR_FORK_FAILED, cmd->argv[0]);
+        close(in_pipe[0]);
+        close(in_pipe[1]);
+        close(out_pipe[0]);
+        close(out_pipe[1]);
+        return -1;
+    }
+    if (shard->pid == 0) {
+        if (dup2(in_pipe[0], STDIN_FILENO) == -1 || dup2(out_pipe[1], STDOUT_FILENO) == -1) {
+            handle_error(ERROR_DUP2_FAILED, "shard pipes");
+            exit(EXIT_FAILURE);
+        }
+        execvp(cmd->argv[0], cmd->argv);
+        PROBE2(exec_failed, cmd->argv[0], errno);
+        if (errno == ENOENT) fprintf(stderr, "Command not found: %s\n", cmd->argv[0]);
+        else if (errno == EACCES) fprintf(stderr, "Permission denied: %s\n", cmd->argv[0]);
+        else handle_error(ERROR_EXEC_FAILED, cmd->argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    close(in_pipe[0]);
+    close(out_pipe[1]);
+    // the chunk is fed between reads of every replica's output, never with a blocking write
+    fcntl(in_pipe[1], F_SETFL, O_NONBLOCK);
+    shard->in_fd = in_pipe[1];
+    shard->out_fd = out_pipe[0];
+    shard->input_sent = 0;
+    shard->output = NULL;
+    shard->output_len = shard->output_cap = 0;
+    if (shard->input_len == 0) {
+        close(shard->in_fd);
+        shard->in_fd = -1;
+    }
+    return 0;
+}
+
+// writes more of a replica's chunk -- closes its stdin once all of it is written or the replica stopped reading
+static void feed_shard(shard_t* shard, short revents) {
+    if (!(revents & POLLERR)) {
+        ssize_t bytes = write(shard->in_fd, shard->input + shard->input_sent, shard->input_len - shard->input_sent);
+        if (bytes > 0) shard->input_sent += (size_t)bytes;
+        if (bytes > 0 || errno == EAGAIN || errno == EINTR) {
+            if (shard->input_sent < shard->input_len) return;
+        }
+    }
+    close(shard->in_fd);
+    shard->in_fd = -1;
+    free(shard->input);
+    shard->input = NULL;
+}
+
+// reads what a replica has written -- closes its stdout at end of file
+static int drain_shard(shard_t* shard) {
+    if (shard->output_cap - shard->output_len < PARALLEL_READ_SIZE) {
+        size_t cap = (shard->output_cap > 0) ? shard->output_cap * 2 : PARALLEL_READ_SIZE * 4;
+        char* output = realloc(shard->output, cap);
+        if (output == NULL) {
+            handle_error(ERROR_MALLOC_FAILED, "shard output");
+            return -1;
+        }
+        shard->output = output;
+        shard->output_cap = cap;
+    }
+    ssize_t bytes = read(shard->out_fd, shard->output + shard->output_len, shard->output_cap - shard->output_len);
+    if (bytes > 0) {
+        shard->output_len += (size_t)bytes;
+    } else if (bytes == 0 || errno != EINTR) {
+        close(shard->out_fd);
+        shard->out_fd = -1;
+    }
+    return 0;
+}
+
+// writes all of data to fd -- 0 on success, -1 on failure
+static int write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t bytes = write(fd, data, len);
+        if (bytes == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += bytes;
+        len -= (size_t)bytes;
+    }
+    return 0;
+}
+
+// the body of a sharded stage's child -- runs up to replicas copies of cmd, each over its own line-aligned
+// chunk of stdin, and passes their outputs to stdout in input order; returns the stage's exit code
+// chunk k + replicas starts once chunk k's replica is done, so at most replicas chunks and their outputs are held;
+// the oldest chunk's output is passed on as it arrives
+// exit code: the first replica failure other than 1, else 0 if any replica exited 0, else 1 -- grep's
+// "matched somewhere", and the 0 sed, cut and tr exit with
+static int run_parallel_stage(command_t* cmd, int replicas) {
+    // this stage never execs, so its copy of the exec probe must go now or timing would wait for it to exit
+    if (exec_probe[0] != -1) {
+        close(exec_probe[0]);
+        close(exec_probe[1]);
+        exec_probe[0] = exec_probe[1] = -1;
+    }
+
+    shard_t shards[replicas];
+    int head = 0;             // slot of the oldest running chunk
+    int active = 0;           // running chunks
+    int started = 0;
+    int input_eof = 0;
+    int failure = 0;
+    int matched = 0;
+    size_t pending_cap = PARALLEL_CHUNK_SIZE + PARALLEL_READ_SIZE;
+    size_t pending_len = 0;
+    char* pending = malloc(pending_cap);
+    if (pending == NULL) {
+        handle_error(ERROR_MALLOC_FAILED, "shard input");
+        return EXIT_FAILURE;
+    }
+
+    while (1) {
+        // a replica for every complete chunk while a slot is free -- empty input still runs one
+        while (active < replicas && !failure) {
+            size_t cut = pending_len;
+            if (!input_eof) {
+                if (pending_len < PARALLEL_CHUNK_SIZE) break;
+                while (cut > 0 && pending[cut - 1] != '\n') cut--;
+                if (cut == 0) break;
+            } else if (pending_len == 0 && started > 0) {
+                break;
+            }
+            char* rest = malloc(pending_cap);
+            if (rest == NULL) {
+                handle_error(ERROR_MALLOC_FAILED, "shard input");
+                failure = EXIT_FAILURE;
+                break;
+            }
+            memcpy(rest, pending + cut, pending_len - cut);
+
+            shard_t* shard = &shards[(head + active) % replicas];
+            shard->input = pending;
+            shard->input_len = cut;
+            pending = rest;
+            pending_len -= cut;
+            if (start_shard(cmd, shard) == -1) {
+                free(shard->input);
+                failure = EXIT_FAILURE;
+                break;
+            }
+            active++;
+            started++;
+        }
+        // a failed start ends the input -- the chunks already running still finish
+        if (failure) input_eof = 1;
+
+        // pass on the oldest chunk's output, and retire it once its replica is done
+        while (active > 0) {
+            shard_t* shard = &shards[head];
+            if (shard->output_len > 0) {
+                if (write_all(STDOUT_FILENO, shard->output, shard->output_len) == -1) {
+                    perror("Error: write failed in sharded stage");
+                    exit(EXIT_FAILURE);
+                }
+                shard->output_len = 0;
+            }
+            if (shard->in_fd != -1 || shard->out_fd != -1) break;
+
+            int status;
+            while (waitpid(shard->pid, &status, 0) == -1) {
+                if (errno != EINTR) { status = 0; break; }
+            }
+            int code = stage_exit_code(status);
+            if (code == 0) matched = 1;
+            else if (code != 1 && failure == 0) failure = code;
+            free(shard->output);
+            head = (head + 1) % replicas;
+            active--;
+        }
+        if (active == 0 && input_eof && (pending_len == 0 || failure)) break;
+
+        // stdin while a chunk could still start, every replica's stdin and stdout
+        struct pollfd fds[2 * replicas + 1];
+        int shard_of[2 * replicas + 1];
+        nfds_t count = 0;
+        if (!input_eof && active < replicas) {
+            fds[count].fd = STDIN_FILENO;
+            fds[count].events = POLLIN;
+            shard_of[count++] = -1;
+        }
+        for (int k = 0; k < active; k++) {
+            int slot = (head + k) % replicas;
+            if (shards[slot].in_fd != -1) {
+                fds[count].fd = shards[slot].in_fd;
+                fds[count].events = POLLOUT;
+                shard_of[count++] = slot;
+            }
+            if (shards[slot].out_fd != -1) {
+                fds[count].fd = shards[slot].out_fd;
+                fds[count].events = POLLIN;
+                shard_of[count++] = slot;
+            }
+        }
+        if (count == 0) continue;
+        if (poll(fds, count, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("Error: poll failed in sharded stage");
+            exit(EXIT_FAILURE);
+        }
+
+        for (nfds_t k = 0; k < count; k++) {
+            if (fds[k].revents == 0) continue;
+            if (shard_of[k] == -1) {
+                if (pending_len == pending_cap) {
+                    char* grown = realloc(pending, pending_cap * 2);
+                    if (grown == NULL) {
+                        handle_error(ERROR_MALLOC_FAILED, "shard input");
+                        exit(EXIT_FAILURE);
+                    }
+                    pending = grown;
+                    pending_cap *= 2;
+                }
+                ssize_t bytes = read(STDIN_FILENO, pending + pending_len, pending_cap - pending_len);
+                if (bytes > 0) {
+                    pending_len += (size_t)bytes;
+                } else if (bytes == 0) {
+                    input_eof = 1;
+                } else if (errno != EINTR) {
+                    perror("Error: read failed in sharded stage");
+                    input_eof = 1;
+                    failure = EXIT_FAILURE;
+                }
+            } else if (fds[k].events == POLLOUT) {
+                feed_shard(&shards[shard_of[k]], fds[k].revents);
+            } else if (drain_shard(&shards[shard_of[k]]) == -1) {
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    free(pending);
+    if (failure) return failure;
+    return matched ? 0 : 1;
+}
+
 // execute a parsed pipeline by creating pipes, forking children, wiring fds, and waiting
 int execute_pipeline(pipeline_t* pipeline) {
     if (!pipeline || pipeline->num_commands == 0) { handle_error(ERROR_INVALID_COMMAND, "empty pipeline"); return -1; }
     
+    // phase timing and per-stage report (no-ops unless pipeline_timing / pipeline_report are set)
+    timing_start();
+    report_start(pipeline->num_commands);
+    
     // handle the degenerate case of a single command without creating any pipe()
     if (pipeline->num_commands == 1) {
         // if the pipeline requested input redirection, transfer it to the single command and clear pipeline storage
         if (pipeline->input_file) { pipeline->commands[0]->input_file = pipeline->input_file; pipeline->commands[0]->has_input_redir = 1; pipeline->input_file = NULL; }
         if (pipeline->output_file) { pipeline->commands[0]->output_file = pipeline->output_file; pipeline->commands[0]->has_output_redir = 1; pipeline->output_file = NULL; }
         if (pipeline->error_file) { pipeline->commands[0]->error_file = pipeline->error_file; pipeline->commands[0]->has_error_redir = 1; pipeline->error_file = NULL; }
-        return execute_simple_command(pipeline->commands[0]);
+        int single_status = execute_simple_command(pipeline->commands[0]);
+        timing_finished();
+        return single_status;
     }
     
     int num_pipes = pipeline->num_commands - 1;
     // declare a variable-length array to hold pipe file descriptors [read, write] for each pipe
     int pipes[num_pipes][2];
     pid_t pids[pipeline->num_commands];
+    int pidfds[pipeline->num_commands];     // exit events, -1 where pidfd_open() is unavailable
     
     // create all pipes up front
     for (int i = 0; i < num_pipes; i++) {
@@ -1733,6 +2392,7 @@ int execute_pipeline(pipeline_t* pipeline) {
             handle_error(ERROR_PIPE_FAILED, "pipe creation");
             // close any previously created pipes to avoid leaks
             for (int j = 0; j < i; j++) { close(pipes[j][0]); close(pipes[j][1]); }
+            timing_finished();
             // abort execution
             return -1;
         }
@@ -1750,7 +2410,8 @@ int execute_pipeline(pipeline_t* pipeline) {
             // close all pipe fds since we are aborting
             for (int j = 0; j < num_pipes; j++) { close(pipes[j][0]); close(pipes[j][1]); }
             // reap any children already successfully forked to avoid zombies
-            for (int j = 0; j < i; j++) waitpid(pids[j], NULL, 0);
+            for (int j = 0; j < i; j++) { waitpid(pids[j], NULL, 0); if (pidfds[j] != -1) close(pidfds[j]); }
+            timing_finished();
             // abort
             return -1;
         // child branch
@@ -1807,6 +2468,11 @@ int execute_pipeline(pipeline_t* pipeline) {
             // in the child, close all pipe fds -- we keep only the dup2'ed ones
             for (int j = 0; j < num_pipes; j++) { close(pipes[j][0]); close(pipes[j][1]); }
             
+            // a line-stateless stage runs as pipeline_parallel replicas over chunks of its input
+            if (pipeline_parallel > 1 && is_line_stateless(pipeline->commands[i])) {
+                exit(run_parallel_stage(pipeline->commands[i], pipeline_parallel));
+            }
+
             // check if this is a built-in command
             if (is_builtin_command(pipeline->commands[i])) {
                 int result = 0;
@@ -1818,6 +2484,7 @@ int execute_pipeline(pipeline_t* pipeline) {
             
             // execute the actual command for this pipeline stage
             if (execvp(pipeline->commands[i]->argv[0], pipeline->commands[i]->argv) == -1) {
+                PROBE2(exec_failed, pipeline->commands[i]->argv[0], errno);
                 // provide nicer messages for common failures
                 if (errno == ENOENT) fprintf(stderr, "Command not found: %s\n", pipeline->commands[i]->argv[0]);
                 else if (errno == EACCES) fprintf(stderr, "Permission denied: %s\n", pipeline->commands[i]->argv[0]);
@@ -1826,21 +2493,345 @@ int execute_pipeline(pipeline_t* pipeline) {
                 exit(EXIT_FAILURE);
             }
         }
+        // parent -- stage i is running, its exit becomes pollable
+        PROBE2(stage_spawn, i, pids[i]);
+        pidfds[i] = open_child_pidfd(pids[i]);
     }
     
     // in the parent, close all pipe file descriptors as they are no longer needed here
     for (int i = 0; i < num_pipes; i++) { close(pipes[i][0]); close(pipes[i][1]); }
     
+    // every stage is forked -- when timing, wait until each one has exec'd
+    timing_forked();
+    
     // wait for all child processes and propagate the last command's exit status
     int status, last_status = 0;
-    // iterate over child pids in order
-    for (int i = 0; i < pipeline->num_commands; i++) {
-        // wait for the ith child to finish
-        if (waitpid(pids[i], &status, 0) == -1) { handle_error(ERROR_INVALID_COMMAND, "wait failed in pipeline"); return -1; }
-        // capture the last child's exit status if it exited normally
-        if (i == pipeline->num_commands - 1) last_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    struct rusage usage;
+    // once a stage has exited, everything upstream of it writes into a pipe nobody will read -- those
+    // stages are sent SIGPIPE at once (what their next write would get), and SIGKILL after
+    // PIPELINE_STOP_GRACE_MS if they ignore it or never write again; "yes | head -5" or a failed
+    // middle stage then finishes as soon as its last useful stage has, downstream stages see EOF as usual
+    int stopped = 0;            // stages below this index have been sent SIGPIPE
+    int killed = 0;             // ... and below this one SIGKILL
+    double kill_at = 0;
+    // reap the stages in the order they exit -- wait4() also collects each one's resource usage
+    for (int reaped = 0; reaped < pipeline->num_commands; ) {
+        int wait_ms = -1;
+        if (killed < stopped) {
+            double remaining = kill_at - timing_now();
+            wait_ms = (remaining > 0) ? (int)(remaining * 1000.0) + 1 : 0;
+        }
+        pid_t pid;
+        int i = reap_next_stage(pids, pidfds, pipeline->num_commands, wait_ms, &pid, &status, &usage);
+        if (i == REAP_TIMEOUT) {
+            signal_stages(pids, killed, stopped, SIGKILL);
+            killed = stopped;
+            continue;
+        }
+        if (i == -1) {
+            handle_error(ERROR_INVALID_COMMAND, "wait failed in pipeline");
+            for (int j = 0; j < pipeline->num_commands; j++) if (pidfds[j] != -1) close(pidfds[j]);
+            timing_finished();
+            return -1;
+        }
+        int exit_code = stage_exit_code(status);
+        PROBE3(stage_exit, i, pid, exit_code);
+        report_stage(i, pid, exit_code, &usage);
+        // capture the last child's exit status -- 128 + signal if it was killed, like the shell does
+        if (i == pipeline->num_commands - 1) last_status = exit_code;
+        reaped++;
+
+        // stop everything upstream of the stage that just went away
+        if (i > stopped) {
+            if (killed == stopped) kill_at = timing_now() + PIPELINE_STOP_GRACE_MS / 1000.0;
+            signal_stages(pids, stopped, i, SIGPIPE);
+            stopped = i;
+        }
     }
     
+    timing_finished();
+    
     // return the exit status of the final command in the pipeline
     return last_status;
 }
+
+
+// command lists -- see command_list_t in shell_utils.h
+
+// finds where the list element starting at input ends -- at a ';', '&&' or '||' outside quotes and parentheses,
+// or at the terminator; a lone '|' is a pipe and stays inside the element
+// returns a pointer to the operator or terminator, NULL if the parentheses do not balance
+// with close_group set, input starts with '(' and the result is its closing ')' instead
+static const char* find_list_operator(const char* input, int close_group) {
+    int depth = 0;
+    char quote = '\0';
+    for (const char* p = input; *p; p++) {
+        if (quote) {
+            if (*p == quote) quote = '\0';
+            else if (*p == '\\' && quote == '"' && p[1]) p++;
+            continue;
+        }
+        if (*p == '\\' && p[1]) { p++; continue; }
+        if (*p == '\'' || *p == '"') { quote = *p; continue; }
+        if (*p == '(') { depth++; continue; }
+        if (*p == ')') {
+            if (--depth < 0) return NULL;
+            if (depth == 0 && close_group) return p;
+            continue;
+        }
+        if (depth > 0) continue;
+        if (*p == ';' || (p[0] == '&' && p[1] == '&') || (p[0] == '|' && p[1] == '|')) return p;
+    }
+    return (depth == 0 && !close_group) ? input + strlen(input) : NULL;
+}
+
+// 1 if text holds c outside quotes (and not escaped with a backslash)
+static int has_unquoted(const char* text, char c) {
+    char quote = '\0';
+    for (const char* p = text; *p; p++) {
+        if (quote) {
+            if (*p == quote) quote = '\0';
+            else if (*p == '\\' && quote == '"' && p[1]) p++;
+            continue;
+        }
+        if (*p == '\\' && p[1]) { p++; continue; }
+        if (*p == '\'' || *p == '"') { quote = *p; continue; }
+        if (*p == c) return 1;
+    }
+    return 0;
+}
+
+// parse_pipeline() works on its own copy -- the pipeline keeps nothing that points into it
+static pipeline_t* parse_entry_pipeline(const char* text) {
+    char* copy = strdup(text);
+    if (copy == NULL) { handle_error(ERROR_MALLOC_FAILED, "command list entry"); return NULL; }
+    pipeline_t* pipeline = parse_pipeline(copy);
+    free(copy);
+    return pipeline;
+}
+
+// the redirections written after a group's ')' -- parse_command_line() needs a command word in front of them,
+// only the redirection fields of the result are used
+static command_t* parse_group_redirections(const char* text) {
+    size_t len = strlen(text);
+    char* line = malloc(len + sizeof("group "));
+    if (line == NULL) { handle_error(ERROR_MALLOC_FAILED, "group redirection"); return NULL; }
+    memcpy(line, "group ", sizeof("group ") - 1);
+    memcpy(line + sizeof("group ") - 1, text, len + 1);
+    command_t* redir = parse_command_line(line);
+    free(line);
+    if (redir != NULL && redir->argc != 1) {
+        // anything left besides the redirections was neither a redirection nor a pipe
+        fprintf(stderr, "Error: Unexpected text after command group: %s\n", text);
+        free_command(redir);
+        return NULL;
+    }
+    return redir;
+}
+
+// fills in a list entry from its trimmed text -- "( list )" becomes a group (with its redirections and
+// the pipeline its output goes to, if any), anything else a pipeline
+// returns 0 on success, -1 on a syntax error (already printed)
+static int parse_list_entry(list_entry_t* entry, const char* text) {
+    entry->text = strdup(text);
+    if (entry->text == NULL) { handle_error(ERROR_MALLOC_FAILED, "command list entry"); return -1; }
+
+    if (text[0] != '(') {
+        // a group past the first stage would reach execvp() as a command named "(..."
+        const char* pipe_at = strchr(text, '|');
+        if (pipe_at != NULL && has_unquoted(pipe_at, '(')) {
+            fprintf(stderr, "Error: A command group can only be the first stage of a pipeline: %s\n", text);
+            return -1;
+        }
+        entry->pipeline = parse_entry_pipeline(text);
+        return (entry->pipeline != NULL) ? 0 : -1;
+    }
+
+    const char* close = find_list_operator(text, 1);
+    if (close == NULL) {
+        fprintf(stderr, "Error: Unbalanced parentheses\n");
+        return -1;
+    }
+    char* inner = strndup(text + 1, (size_t)(close - text - 1));
+    if (inner == NULL) { handle_error(ERROR_MALLOC_FAILED, "command group"); return -1; }
+    if (is_empty_string(inner)) {
+        fprintf(stderr, "Error: Empty command group\n");
+        free(inner);
+        return -1;
+    }
+    entry->group = parse_command_list(inner);
+    free(inner);
+    if (entry->group == NULL) return -1;
+
+    // after the ')' -- redirections of the group itself, then "| pipeline" for its output
+    // (split at the first '|', as parse_pipeline() splits its stages)
+    char* tail = strdup(close + 1);
+    if (tail == NULL) { handle_error(ERROR_MALLOC_FAILED, "command group"); return -1; }
+    char* pipe_at = strchr(tail, '|');
+    if (pipe_at != NULL) *pipe_at = '\0';
+    int result = 0;
+    if (!is_empty_string(tail)) {
+        entry->group_redir = parse_group_redirections(trim_whitespace(tail));
+        if (entry->group_redir == NULL) result = -1;
+    }
+    if (result == 0 && pipe_at != NULL) {
+        char* rest = trim_whitespace(pipe_at + 1);
+        if (*rest == '\0') {
+            fprintf(stderr, "Error: Command missing after pipe\n");
+            result = -1;
+        } else if (has_unquoted(rest, '(')) {
+            fprintf(stderr, "Error: A command group can only be the first stage of a pipeline: %s\n", text);
+            result = -1;
+        } else {
+            entry->pipeline = parse_entry_pipeline(rest);
+            if (entry->pipeline == NULL) result = -1;
+        }
+    }
+    free(tail);
+    return result;
+}
+
+// parse a command line of pipelines joined by ;, && and || into a command_list_t
+command_list_t* parse_command_list(char* input) {
+    command_list_t* list = calloc(1, sizeof(command_list_t));
+    if (!list) { handle_error(ERROR_MALLOC_FAILED, "parse_command_list"); return NULL; }
+
+    int capacity = 0;
+    list_op_t op = LIST_SEQ;
+    const char* element = input;
+    while (1) {
+        const char* end = find_list_operator(element, 0);
+        if (end == NULL) {
+            fprintf(stderr, "Error: Unbalanced parentheses\n");
+            free_command_list(list);
+            return NULL;
+        }
+
+        char* text = strndup(element, (size_t)(end - element));
+        if (!text) { handle_error(ERROR_MALLOC_FAILED, "command list element"); free_command_list(list); return NULL; }
+        char* trimmed = trim_whitespace(text);
+
+        if (*trimmed == '\0') {
+            free(text);
+            // a trailing ';' ends the list like the shell allows; an empty command anywhere else is an error
+            if (*end == '\0' && op == LIST_SEQ && list->num_entries > 0) break;
+            fprintf(stderr, "Error: Missing command %s '%s'\n", (*end == '\0') ? "after" : "before",
+                    (*end == '\0') ? ((op == LIST_AND) ? "&&" : (op == LIST_OR) ? "||" : ";")
+                                   : ((*end == ';') ? ";" : (*end == '&') ? "&&" : "||"));
+            free_command_list(list);
+            return NULL;
+        }
+
+        if (list->num_entries == capacity) {
+            capacity = capacity ? capacity * 2 : 4;
+            list_entry_t* grown = realloc(list->entries, (size_t)capacity * sizeof(list_entry_t));
+            if (!grown) { handle_error(ERROR_MALLOC_FAILED, "command list entries"); free(text); free_command_list(list); return NULL; }
+            list->entries = grown;
+        }
+        list_entry_t* entry = &list->entries[list->num_entries++];
+        memset(entry, 0, sizeof(*entry));
+        entry->op = op;
+        int parsed = parse_list_entry(entry, trimmed);
+        free(text);
+        if (parsed == -1) { free_command_list(list); return NULL; }
+
+        if (*end == '\0') break;
+        op = (*end == ';') ? LIST_SEQ : (*end == '&') ? LIST_AND : LIST_OR;
+        element = end + ((op == LIST_SEQ) ? 1 : 2);
+    }
+    return list;
+}
+
+// runs a group in a forked subshell, so a cd inside it stays inside it
+// with a pipeline after the group, the subshell's stdout is a pipe that becomes the pipeline's stdin --
+// the subshell's redirections are applied on top, so "( list ) > file | wc" writes to the file like the shell does
+// returns the subshell's status, or the pipeline's when there is one
+static int execute_list_group(const list_entry_t* entry) {
+    int pipe_fds[2] = { -1, -1 };
+    if (entry->pipeline != NULL && pipe(pipe_fds) == -1) { handle_error(ERROR_PIPE_FAILED, "( ) |"); return -1; }
+
+    // buffered output of earlier entries must not be written twice, by the subshell and by us
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == -1) {
+        handle_error(ERROR_FORK_FAILED, "( )");
+        if (pipe_fds[0] != -1) { close(pipe_fds[0]); close(pipe_fds[1]); }
+        return -1;
+    }
+    if (pid == 0) {
+        if (pipe_fds[1] != -1) {
+            dup2(pipe_fds[1], STDOUT_FILENO);
+            close(pipe_fds[0]);
+            close(pipe_fds[1]);
+        }
+        if (entry->group_redir != NULL && setup_redirection(entry->group_redir) != 0) exit(EXIT_FAILURE);
+        int status = execute_command_list(entry->group);
+        fflush(stdout);
+        exit(status);
+    }
+
+    int result = 0;
+    if (entry->pipeline != NULL) {
+        // the pipeline's first stage inherits stdin -- point it at the group for the duration
+        int saved_stdin = dup(STDIN_FILENO);
+        dup2(pipe_fds[0], STDIN_FILENO);
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        result = execute_pipeline(entry->pipeline);
+        if (saved_stdin != -1) {
+            dup2(saved_stdin, STDIN_FILENO);
+            close(saved_stdin);
+        }
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR) { handle_error(ERROR_INVALID_COMMAND, "wait failed for group"); return -1; }
+    }
+    return (entry->pipeline != NULL) ? result : stage_exit_code(status);
+}
+
+// execute a command list entry by entry -- && and || look at the status of the last entry that ran
+int execute_command_list(command_list_t* list) {
+    if (!list || list->num_entries == 0) { handle_error(ERROR_INVALID_COMMAND, "empty command list"); return -1; }
+
+    int status = 0;
+    for (int i = 0; i < list->num_entries; i++) {
+        list_entry_t* entry = &list->entries[i];
+        if ((entry->op == LIST_AND && status != 0) || (entry->op == LIST_OR && status == 0)) continue;
+
+        command_t* first = entry->pipeline ? entry->pipeline->commands[0] : NULL;
+        const char* name = (first && first->argv) ? first->argv[0] : NULL;
+        if (entry->group) {
+            status = execute_list_group(entry);
+        } else if (entry->pipeline->num_commands == 1 && name != NULL && strcmp(name, "cd") == 0) {
+            status = builtin_cd(first);
+        } else if (entry->pipeline->num_commands == 1 && name != NULL && strcmp(name, "export") == 0) {
+            status = builtin_export(first);
+        } else if (entry->pipeline->num_commands == 1 && name != NULL && strcmp(name, "unset") == 0) {
+            status = builtin_unset(first);
+        } else {
+            status = execute_pipeline(entry->pipeline);
+        }
+        entry->ran = 1;
+        entry->exit_code = status;
+        // a built-in's stdio output goes out before the next entry's children write theirs
+        fflush(stdout);
+        fflush(stderr);
+    }
+    return status;
+}
+
+// free an entire command_list_t including its pipelines, groups and entry texts
+void free_command_list(command_list_t* list) {
+    if (!list) return;
+    for (int i = 0; i < list->num_entries; i++) {
+        free_pipeline(list->entries[i].pipeline);
+        free_command_list(list->entries[i].group);
+        if (list->entries[i].group_redir != NULL) free_command(list->entries[i].group_redir);
+        free(list->entries[i].text);
+    }
+    free(list->entries);
+    free(list);
+}
@@ -11,6 +11,7 @@
 #include <sys/types.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/resource.h>
 
 // declaring these values as constants -- max size for various components
 #define MAX_INPUT_SIZE 1024
@@ -62,6 +63,71 @@ typedef struct {
     char* error_file;         // error redirection
 } pipeline_t;
 
+// command list -- pipelines and ( ) groups joined by ;, && and ||, evaluated left to right like the shell does:
+// an && entry runs only if the status so far is 0, an || entry only if it is not, a ; entry always
+// a group may take <, > and 2> redirections and start a pipeline -- "( list ) > file", "( list ) | wc -l";
+// it cannot be a later stage of one
+typedef enum {
+    LIST_SEQ,                 // first entry, or after ';'
+    LIST_AND,                 // after '&&'
+    LIST_OR                   // after '||'
+} list_op_t;
+
+typedef struct command_list command_list_t;
+
+typedef struct {
+    list_op_t op;             // how this entry joins the one before it
+    pipeline_t* pipeline;     // the entry's pipeline -- after a group, the stages its output is piped to (NULL for none)
+    command_list_t* group;    // "( list )" run in a subshell, or NULL for a pipeline
+    command_t* group_redir;   // the group's redirections (only the redirection fields are set), NULL for none
+    char* text;               // the entry as written, for status reports
+    int ran;                  // 1 once executed, 0 if && or || skipped it
+    int exit_code;            // the entry's status if it ran
+} list_entry_t;
+
+struct command_list {
+    list_entry_t* entries;    // in the order written
+    int num_entries;
+};
+
+// optional phase timestamps for execute_pipeline() -- CLOCK_MONOTONIC seconds
+// the server points pipeline_timing at one of these to see where a command's time went
+// NULL (the default) disables timing
+typedef struct {
+    double start;             // execute_pipeline() entered
+    double forked;            // every stage forked
+    double execed;            // every stage has exec'd (or exited without exec'ing)
+    double finished;          // every stage reaped
+} pipeline_timing_t;
+
+extern pipeline_timing_t* pipeline_timing;
+
+// optional per-stage outcome for execute_pipeline() -- filled in as each stage is reaped
+// the server points pipeline_report at one of these to log what every stage of a slow command cost
+// NULL (the default) disables the report
+#define PIPELINE_REPORT_STAGES (MAX_PIPES + 1)
+
+typedef struct {
+    pid_t pid;                // 0 for a built-in run by the shell process itself
+    int exit_code;            // 128 + signal if killed, -1 if not reaped
+    struct rusage usage;      // from wait4(), zero for a built-in
+} pipeline_stage_t;
+
+typedef struct {
+    int num_stages;           // stages in the pipeline -- only the first PIPELINE_REPORT_STAGES are kept
+    pipeline_stage_t stages[PIPELINE_REPORT_STAGES];
+} pipeline_report_t;
+
+extern pipeline_report_t* pipeline_report;
+
+// optional data-parallel stages for execute_pipeline() -- a line-stateless stage (see is_line_stateless())
+// runs as this many replicas, each over its own line-aligned chunk of the stage's input, and their outputs
+// are merged back in input order; the server sets it per command (-P, @par)
+// 1 (the default) runs every stage once
+#define PIPELINE_PARALLEL_MAX 64
+
+extern int pipeline_parallel;
+
 
 // function prototypes for basic shell operations
 
@@ -106,6 +172,16 @@ int execute_pipeline(pipeline_t* pipeline);
 // frees memory allocated for pipeline_t structure
 void free_pipeline(pipeline_t* pipeline);
 
+// parses a command line of pipelines joined by ;, && and || (quotes respected, ( ) groups nested)
+// returns the list, NULL on a syntax error (already printed)
+command_list_t* parse_command_list(char* input);
+
+// executes a command list, recording each entry's outcome -- returns the status of the last entry that ran
+int execute_command_list(command_list_t* list);
+
+// frees memory allocated for command_list_t structure, groups included
+void free_command_list(command_list_t* list);
+
 // counts the number of pipes in input string -- returns number of pipe characters found
 int count_pipes(const char* input);
 
@@ -118,4 +194,26 @@ int is_builtin_command(command_t* cmd);
 // executes built-in echo command
 int builtin_echo(command_t* cmd);
 
+// executes built-in cd command -- changes the shell process's own working directory, HOME without an argument
+int builtin_cd(command_t* cmd);
+
+// executes built-in export command -- NAME=value arguments set variables in the shell process's own environment,
+// no argument lists the environment
+int builtin_export(command_t* cmd);
+
+// executes built-in unset command -- removes the named variables from the shell process's own environment
+int builtin_unset(command_t* cmd);
+
+// checks if a name can be an environment variable -- letters, digits and '_', not starting with a digit
+int is_valid_env_name(const char* name, size_t len);
+
+// checks if a pipeline stage can be sharded -- grep, cut, tr, or sed with s/// and y/// scripts only, reading
+// stdin, with no option that carries state from one line to the next (counts, line numbers, context, hold space)
+// returns 1 if each line's output depends on that line alone, 0 otherwise
+int is_line_stateless(command_t* cmd);
+
+// opens a pidfd for child pid -- a close-on-exec descriptor that polls readable once the child has exited,
+// so an exit can wait in the same poll() as pipes and sockets; -1 if the kernel has no pidfd_open() (before 5.3)
+int open_child_pidfd(pid_t pid);
+
 #endif /* SHELL_UTILS_H */
@@ -0,0 +1,367 @@
+// spawn.c -- spawn helper ("zygote") process and the server's side of its socket, see spawn.h
+//
+// the helper is single threaded: one poll() loop over the launch socket and a signalfd for SIGCHLD, so a launch
+// and any number of exits are all just events; a launch is forked at once and its wait socket is kept in
+// a table until the child is reaped -- one SIGCHLD event reaps every child that has exited since the last
+// all sockets are SOCK_SEQPACKET, so every request and reply is one message -- session threads share the
+// launch socket without a lock, each sendmsg() arrives whole
+
+// _GNU_SOURCE for SOCK_CLOEXEC and MSG_CMSG_CLOEXEC
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>      // offsetof()
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/prctl.h>   // prctl(PR_SET_PDEATHSIG)
+#include <sys/socket.h>  // socketpair(), sendmsg(), recvmsg(), SCM_RIGHTS
+#include <sys/signalfd.h> // signalfd() -- SIGCHLD as a pollable event
+#include <sys/wait.h>
+
+#include "spawn.h"
+
+
+// one launch, helper-bound -- sent up to the command's terminator, descriptors ride along
+typedef struct {
+    size_t arg_len;
+    char arg[SPAWN_ARG_MAX];
+    char command[SPAWN_COMMAND_MAX];
+} spawn_request_t;
+
+// helper's answers on a launch's wait socket -- the pid once forked, then the wait status once reaped
+typedef struct {
+    pid_t pid;                // -1 if fork() failed
+    int status;               // waitpid() status, second message only
+    int error;                // errno of a failed fork()
+} spawn_reply_t;
+
+// a child the helper has not reaped yet
+typedef struct {
+    pid_t pid;
+    int wait_fd;
+} spawn_child_t;
+
+// control buffer for the descriptors of one launch plus its wait socket
+typedef union {
+    char buf[CMSG_SPACE(sizeof(int) * (SPAWN_FDS_MAX + 1))];
+    struct cmsghdr align;
+} spawn_control_t;
+
+// server side
+static int helper_fd = -1;                // launch socket, -1 without a helper
+static pid_t helper_pid = -1;
+static int helper_gone = 0;               // set once a launch finds the helper dead
+
+// helper side
+static spawn_child_fn child_main;
+static int sigchld_fd = -1;
+static sigset_t sigchld_mask;
+static spawn_child_t* children = NULL;
+static size_t num_children = 0;
+static size_t max_children = 0;
+
+// prototypes
+static void helper_main(int control_fd);
+static int helper_launch(int control_fd);
+static void helper_reap(void);
+static void send_reply(int fd, pid_t pid, int status, int error);
+static int mark_gone(void);
+
+
+int spawn_helper_start(spawn_child_fn child) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+        perror("Error: socketpair failed for the spawn helper");
+        return -1;
+    }
+
+    child_main = child;
+    pid_t server = getpid();
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("Error: fork failed for the spawn helper");
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        // backstop for a server that dies without closing the launch socket cleanly --
+        // the server may already have exited before prctl() ran, hence the getppid() check
+        if (prctl(PR_SET_PDEATHSIG, SIGKILL) == -1 || getppid() != server) _exit(EXIT_FAILURE);
+        helper_main(sv[1]);
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(sv[1]);
+    helper_fd = sv[0];
+    helper_pid = pid;
+    return 0;
+}
+
+void spawn_helper_stop(void) {
+    if (helper_fd == -1) return;
+    // end of file on the launch socket ends the helper's loop
+    close(helper_fd);
+    helper_fd = -1;
+    while (waitpid(helper_pid, NULL, 0) == -1 && errno == EINTR) {
+        // interrupted -- keep waiting
+    }
+    helper_pid = -1;
+}
+
+int spawn_helper_launch(const char* command, const void* arg, size_t arg_len, const int* fds, int num_fds,
+                        pid_t* pid, int* wait_fd) {
+    if (helper_fd == -1 || __atomic_load_n(&helper_gone, __ATOMIC_RELAXED)) return SPAWN_HELPER_GONE;
+
+    size_t command_len = strlen(command) + 1;
+    if (command_len > SPAWN_COMMAND_MAX || arg_len > SPAWN_ARG_MAX || num_fds > SPAWN_FDS_MAX) {
+        errno = E2BIG;
+        return -1;
+    }
+
+    // the launch's own socket -- the helper gets one end with the child's descriptors
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) return -1;
+
+    spawn_request_t request;
+    request.arg_len = arg_len;
+    memcpy(request.arg, arg, arg_len);
+    memcpy(request.command, command, command_len);
+
+    struct iovec iov;
+    iov.iov_base = &request;
+    iov.iov_len = offsetof(spawn_request_t, command) + command_len;
+
+    spawn_control_t control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * (size_t)(num_fds + 1));
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * (size_t)(num_fds + 1));
+    int* passed = (int*)CMSG_DATA(cmsg);
+    memcpy(passed, fds, sizeof(int) * (size_t)num_fds);
+    passed[num_fds] = sv[1];
+
+    ssize_t sent;
+    while ((sent = sendmsg(helper_fd, &msg, MSG_NOSIGNAL)) == -1 && errno == EINTR) {
+        // interrupted -- try again
+    }
+    close(sv[1]);
+    if (sent == -1) {
+        int error = errno;
+        close(sv[0]);
+        if (error == EPIPE || error == ECONNRESET || error == ENOTCONN) return mark_gone();
+        errno = error;
+        return -1;
+    }
+
+    // the pid -- the helper answers as soon as it has forked
+    spawn_reply_t reply;
+    ssize_t got;
+    while ((got = recv(sv[0], &reply, sizeof(reply), 0)) == -1 && errno == EINTR) {
+        // interrupted -- keep waiting
+    }
+    if (got != (ssize_t)sizeof(reply)) {
+        close(sv[0]);
+        return mark_gone();
+    }
+    if (reply.pid == -1) {
+        close(sv[0]);
+        errno = reply.error;
+        return -1;
+    }
+
+    *pid = reply.pid;
+    *wait_fd = sv[0];
+    return 0;
+}
+
+int spawn_helper_wait(int wait_fd, int* status) {
+    spawn_reply_t reply;
+    ssize_t got;
+    while ((got = recv(wait_fd, &reply, sizeof(reply), 0)) == -1 && errno == EINTR) {
+        // interrupted -- keep waiting
+    }
+    close(wait_fd);
+    if (got != (ssize_t)sizeof(reply)) return -1;
+    *status = reply.status;
+    return 0;
+}
+
+// the helper is dead -- every later launch is forked by the caller; reaps the helper if it already exited
+static int mark_gone(void) {
+    if (!__atomic_exchange_n(&helper_gone, 1, __ATOMIC_RELAXED)) {
+        waitpid(helper_pid, NULL, WNOHANG);
+    }
+    return SPAWN_HELPER_GONE;
+}
+
+
+// helper process
+// serves launches until the server closes its end of the launch socket
+static void helper_main(int control_fd) {
+    // the server's SIGUSR1 handler (flight recorder dump) is installed after this fork -- a "pkill -USR1 server"
+    // would otherwise take the helper's default action and kill it
+    signal(SIGUSR1, SIG_IGN);
+
+    // blocked, SIGCHLD stays queued for the signalfd instead of being delivered
+    sigemptyset(&sigchld_mask);
+    sigaddset(&sigchld_mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &sigchld_mask, NULL) == -1 ||
+        (sigchld_fd = signalfd(-1, &sigchld_mask, SFD_CLOEXEC | SFD_NONBLOCK)) == -1) {
+        perror("Error: spawn helper signalfd failed");
+        return;
+    }
+
+    struct pollfd fds[2];
+    fds[0].fd = control_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = sigchld_fd;
+    fds[1].events = POLLIN;
+
+    while (1) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            perror("Error: spawn helper poll failed");
+            break;
+        }
+        if (fds[1].revents != 0) {
+            // several exits can share one queued SIGCHLD -- drain, then reap everything that has exited
+            struct signalfd_siginfo info;
+            while (read(sigchld_fd, &info, sizeof(info)) > 0) {
+                // drained
+            }
+            helper_reap();
+        }
+        // a closed launch socket reports POLLIN together with POLLHUP -- recvmsg()'s 0 is what tells them apart
+        if (fds[0].revents != 0 && helper_launch(control_fd) == -1) {
+            // server gone -- children still running finish on their own
+            break;
+        }
+    }
+}
+
+// receives one launch and forks its child
+// returns 0 once the launch is handled (a failed one included), -1 if the server closed the launch socket
+static int helper_launch(int control_fd) {
+    spawn_request_t request;
+    spawn_control_t control;
+    struct iovec iov;
+    iov.iov_base = &request;
+    iov.iov_len = sizeof(request);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t got = recvmsg(control_fd, &msg, MSG_CMSG_CLOEXEC);
+    if (got == -1) return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+    if (got == 0) return -1;
+
+    // descriptors first -- whatever else is wrong with the message, they must not leak
+    int fds[SPAWN_FDS_MAX + 1];
+    int num_fds = 0;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        int count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        int* received = (int*)CMSG_DATA(cmsg);
+        for (int i = 0; i < count; i++) {
+            if (num_fds < SPAWN_FDS_MAX + 1) fds[num_fds++] = received[i];
+            else close(received[i]);
+        }
+    }
+    if (num_fds == 0) return 0;
+    int wait_fd = fds[--num_fds];
+    if ((size_t)got <= offsetof(spawn_request_t, command) || request.arg_len > SPAWN_ARG_MAX ||
+        (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        for (int i = 0; i < num_fds; i++) close(fds[i]);
+        send_reply(wait_fd, -1, 0, EINVAL);
+        close(wait_fd);
+        return 0;
+    }
+    ((char*)&request)[got - 1] = '\0';
+
+    // room for the child before forking it, so a table failure never leaves an unreported child
+    if (num_children == max_children) {
+        size_t new_max = (max_children > 0) ? max_children * 2 : 16;
+        spawn_child_t* grown = realloc(children, new_max * sizeof(spawn_child_t));
+        if (grown == NULL) {
+            for (int i = 0; i < num_fds; i++) close(fds[i]);
+            send_reply(wait_fd, -1, 0, ENOMEM);
+            close(wait_fd);
+            return 0;
+        }
+        children = grown;
+        max_children = new_max;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // command child -- nothing of the helper's own survives into it, the signal mask included
+        // (an ignored signal stays ignored across execvp(), so SIGUSR1 goes back to its default)
+        sigprocmask(SIG_UNBLOCK, &sigchld_mask, NULL);
+        signal(SIGUSR1, SIG_DFL);
+        close(control_fd);
+        close(sigchld_fd);
+        close(wait_fd);
+        for (size_t i = 0; i < num_children; i++) close(children[i].wait_fd);
+        child_main(request.command, request.arg, fds, num_fds);
+        _exit(EXIT_FAILURE);
+    }
+
+    int error = errno;
+    for (int i = 0; i < num_fds; i++) close(fds[i]);
+    if (pid == -1) {
+        send_reply(wait_fd, -1, 0, error);
+        close(wait_fd);
+        return 0;
+    }
+
+    // group set from this side too, so the server can kill(-pid) as soon as it has the pid
+    setpgid(pid, pid);
+    send_reply(wait_fd, pid, 0, 0);
+    children[num_children].pid = pid;
+    children[num_children].wait_fd = wait_fd;
+    num_children++;
+    return 0;
+}
+
+// reaps every exited child and reports its wait status on its launch's wait socket
+static void helper_reap(void) {
+    pid_t pid;
+    int status;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for (size_t i = 0; i < num_children; i++) {
+            if (children[i].pid != pid) continue;
+            send_reply(children[i].wait_fd, pid, status, 0);
+            close(children[i].wait_fd);
+            children[i] = children[--num_children];
+            break;
+        }
+    }
+}
+
+// never blocks -- a reply the server stopped waiting for is simply dropped
+static void send_reply(int fd, pid_t pid, int status, int error) {
+    spawn_reply_t reply;
+    reply.pid = pid;
+    reply.status = status;
+    reply.error = error;
+    if (send(fd, &reply, sizeof(reply), MSG_DONTWAIT | MSG_NOSIGNAL) == -1) {
+        // the server's end is closed -- nothing to report to
+    }
+}
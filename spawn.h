@@ -0,0 +1,56 @@
+// header guard to prevent multiple inclusions of this file
+#ifndef SPAWN_H
+#define SPAWN_H
+
+// spawn.h -- spawn helper ("zygote") that forks command children on the server's behalf
+//
+// fork() copies the caller's page tables, so its cost grows with everything the server holds --
+// sessions, capture buffers, logger and metrics state; the helper is forked once at startup,
+// before any of that exists, and forks every command child from its own small address space
+//
+// a launch goes to the helper over a Unix socket: the command, a small argument blob and the child's
+// descriptors (SCM_RIGHTS); the helper answers on a socket of the launch's own, first with the
+// child's pid, then with its wait status once the helper has reaped it
+// the child is in its own process group (pgid = pid) before its pid is returned
+//
+// usage:
+//   spawn_helper_start(child_main);             // once, before threads and large allocations
+//   spawn_helper_launch(command, &arg, sizeof(arg), fds, 3, &pid, &wait_fd);
+//   ... read the child's output, kill(-pid, ...) if needed ...
+//   spawn_helper_wait(wait_fd, &status);        // instead of waitpid()
+//   spawn_helper_stop();                        // only if the server exits
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define SPAWN_COMMAND_MAX 4096    // longest command, terminator included
+#define SPAWN_ARG_MAX 64          // largest argument blob
+#define SPAWN_FDS_MAX 5           // most descriptors handed to one child
+
+// spawn_helper_launch() result when there is no helper (never started, or died) -- fork the child yourself
+#define SPAWN_HELPER_GONE (-2)
+
+// runs in the command child with the received command, argument blob and descriptors (close-on-exec set) --
+// must not return; if it does, the child exits with EXIT_FAILURE
+typedef void (*spawn_child_fn)(const char* command, const void* arg, const int* fds, int num_fds);
+
+// forks the helper -- call once from the main thread before any other thread is started
+// returns 0 on success, -1 on failure (error already printed)
+int spawn_helper_start(spawn_child_fn child);
+
+// closes the launch socket and reaps the helper -- for a server that exits after starting it
+// children the helper already forked keep running; a no-op without a helper
+void spawn_helper_stop(void);
+
+// has the helper fork a child running the helper's spawn_child_fn -- safe from any thread
+// the caller keeps its own copies of fds and closes them as usual
+// returns 0 with *pid and *wait_fd set, -1 if the helper's fork() failed (errno set),
+// SPAWN_HELPER_GONE if no helper is running
+int spawn_helper_launch(const char* command, const void* arg, size_t arg_len, const int* fds, int num_fds,
+                        pid_t* pid, int* wait_fd);
+
+// waits until the helper has reaped the child of a launch and closes wait_fd
+// returns 0 with *status set (as by waitpid()), -1 if the helper died first
+int spawn_helper_wait(int wait_fd, int* status);
+
+#endif /* SPAWN_H */
@@ -0,0 +1,320 @@
+// spool.c -- command output in memory up to a session budget, in a spill file past it
+// see spool.h
+
+// _GNU_SOURCE for memfd_create(), O_TMPFILE and splice()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>        // pthread_sigmask() around sendfile()
+#include <time.h>           // struct timespec for sigtimedwait()
+#include <sys/mman.h>       // memfd_create()
+#include <sys/sendfile.h>
+#include <sys/socket.h>     // send() for spool_send_some()
+
+#include "spool.h"
+
+
+#define SPOOL_INITIAL (8 * 1024)        // first allocation -- granted even when the budget is used up
+#define SPOOL_MIN_ROOM 4096             // memory grows once less than this is left
+#define SPOOL_COPY_CHUNK (64 * 1024)    // read()/write() fallback where the spill file cannot take splice()
+#define SPOOL_SEARCH_CHUNK (256 * 1024) // spool_find() scans this much at a time
+
+// O_TMPFILE directory for spill files, NULL = memfds -- set once at startup
+static const char* spill_dir = NULL;
+
+// prototypes
+static int charge_budget(spool_budget_t* budget, size_t bytes, int always);
+static void release_budget(spool_budget_t* budget, size_t bytes);
+static int grow_memory(spool_t* spool);
+static int open_spill_file(void);
+static ssize_t spill_read(spool_t* spool, int fd, size_t max);
+static void block_sigpipe(sigset_t* old_set);
+static void restore_sigpipe(const sigset_t* old_set, int failed);
+
+
+void spool_budget_init(spool_budget_t* budget, size_t limit) {
+    budget->limit = limit;
+    budget->used = 0;
+}
+
+int spool_set_directory(const char* dir) {
+    spill_dir = dir;
+    if (dir == NULL) return 0;
+
+    // fail at startup, not on the first large output
+    int fd = open_spill_file();
+    if (fd == -1) {
+        fprintf(stderr, "Error: cannot create spill files in %s: %s\n", dir, strerror(errno));
+        spill_dir = NULL;
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+void spool_init(spool_t* spool, spool_budget_t* budget, size_t max_len) {
+    spool->data = NULL;
+    spool->mem_len = 0;
+    spool->mem_cap = 0;
+    spool->max_len = max_len;
+    spool->fd = -1;
+    spool->file_len = 0;
+    spool->budget = budget;
+}
+
+
+// budget
+// charges bytes to the budget -- 0 if they fit (or always is set), -1 if the budget is used up
+// several threads charge one budget, so the check is on the sum after adding, undone if it went over
+static int charge_budget(spool_budget_t* budget, size_t bytes, int always) {
+    if (budget == NULL) return 0;
+    size_t used = __atomic_add_fetch(&budget->used, bytes, __ATOMIC_RELAXED);
+    if (always || budget->limit == 0 || used <= budget->limit) return 0;
+    __atomic_sub_fetch(&budget->used, bytes, __ATOMIC_RELAXED);
+    return -1;
+}
+
+static void release_budget(spool_budget_t* budget, size_t bytes) {
+    if (budget != NULL) __atomic_sub_fetch(&budget->used, bytes, __ATOMIC_RELAXED);
+}
+
+// doubles the memory part, never past max_len + 1 (one spare byte lets the caller detect overflow)
+// returns 0 on success, -1 if the budget, max_len or malloc says no -- the spool spills instead
+static int grow_memory(spool_t* spool) {
+    size_t cap = (spool->mem_cap == 0) ? SPOOL_INITIAL : spool->mem_cap * 2;
+    if (spool->max_len > 0 && cap > spool->max_len + 1) cap = spool->max_len + 1;
+    if (cap <= spool->mem_cap) return -1;
+
+    size_t grow = cap - spool->mem_cap;
+    if (charge_budget(spool->budget, grow, spool->mem_cap == 0) == -1) return -1;
+    char* data = realloc(spool->data, cap);
+    if (data == NULL) {
+        release_budget(spool->budget, grow);
+        return -1;
+    }
+    spool->data = data;
+    spool->mem_cap = cap;
+    return 0;
+}
+
+
+// reading
+ssize_t spool_read(spool_t* spool, int fd, size_t max) {
+    // once spilled, every later byte goes to the file -- the output stays in order
+    if (spool->fd < 0) {
+        if (spool->mem_cap - spool->mem_len < SPOOL_MIN_ROOM) grow_memory(spool);
+        size_t room = spool->mem_cap - spool->mem_len;
+        if (room > 0) {
+            // read straight into the memory part -- no intermediate copy
+            ssize_t bytes = read(fd, spool->data + spool->mem_len, (max < room) ? max : room);
+            if (bytes > 0) spool->mem_len += (size_t)bytes;
+            return bytes;
+        }
+    }
+    return spill_read(spool, fd, max);
+}
+
+// unlinked from birth -- the file is gone as soon as the spool closes it, even if the server dies
+static int open_spill_file(void) {
+    if (spill_dir != NULL) return open(spill_dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    return memfd_create("spool", MFD_CLOEXEC);
+}
+
+// moves bytes from fd to the end of the spill file -- splice() from a pipe never copies them through the server
+static ssize_t spill_read(spool_t* spool, int fd, size_t max) {
+    if (spool->fd < 0) {
+        spool->fd = open_spill_file();
+        if (spool->fd == -1) return SPOOL_FAILED;
+    }
+
+    loff_t offset = (loff_t)spool->file_len;
+    ssize_t bytes = splice(fd, NULL, spool->fd, &offset, max, 0);
+    if (bytes >= 0) {
+        spool->file_len += (size_t)bytes;
+        return bytes;
+    }
+    if (errno == EINTR) return -1;
+    if (errno != EINVAL) return SPOOL_FAILED;
+
+    // fd is not a pipe, or the spill file system has no splice support -- copy through a buffer
+    char chunk[SPOOL_COPY_CHUNK];
+    bytes = read(fd, chunk, (max < sizeof(chunk)) ? max : sizeof(chunk));
+    if (bytes <= 0) return bytes;
+    for (ssize_t done = 0; done < bytes;) {
+        ssize_t written = pwrite(spool->fd, chunk + done, (size_t)(bytes - done), (off_t)spool->file_len + done);
+        if (written == -1 && errno == EINTR) continue;
+        if (written <= 0) return SPOOL_FAILED;
+        done += written;
+    }
+    spool->file_len += (size_t)bytes;
+    return bytes;
+}
+
+size_t spool_length(const spool_t* spool) {
+    return spool->mem_len + spool->file_len;
+}
+
+void spool_truncate(spool_t* spool, size_t len) {
+    if (len <= spool->mem_len) {
+        spool->mem_len = len;
+        len = 0;
+    } else {
+        len -= spool->mem_len;
+    }
+    if (len < spool->file_len) {
+        spool->file_len = len;
+        // only gives the pages back -- file_len alone decides what is sent
+        if (spool->fd >= 0 && ftruncate(spool->fd, (off_t)len) == -1) {
+            // harmless, the tail past file_len is never read
+        }
+    }
+}
+
+
+// random access
+size_t spool_copy(const spool_t* spool, size_t offset, char* buf, size_t len) {
+    size_t copied = 0;
+    if (offset < spool->mem_len) {
+        copied = (len < spool->mem_len - offset) ? len : spool->mem_len - offset;
+        memcpy(buf, spool->data + offset, copied);
+    }
+    // the rest comes from the spill file -- offsets past data count from its start
+    while (copied < len && spool->fd >= 0) {
+        size_t file_offset = offset + copied - spool->mem_len;
+        if (file_offset >= spool->file_len) break;
+        size_t want = len - copied;
+        if (want > spool->file_len - file_offset) want = spool->file_len - file_offset;
+        ssize_t got = pread(spool->fd, buf + copied, want, (off_t)file_offset);
+        if (got == -1 && errno == EINTR) continue;
+        if (got <= 0) break;
+        copied += (size_t)got;
+    }
+    return copied;
+}
+
+// scans in chunks that overlap by len - 1 bytes, so a match across a chunk boundary (or across the
+// end of data and the start of the spill file) is still found
+int spool_find(const spool_t* spool, size_t from, const char* pattern, size_t len, size_t* found) {
+    size_t total = spool_length(spool);
+    if (len == 0 || len > SPOOL_SEARCH_CHUNK || from >= total) return -1;
+    char* chunk = malloc(SPOOL_SEARCH_CHUNK);
+    if (chunk == NULL) return -1;
+
+    int result = -1;
+    for (size_t offset = from; offset + len <= total; offset += SPOOL_SEARCH_CHUNK - len + 1) {
+        size_t got = spool_copy(spool, offset, chunk, SPOOL_SEARCH_CHUNK);
+        const char* match = memmem(chunk, got, pattern, len);
+        if (match != NULL) {
+            *found = offset + (size_t)(match - chunk);
+            result = 0;
+            break;
+        }
+        if (got < SPOOL_SEARCH_CHUNK) break;
+    }
+    free(chunk);
+    return result;
+}
+
+
+// sending
+// sendfile() has no MSG_NOSIGNAL, so SIGPIPE is blocked for the call; a SIGPIPE raised for it
+// is taken off the thread's pending set before the old mask comes back
+static void block_sigpipe(sigset_t* old_set) {
+    sigset_t pipe_set;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, old_set);
+}
+
+static void restore_sigpipe(const sigset_t* old_set, int failed) {
+    if (failed && errno == EPIPE) {
+        int saved_errno = errno;
+        sigset_t pipe_set;
+        sigemptyset(&pipe_set);
+        sigaddset(&pipe_set, SIGPIPE);
+        struct timespec no_wait = { 0, 0 };
+        sigtimedwait(&pipe_set, NULL, &no_wait);
+        errno = saved_errno;
+    }
+    pthread_sigmask(SIG_SETMASK, old_set, NULL);
+}
+
+int spool_send_file(int fd, const spool_t* spool, size_t offset, size_t len) {
+    if (spool->fd < 0 || len == 0) return 0;
+    if (offset > spool->file_len || len > spool->file_len - offset) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    sigset_t old_set;
+    block_sigpipe(&old_set);
+
+    int result = 0;
+    off_t position = (off_t)offset;
+    off_t end = (off_t)(offset + len);
+    while (position < end) {
+        ssize_t sent = sendfile(fd, spool->fd, &position, (size_t)(end - position));
+        if (sent == -1 && errno == EINTR) continue;
+        if (sent <= 0) {
+            // 0 -- the file is shorter than recorded, nothing more will come
+            if (sent == 0) errno = EIO;
+            result = -1;
+            break;
+        }
+    }
+
+    restore_sigpipe(&old_set, result == -1);
+    return result;
+}
+
+// one send() from memory or one sendfile() from the spill file -- never both, so a full socket
+// buffer costs a single EAGAIN; the caller comes back for the rest
+ssize_t spool_send_some(int fd, const spool_t* spool, size_t offset, size_t len) {
+    if (len == 0) return 0;
+    if (offset > spool_length(spool) || len > spool_length(spool) - offset) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ssize_t sent;
+    if (offset < spool->mem_len) {
+        size_t want = (len < spool->mem_len - offset) ? len : spool->mem_len - offset;
+        do {
+            sent = send(fd, spool->data + offset, want, MSG_DONTWAIT | MSG_NOSIGNAL);
+        } while (sent == -1 && errno == EINTR);
+        return sent;
+    }
+
+    sigset_t old_set;
+    block_sigpipe(&old_set);
+    off_t position = (off_t)(offset - spool->mem_len);
+    do {
+        sent = sendfile(fd, spool->fd, &position, len);
+    } while (sent == -1 && errno == EINTR);
+    if (sent == 0) {
+        errno = EIO;
+        sent = -1;
+    }
+    restore_sigpipe(&old_set, sent == -1);
+    return sent;
+}
+
+void spool_clear(spool_t* spool) {
+    spool->mem_len = 0;
+    if (spool->fd >= 0) close(spool->fd);
+    spool->fd = -1;
+    spool->file_len = 0;
+}
+
+void spool_free(spool_t* spool) {
+    free(spool->data);
+    release_budget(spool->budget, spool->mem_cap);
+    if (spool->fd >= 0) close(spool->fd);
+    spool_init(spool, spool->budget, spool->max_len);
+}
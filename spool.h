@@ -0,0 +1,84 @@
+// header guard to prevent multiple inclusions of this file
+#ifndef SPOOL_H
+#define SPOOL_H
+
+// spool.h -- captured command output, held in memory up to a per-session budget and spilled to a file past it
+//
+// every spool of a session (the foreground command, parallel jobs, background jobs waiting to be fetched)
+// charges the memory it allocates to the session's spool_budget_t; once the budget is used up, a spool
+// keeps what it already holds in memory and appends everything after it to an unlinked spill file --
+// a memfd, or an O_TMPFILE file in the spill directory -- which is sent with sendfile(), so the server's
+// heap stays bounded however large the outputs are
+//
+// usage:
+//   spool_init(&spool, &budget, max_output);
+//   while ((n = spool_read(&spool, pipe_fd, room)) > 0) ...     // straight from the command's pipes
+//   spool_send_file(client_fd, &spool, 0, spool.file_len);        // after sending spool.data itself
+//   spool_free(&spool);
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// spool_read() result when the bytes could not be stored (spill file could not be created or written)
+#define SPOOL_FAILED (-2)
+
+// memory all spools of one session may hold together -- shared by the session's threads
+typedef struct {
+    size_t limit;             // bytes, 0 = unlimited (never spill)
+    size_t used;              // allocated bytes charged -- updated with atomic builtins
+} spool_budget_t;
+
+typedef struct {
+    char* data;               // the first mem_len bytes of the output
+    size_t mem_len;
+    size_t mem_cap;           // allocated bytes -- charged to the budget
+    size_t max_len;           // the most the spool will ever hold, 0 = unknown -- memory never grows past it
+    int fd;                   // spill file with the bytes after data, -1 until the spool spills
+    size_t file_len;
+    spool_budget_t* budget;   // NULL = memory only, no limit
+} spool_t;
+
+
+// sets up a session's budget
+void spool_budget_init(spool_budget_t* budget, size_t limit);
+
+// spill files go to dir as O_TMPFILE files instead of memfds -- NULL for memfds
+// call before any spool is used; returns 0 on success, -1 if dir cannot hold one (error already printed)
+int spool_set_directory(const char* dir);
+
+// an empty spool charging budget (NULL for none) -- allocates nothing yet
+void spool_init(spool_t* spool, spool_budget_t* budget, size_t max_len);
+
+// reads at most max bytes from fd into the spool -- into memory while the budget allows, else into the spill file
+// returns the bytes read, 0 at end of file, -1 on a read error (errno set), SPOOL_FAILED if they could not be stored
+ssize_t spool_read(spool_t* spool, int fd, size_t max);
+
+// bytes held in memory and in the spill file together
+size_t spool_length(const spool_t* spool);
+
+// drops everything past len bytes
+void spool_truncate(spool_t* spool, size_t len);
+
+// copies up to len bytes from offset (counted over memory and spill file together) into buf
+// returns the bytes copied -- fewer at the end of the spool or if the spill file cannot be read
+size_t spool_copy(const spool_t* spool, size_t offset, char* buf, size_t len);
+
+// finds the first occurrence of pattern at or after offset from -- returns 0 with *found set, -1 if there is none
+int spool_find(const spool_t* spool, size_t from, const char* pattern, size_t len, size_t* found);
+
+// sends len bytes of the spill file, from offset within it, with sendfile() -- returns 0 on success, -1 on failure
+// a vanished peer gives EPIPE, never SIGPIPE
+int spool_send_file(int fd, const spool_t* spool, size_t offset, size_t len);
+
+// sends up to len bytes from offset (counted over memory and spill file together) with a single send()
+// or sendfile() that does not wait -- fd must be non-blocking for the spill file part
+// returns the bytes sent, -1 on failure (errno set, EAGAIN when the socket buffer is full); EPIPE, never SIGPIPE
+ssize_t spool_send_some(int fd, const spool_t* spool, size_t offset, size_t len);
+
+// drops everything the spool holds but keeps its memory for what is read next -- the spill file is closed
+void spool_clear(spool_t* spool);
+
+// frees the memory (and returns it to the budget) and closes the spill file -- the spool is empty afterwards
+void spool_free(spool_t* spool);
+
+#endif /* SPOOL_H */
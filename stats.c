@@ -0,0 +1,120 @@
+// stats.c -- server-wide per-phase latency statistics, see stats.h
+// one lock guards everything -- it is taken once per command, which costs
+// at least a fork() and an exec(), so it is never the bottleneck
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>        // clock_gettime() for the uptime line
+#include <pthread.h>
+
+#include "histogram.h"
+#include "stats.h"
+
+
+#define STATS_REPORT_SIZE 4096
+
+// short names indexed by phase_t
+static const char* const phase_names[PHASE_COUNT] = {
+    "fork", "parse", "spawn", "exec", "run", "capture", "reap", "send", "total"
+};
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static histogram_t phase_latency[PHASE_COUNT];      // nanoseconds
+static uint64_t status_counts[REPLY_ERROR + 1];     // indexed by reply_status_t
+static uint64_t requests;
+static double stats_since;                          // CLOCK_MONOTONIC seconds of the last reset, 0 = never
+static int stats_ready;
+
+
+// CLOCK_MONOTONIC in seconds
+static double stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// clears everything -- caller holds stats_lock
+static void stats_clear_locked(void) {
+    for (int i = 0; i < PHASE_COUNT; i++) hist_init(&phase_latency[i]);
+    memset(status_counts, 0, sizeof(status_counts));
+    requests = 0;
+    stats_since = stats_now();
+    stats_ready = 1;
+}
+
+
+const char* phase_name(phase_t phase) {
+    if ((int)phase < 0 || phase >= PHASE_COUNT) return "unknown";
+    return phase_names[phase];
+}
+
+void timing_clear(request_timing_t* timing) {
+    for (int i = 0; i < PHASE_COUNT; i++) timing->phase[i] = -1.0;
+}
+
+int timing_format(const request_timing_t* timing, char* buf, size_t size) {
+    size_t len = 0;
+    if (size > 0) buf[0] = '\0';
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        if (timing->phase[i] < 0) continue;
+        int n = snprintf(buf + len, size - len, "%s%s=%.3f", (len > 0) ? " " : "", phase_names[i], timing->phase[i] * 1e3);
+        if (n < 0 || (size_t)n >= size - len) break;
+        len += (size_t)n;
+    }
+    return (int)len;
+}
+
+void stats_record(const request_timing_t* timing, reply_status_t status) {
+    pthread_mutex_lock(&stats_lock);
+    if (!stats_ready) stats_clear_locked();
+
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        if (timing->phase[i] >= 0) hist_record(&phase_latency[i], (uint64_t)(timing->phase[i] * 1e9));
+    }
+    if ((int)status >= 0 && status <= REPLY_ERROR) status_counts[status]++;
+    requests++;
+
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void stats_reset(void) {
+    pthread_mutex_lock(&stats_lock);
+    stats_clear_locked();
+    pthread_mutex_unlock(&stats_lock);
+}
+
+char* stats_report(size_t* len) {
+    char* report = malloc(STATS_REPORT_SIZE);
+    if (report == NULL) return NULL;
+
+    pthread_mutex_lock(&stats_lock);
+    if (!stats_ready) stats_clear_locked();
+
+    size_t used = 0;
+    used += (size_t)snprintf(report + used, STATS_REPORT_SIZE - used, "requests %llu in %.1f s --",
+                             (unsigned long long)requests, stats_now() - stats_since);
+    for (int s = REPLY_OK; s <= REPLY_ERROR; s++) {
+        used += (size_t)snprintf(report + used, STATS_REPORT_SIZE - used, " %s=%llu",
+                                 reply_status_name((reply_status_t)s), (unsigned long long)status_counts[s]);
+    }
+    used += (size_t)snprintf(report + used, STATS_REPORT_SIZE - used, "\n%-8s %8s %9s %9s %9s %9s %9s %9s  (ms)\n",
+                             "phase", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        const histogram_t* h = &phase_latency[i];
+        used += (size_t)snprintf(report + used, STATS_REPORT_SIZE - used, "%-8s %8llu %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+                                 phase_names[i], (unsigned long long)h->total, hist_mean(h) / 1e6,
+                                 (double)hist_percentile(h, 50.0) / 1e6, (double)hist_percentile(h, 90.0) / 1e6,
+                                 (double)hist_percentile(h, 99.0) / 1e6, (double)hist_percentile(h, 99.9) / 1e6,
+                                 (double)h->max / 1e6);
+    }
+
+    pthread_mutex_unlock(&stats_lock);
+
+    *len = used;
+    return report;
+}
@@ -0,0 +1,54 @@
+// header guard to prevent multiple inclusions of this file
+#ifndef STATS_H
+#define STATS_H
+
+// stats.h -- per-phase latency statistics for the server
+//
+// every command the server runs is split into phases, each timed with CLOCK_MONOTONIC
+// and recorded into a per-phase histogram; the "stats" request prints them
+// phases measured in the command child (parse, spawn, exec, run) come back over a report pipe
+
+#include <stddef.h>
+
+#include "protocol.h"
+
+// phases of one request, in the order they happen
+typedef enum {
+    PHASE_FORK,               // server: fork() of the command child
+    PHASE_PARSE,              // child: parse_pipeline()
+    PHASE_SPAWN,              // child: forking every pipeline stage
+    PHASE_EXEC,               // child: until every stage has exec'd (or exited)
+    PHASE_RUN,                // child: until every stage has exited
+    PHASE_CAPTURE,            // server: capture loop, fork to output pipes closed
+    PHASE_REAP,               // server: waitpid() of the command child
+    PHASE_SEND,               // server: sending the reply frames
+    PHASE_TOTAL,              // server: request line received to reply sent
+    PHASE_COUNT
+} phase_t;
+
+// seconds spent in each phase of one request -- negative = not measured
+typedef struct {
+    double phase[PHASE_COUNT];
+} request_timing_t;
+
+
+// returns the short name of a phase ("fork", "exec", ...)
+const char* phase_name(phase_t phase);
+
+// marks every phase of a timing as not measured
+void timing_clear(request_timing_t* timing);
+
+// formats a timing as "fork=0.210 parse=0.004 ..." in milliseconds -- returns the length written
+int timing_format(const request_timing_t* timing, char* buf, size_t size);
+
+// adds one finished request to the server-wide statistics -- thread safe
+void stats_record(const request_timing_t* timing, reply_status_t status);
+
+// clears the server-wide statistics -- thread safe
+void stats_reset(void);
+
+// renders the server-wide statistics as a text table
+// returns a malloc'd string (caller frees) and its length, NULL on allocation failure
+char* stats_report(size_t* len);
+
+#endif /* STATS_H */
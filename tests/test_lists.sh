@@ -0,0 +1,81 @@
+#!/bin/sh
+# checks command lists (;, &&, ||, ( ) groups) in the Phase 1 shell -- run from the repo root: make test-lists
+# each case feeds one line to ./myshell and compares everything it prints (prompts stripped) with the expected text
+
+SHELL_BIN=${SHELL_BIN:-./myshell}
+TMP=${TMPDIR:-/tmp}/test_lists.$$
+pass=0
+fail=0
+
+trap 'rm -f "$TMP".*' EXIT
+
+# check <name> <command line> <expected output>
+check() {
+    printf '%s\n' "$2" | "$SHELL_BIN" 2>&1 | sed -e 's/^\(\$ \)*//' -e '/^$/d' > "$TMP.out"
+    printf '%s\n' "$3" | sed -e '/^$/d' > "$TMP.exp"
+    if cmp -s "$TMP.out" "$TMP.exp"; then
+        pass=$((pass + 1))
+    else
+        fail=$((fail + 1))
+        echo "FAIL: $1"
+        echo "  input:    $2"
+        echo "  expected: $(cat "$TMP.exp")"
+        echo "  got:      $(cat "$TMP.out")"
+    fi
+}
+
+# sequencing
+check "semicolon"           'echo a; echo b'                      'a
+b'
+check "trailing semicolon"  'echo a; echo b;'                     'a
+b'
+check "failure continues"   'false; echo after'                   'after'
+
+# short-circuit
+check "and runs on success" 'true && echo yes'                    'yes'
+check "and skips on fail"   'false && echo no'                    ''
+check "or runs on fail"     'false || echo yes'                   'yes'
+check "or skips on success" 'true || echo no'                     ''
+check "left to right"       'true && false || echo r'             'r'
+check "or then and"         'false || true && echo both'          'both'
+
+# groups
+check "group status"        '(false) && echo no || echo yes'      'yes'
+check "nested groups"       '(echo 1; (false && echo 2) || echo 3)' '1
+3'
+check "group is a subshell" "(cd / && pwd); pwd | grep -c '^/\$'" '/
+0'
+check "group into pipe"     '(echo x; echo y) | wc -l'            '2'
+check "pipe status"         '(false) | true && echo ok'           'ok'
+check "group redirection"   "(echo a; echo b) > $TMP.file; cat $TMP.file" 'a
+b'
+check "group in a list"     'false || (echo z | tr z Z)'          'Z'
+
+# quoting -- operators inside quotes are plain text
+check "quoted semicolon"    "echo 'a;b'"                          'a;b'
+check "quoted and"          'echo "x && y"'                       'x && y'
+check "quoted paren"        "echo '(a)' && echo ')'"              '(a)
+)'
+
+# syntax errors -- nothing runs
+check "missing before"      '; echo a'                            "Error: Missing command before ';'
+Error: Invalid command '; echo a'"
+check "missing after"       'echo a &&'                           "Error: Missing command after '&&'
+Error: Invalid command 'echo a &&'"
+check "doubled operator"    'echo a || || echo b'                 "Error: Missing command before '||'
+Error: Invalid command 'echo a || || echo b'"
+check "unclosed group"      '(echo a'                             "Error: Unbalanced parentheses
+Error: Invalid command '(echo a'"
+check "stray paren"         'echo a)'                             "Error: Unbalanced parentheses
+Error: Invalid command 'echo a)'"
+check "empty group"         '()'                                  "Error: Empty command group
+Error: Invalid command '()'"
+check "text after group"    '(echo a) foo'                        "Error: Unexpected text after command group: foo
+Error: Invalid command '(echo a) foo'"
+check "group after pipe"    'echo x | (cat)'                      "Error: A command group can only be the first stage of a pipeline: echo x | (cat)
+Error: Invalid command 'echo x | (cat)'"
+check "nothing after pipe"  '(echo q) |'                          "Error: Command missing after pipe
+Error: Invalid command '(echo q) |'"
+
+echo "test_lists: $pass passed, $fail failed"
+[ "$fail" -eq 0 ]
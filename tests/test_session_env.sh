@@ -0,0 +1,79 @@
+#!/bin/sh
+# checks a session's export/unset state in the server -- run from the repo root: make test-session
+# each case starts a server with a known environment (env -i), sends its lines through ./client and compares
+# what the client prints with the expected text; the server must still be up at the end of every case
+
+SERVER_BIN=${SERVER_BIN:-./server}
+CLIENT_BIN=${CLIENT_BIN:-./client}
+PORT=${PORT:-$((20000 + $$ % 10000))}
+TMP=${TMPDIR:-/tmp}/test_session_env.$$
+pass=0
+fail=0
+server_pid=
+
+stop_server() {
+    if [ -n "$server_pid" ]; then
+        kill "$server_pid" 2>/dev/null
+        wait "$server_pid" 2>/dev/null
+        server_pid=
+    fi
+}
+trap 'stop_server; rm -f "$TMP".*' EXIT
+
+# check <name> <server environment> <lines to send> <expected output>
+check() {
+    env -i $2 "$SERVER_BIN" -p "$PORT" -l error > "$TMP.log" 2>&1 &
+    server_pid=$!
+    sleep 0.5
+    printf '%s\n' "$3" | "$CLIENT_BIN" 127.0.0.1 "$PORT" > "$TMP.out" 2>&1
+    printf '%s\n' "$4" > "$TMP.exp"
+    if ! kill -0 "$server_pid" 2>/dev/null; then
+        fail=$((fail + 1))
+        echo "FAIL: $1 -- the server died"
+        sed -e 's/^/  /' "$TMP.log"
+    elif cmp -s "$TMP.out" "$TMP.exp"; then
+        pass=$((pass + 1))
+    else
+        fail=$((fail + 1))
+        echo "FAIL: $1"
+        echo "  expected:"
+        sed -e 's/^/    /' "$TMP.exp"
+        echo "  got:"
+        sed -e 's/^/    /' "$TMP.out"
+    fi
+    stop_server
+}
+
+check "export lists the session" '' 'export A=1
+export' '[exit 0] export A=1
+A=1
+[exit 0] export'
+
+check "unset the server's variable" 'FOO=x' 'unset FOO
+export B=2
+export' '[exit 0] unset FOO
+[exit 0] export B=2
+B=2
+[exit 0] export'
+
+# every variable unset leaves an empty block -- the next change must not read past it
+check "export after unsetting everything" '' 'export A=1
+unset A
+export B=2
+unset B
+export C=3
+export' '[exit 0] export A=1
+[exit 0] unset A
+[exit 0] export B=2
+[exit 0] unset B
+[exit 0] export C=3
+C=3
+[exit 0] export'
+
+check "commands run with an empty environment" 'FOO=x' 'unset FOO
+env | wc -l' '[exit 0] unset FOO
+0
+[exit 0] env | wc -l'
+
+echo "test_session_env: $pass passed, $fail failed"
+[ "$fail" -eq 0 ]